@@ -0,0 +1,371 @@
+/*
+
+  AsyncIO
+
+  The buffers form a ring.  A file being read has every buffer but the
+  one being read from out with the file system, in file order, and each
+  buffer that is read to the end is sent out again behind the others.
+  A file being written sends each buffer as it fills and only waits when
+  the next one is still out.  A file system serves the packets for one
+  file in the order they arrive, so data is never out of place.
+
+  This program is released under the MIT License.
+*/
+
+#include <dos/dos.h>
+#include <dos/dosextens.h>
+#include <exec/memory.h>
+#include <exec/ports.h>
+#include <exec/types.h>
+#include <proto/dos.h>
+#include <proto/exec.h>
+#include <string.h>
+
+#include "AsyncIO.h"
+
+#define BLOCK_SIZE 512 /* Buffers are whole blocks, so the file system can transfer them directly */
+
+struct AsyncFile
+{
+  BPTR file;
+  struct MsgPort *handler;  /* The file system; NULL if Read() and Write() are used */
+  LONG  handler_arg;        /* The file system's own reference to the file */
+  struct MsgPort *port;     /* Packets come back here */
+  struct StandardPacket packets[ASYNC_MAX_BUFFERS];
+  BOOL  pending[ASYNC_MAX_BUFFERS];   /* Out with the file system */
+  BOOL  requested[ASYNC_MAX_BUFFERS]; /* Sent to be read, and the data not yet taken */
+  LONG  results[ASYNC_MAX_BUFFERS];   /* Bytes each packet read or wrote when it came back, or -1 */
+  UBYTE *buffers[ASYNC_MAX_BUFFERS];
+  UBYTE *memory;
+  int   mode;
+  int   num_buffers;
+  ULONG buffer_size;        /* Of each buffer */
+  int   current;            /* The buffer being read from or filled */
+  ULONG used;               /* Bytes of it already read or filled */
+  ULONG length;             /* Bytes in it, when reading */
+  ULONG position;           /* Of its first byte in the file, when reading */
+  LONG  error;
+};
+
+/* Keeps the first error, using fallback if the file system gave no code */
+static void note_error(struct AsyncFile *file, LONG error, LONG fallback)
+{
+  if (file->error == 0)
+  {
+    file->error = error != 0 ? error : fallback;
+  }
+}
+
+static void send_packet(struct AsyncFile *file, int n, LONG action, ULONG length)
+{
+  struct DosPacket *packet = &file->packets[n].sp_Pkt;
+
+  packet->dp_Type = action;
+  packet->dp_Arg1 = file->handler_arg;
+  packet->dp_Arg2 = (LONG)file->buffers[n];
+  packet->dp_Arg3 = (LONG)length;
+  SendPkt(packet, file->handler, file->port);
+  file->pending[n] = TRUE;
+  file->requested[n] = action == ACTION_READ;
+}
+
+/* Takes in a packet that has come back, keeping its result and any error */
+static void take_packet(struct AsyncFile *file, int n)
+{
+  struct DosPacket *packet = &file->packets[n].sp_Pkt;
+
+  file->pending[n] = FALSE;
+  file->results[n] = packet->dp_Res1;
+  if (packet->dp_Res1 < 0)
+  {
+    note_error(file, packet->dp_Res2, ERROR_OBJECT_NOT_FOUND);
+    file->results[n] = -1;
+  }
+  else if (packet->dp_Type == ACTION_WRITE && packet->dp_Res1 != packet->dp_Arg3)
+  {
+    /* A short write without a reason is a full disk */
+    note_error(file, packet->dp_Res2, ERROR_DISK_FULL);
+    file->results[n] = -1;
+  }
+}
+
+/*
+ * Waits for buffer n to come back, taking in any others that come back
+ * first, so a failed write is noted even when its buffer is not waited
+ * for.  Returns the number of bytes read or written, or -1 if the packet
+ * failed.
+ */
+static LONG wait_packet(struct AsyncFile *file, int n)
+{
+  struct Message *message;
+
+  while (file->pending[n])
+  {
+    WaitPort(file->port);
+    while ((message = GetMsg(file->port)) != NULL)
+    {
+      take_packet(file, (struct StandardPacket *)message - file->packets);
+    }
+  }
+  return file->results[n];
+}
+
+static void wait_all(struct AsyncFile *file)
+{
+  int i;
+
+  for (i = 0; i < file->num_buffers; i++)
+  {
+    if (file->pending[i])
+    {
+      wait_packet(file, i);
+    }
+  }
+}
+
+/* Sends every buffer but the current one, which is left empty, to be read from position on */
+static void start_reading(struct AsyncFile *file, ULONG position)
+{
+  int i;
+
+  for (i = 0; i < file->num_buffers; i++)
+  {
+    file->requested[i] = FALSE;
+  }
+  file->current = file->num_buffers - 1;
+  file->used = 0;
+  file->length = 0;
+  file->position = position;
+  for (i = 0; i < file->current; i++)
+  {
+    send_packet(file, i, ACTION_READ, file->buffer_size);
+  }
+}
+
+/*
+ * Moves a file being read on to its next buffer and sends the one given
+ * up for more.  Returns the bytes in the new buffer, 0 once the file has
+ * ended or -1 on an error.
+ */
+static LONG next_buffer(struct AsyncFile *file)
+{
+  int next = (file->current + 1) % file->num_buffers;
+  LONG count;
+
+  if (!file->requested[next])
+  {
+    /* Nothing more was asked for, since the file ended */
+    return file->error != 0 ? -1 : 0;
+  }
+  file->requested[next] = FALSE;
+  count = wait_packet(file, next);
+  if (count < 0)
+  {
+    return -1;
+  }
+  if (count > 0)
+  {
+    send_packet(file, file->current, ACTION_READ, file->buffer_size);
+  }
+  file->position += file->length;
+  file->length = count;
+  file->used = 0;
+  file->current = next;
+  return count;
+}
+
+struct AsyncFile *async_attach(BPTR file, int mode, ULONG buffer_size, int num_buffers)
+{
+  struct AsyncFile *async;
+  struct FileHandle *handle = (struct FileHandle *)BADDR(file);
+  LONG position;
+  int i;
+
+  async = (struct AsyncFile *)AllocVec(sizeof(struct AsyncFile), MEMF_PUBLIC | MEMF_CLEAR);
+  if (async == NULL)
+  {
+    return NULL;
+  }
+  async->file = file;
+  async->mode = mode;
+
+  if (num_buffers > ASYNC_MAX_BUFFERS)
+  {
+    num_buffers = ASYNC_MAX_BUFFERS;
+  }
+  async->buffer_size = num_buffers >= 2 ? (buffer_size / num_buffers) & ~(ULONG)(BLOCK_SIZE - 1) : 0;
+  position = mode == ASYNC_READ ? Seek(file, 0, OFFSET_CURRENT) : 0;
+
+  /* Without a file system, buffers or a port the file is used as it is */
+  if (handle->fh_Type == NULL || async->buffer_size == 0 || position < 0)
+  {
+    return async;
+  }
+  async->memory = (UBYTE *)AllocVec(async->buffer_size * num_buffers, MEMF_PUBLIC);
+  async->port = async->memory != NULL ? CreateMsgPort() : NULL;
+  if (async->port == NULL)
+  {
+    if (async->memory != NULL)
+    {
+      FreeVec(async->memory);
+      async->memory = NULL;
+    }
+    return async;
+  }
+
+  async->handler = handle->fh_Type;
+  async->handler_arg = handle->fh_Arg1;
+  async->num_buffers = num_buffers;
+  for (i = 0; i < num_buffers; i++)
+  {
+    async->buffers[i] = async->memory + i * async->buffer_size;
+    async->packets[i].sp_Msg.mn_Node.ln_Name = (char *)&async->packets[i].sp_Pkt;
+    async->packets[i].sp_Pkt.dp_Link = &async->packets[i].sp_Msg;
+  }
+  if (mode == ASYNC_READ)
+  {
+    start_reading(async, (ULONG)position);
+  }
+  return async;
+}
+
+LONG async_read(APTR handle, UBYTE *buffer, LONG length)
+{
+  struct AsyncFile *file = (struct AsyncFile *)handle;
+  LONG done = 0, count;
+
+  if (file->handler == NULL)
+  {
+    count = Read(file->file, buffer, length);
+    if (count < 0)
+    {
+      note_error(file, IoErr(), ERROR_OBJECT_NOT_FOUND);
+    }
+    return count;
+  }
+  if (file->error != 0)
+  {
+    return -1;
+  }
+
+  while (done < length)
+  {
+    if (file->used == file->length)
+    {
+      count = next_buffer(file);
+      if (count < 0)
+      {
+        return -1;
+      }
+      if (count == 0)
+      {
+        break;
+      }
+    }
+    count = length - done;
+    if ((ULONG)count > file->length - file->used)
+    {
+      count = file->length - file->used;
+    }
+    memcpy(buffer + done, file->buffers[file->current] + file->used, count);
+    file->used += count;
+    done += count;
+  }
+  return done;
+}
+
+LONG async_write(APTR handle, const UBYTE *data, LONG length)
+{
+  struct AsyncFile *file = (struct AsyncFile *)handle;
+  ULONG count, left = (ULONG)length;
+
+  if (file->handler == NULL)
+  {
+    if (Write(file->file, (APTR)data, length) != length)
+    {
+      note_error(file, IoErr(), ERROR_DISK_FULL);
+      return -1;
+    }
+    return length;
+  }
+
+  while (left > 0 && file->error == 0)
+  {
+    count = file->buffer_size - file->used;
+    if (count > left)
+    {
+      count = left;
+    }
+    memcpy(file->buffers[file->current] + file->used, data, count);
+    file->used += count;
+    data += count;
+    left -= count;
+
+    if (file->used == file->buffer_size)
+    {
+      send_packet(file, file->current, ACTION_WRITE, file->used);
+      file->current = (file->current + 1) % file->num_buffers;
+      file->used = 0;
+      if (file->pending[file->current])
+      {
+        wait_packet(file, file->current);
+      }
+    }
+  }
+  return file->error == 0 ? length : -1;
+}
+
+BOOL async_seek(struct AsyncFile *file, ULONG position)
+{
+  if (file->handler != NULL && position >= file->position &&
+      position < file->position + file->length + (file->num_buffers - 1) * file->buffer_size)
+  {
+    /* Already read, or on its way */
+    while (position > file->position + file->length)
+    {
+      if (next_buffer(file) <= 0)
+      {
+        /* Past the end, where reads find nothing */
+        file->used = file->length;
+        return file->error == 0;
+      }
+    }
+    file->used = position - file->position;
+    return TRUE;
+  }
+
+  wait_all(file);
+  if (Seek(file->file, (LONG)position, OFFSET_BEGINNING) < 0)
+  {
+    note_error(file, IoErr(), ERROR_SEEK_ERROR);
+    return FALSE;
+  }
+  if (file->handler != NULL)
+  {
+    start_reading(file, position);
+  }
+  return TRUE;
+}
+
+LONG async_close(struct AsyncFile *file)
+{
+  LONG error;
+
+  if (file->handler != NULL)
+  {
+    if (file->mode == ASYNC_WRITE && file->used > 0 && file->error == 0)
+    {
+      send_packet(file, file->current, ACTION_WRITE, file->used);
+    }
+    wait_all(file);
+    DeleteMsgPort(file->port);
+    FreeVec(file->memory);
+  }
+  if (!Close(file->file))
+  {
+    note_error(file, IoErr(), ERROR_DISK_FULL);
+  }
+  error = file->error;
+  FreeVec(file);
+  return error;
+}
@@ -0,0 +1,59 @@
+/*
+
+  AsyncIO
+
+  Reads and writes a file through several buffers with DOS packets sent
+  straight to its file system, without waiting for them, in the manner
+  of asyncio.library.  While the program works on one buffer the file
+  system fills or empties the others, so on a single 68000 a slow source
+  such as PC0: or a CF card, the target disk and the decoder all keep
+  busy at once instead of taking turns.
+
+  Files on handlers that take no packets, such as NIL:, and files for
+  which there is no memory for the buffers are simply read and written
+  with Read() and Write().
+
+  This program is released under the MIT License.
+*/
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include <exec/types.h>
+#include <dos/dos.h>
+
+#define ASYNC_READ 0
+#define ASYNC_WRITE 1
+
+#define ASYNC_MAX_BUFFERS 4
+
+struct AsyncFile;
+
+/*
+ * Takes over a file just opened, which async_close() then closes; it must
+ * not be used directly until then.  buffer_size is shared between
+ * num_buffers buffers, up to ASYNC_MAX_BUFFERS.  A file being read
+ * starts reading ahead at once.  Returns NULL if out of memory, in which
+ * case the file is left open.
+ */
+struct AsyncFile *async_attach(BPTR file, int mode, ULONG buffer_size, int num_buffers);
+
+/* Return the number of bytes read or written, or -1 on an error; an LhaReadFunc and an LhaWriteFunc */
+LONG async_read(APTR file, UBYTE *buffer, LONG length);
+LONG async_write(APTR file, const UBYTE *data, LONG length);
+
+/*
+ * Moves a file being read to a position from its start.  A position in
+ * data already read or on its way is reached without asking the file
+ * system.  Returns FALSE on an error.
+ */
+BOOL async_seek(struct AsyncFile *file, ULONG position);
+
+/*
+ * Writes what is left, waits for every packet and closes the file.
+ * Returns 0, or the IoErr() code of the first error since the file was
+ * attached.
+ */
+LONG async_close(struct AsyncFile *file);
+
+#endif
@@ -0,0 +1,1157 @@
+/*
+
+  Catalogue
+
+  Stored as arrays rather than records: one array per field of the
+  archives, of the members and of the path tree, each doubling in size
+  when it fills, so walking the members reads memory in order and a
+  member costs 19 bytes plus its name.  A path node is a parent node and
+  an offset in one pool of NUL-terminated names, found again through a
+  hash of the two, so a name is only stored once below each directory.
+  Totals are kept in KB with the bytes left over carried separately, so
+  a catalogue of several gigabytes still fits in 32 bits.
+
+  This program is released under the MIT License.
+*/
+
+#include <dos/dos.h>
+#include <exec/memory.h>
+#include <exec/semaphores.h>
+#include <exec/types.h>
+#include <proto/dos.h>
+#include <proto/exec.h>
+#include <string.h>
+
+#include "Catalogue.h"
+
+#define FIRST_ARCHIVES 256
+#define FIRST_DIRECTORIES 256
+#define FIRST_MEMBERS 4096
+#define FIRST_NODES 1024
+#define FIRST_NAMES 16384
+#define FIRST_BUCKETS 1024 /* Must be a power of two */
+#define FNV_OFFSET 2166136261UL
+#define FNV_PRIME 16777619UL
+#define INDEX_MAGIC 0x57484449 /* "WHDI" */
+#define INDEX_VERSION 1
+
+static const char *method_names[] = {
+    "-lh0-", "-lh1-", "-lh2-", "-lh3-", "-lh4-", "-lh5-", "-lh6-", "-lh7-", "-lhd-", "-lzs-", "-lz4-", "-lz5-"};
+
+#define NUM_METHODS (sizeof(method_names) / sizeof(method_names[0]))
+
+struct Catalogue
+{
+  struct SignalSemaphore lock; /* Inventory jobs add archives at the same time */
+
+  /* Archives */
+  ULONG *archive_path;
+  LONG  *archive_size;
+  LONG  *archive_members;
+  ULONG *archive_first;
+  ULONG *archive_packed;
+  ULONG *archive_original;
+  UBYTE *archive_type;
+  UBYTE *archive_native;
+  struct DateStamp *archive_date;
+  ULONG *order;        /* Archive numbers as last sorted, or NULL */
+  ULONG num_archives, archive_capacity;
+
+  /* Members of every archive, each archive's together */
+  ULONG *member_path;
+  ULONG *member_packed;
+  ULONG *member_original;
+  ULONG *member_time;
+  UWORD *member_crc;
+  UBYTE *member_method;
+  ULONG num_members, member_capacity;
+
+  /* Directories scanned, with their dates for the index */
+  ULONG *directory_path;
+  struct DateStamp *directory_date;
+  ULONG num_directories, directory_capacity;
+
+  /* Path tree: node n is names + node_name[n], inside node_parent[n] */
+  ULONG *node_parent;
+  ULONG *node_name;
+  ULONG *node_next;    /* Next node in the same hash bucket */
+  ULONG num_nodes, node_capacity;
+  ULONG *buckets;
+  ULONG num_buckets;   /* Always a power of two */
+  char *names;
+  ULONG names_used, names_capacity;
+
+  ULONG kb_packed, bytes_packed;
+  ULONG kb_original, bytes_original;
+};
+
+/* Moves an array to a new block with room for capacity elements */
+static BOOL resize(APTR *array, ULONG element_size, ULONG used, ULONG capacity)
+{
+  APTR block;
+
+  block = AllocVec(capacity * element_size, MEMF_ANY);
+  if (block == NULL)
+  {
+    return FALSE;
+  }
+  if (*array != NULL)
+  {
+    memcpy(block, *array, used * element_size);
+    FreeVec(*array);
+  }
+  *array = block;
+  return TRUE;
+}
+
+static void free_array(APTR array)
+{
+  if (array != NULL)
+  {
+    FreeVec(array);
+  }
+}
+
+/* The capacity after doubling from first until needed fits */
+static ULONG grown_capacity(ULONG capacity, ULONG first, ULONG needed)
+{
+  if (capacity == 0)
+  {
+    capacity = first;
+  }
+  while (capacity < needed)
+  {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+static BOOL reserve_archives(struct Catalogue *catalogue)
+{
+  ULONG used = catalogue->num_archives, capacity;
+
+  if (used < catalogue->archive_capacity)
+  {
+    return TRUE;
+  }
+  capacity = grown_capacity(catalogue->archive_capacity, FIRST_ARCHIVES, used + 1);
+  if (!resize((APTR *)&catalogue->archive_path, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->archive_size, sizeof(LONG), used, capacity) ||
+      !resize((APTR *)&catalogue->archive_members, sizeof(LONG), used, capacity) ||
+      !resize((APTR *)&catalogue->archive_first, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->archive_packed, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->archive_original, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->archive_type, sizeof(UBYTE), used, capacity) ||
+      !resize((APTR *)&catalogue->archive_native, sizeof(UBYTE), used, capacity) ||
+      !resize((APTR *)&catalogue->archive_date, sizeof(struct DateStamp), used, capacity))
+  {
+    return FALSE;
+  }
+  catalogue->archive_capacity = capacity;
+  return TRUE;
+}
+
+static BOOL reserve_directories(struct Catalogue *catalogue)
+{
+  ULONG used = catalogue->num_directories, capacity;
+
+  if (used < catalogue->directory_capacity)
+  {
+    return TRUE;
+  }
+  capacity = grown_capacity(catalogue->directory_capacity, FIRST_DIRECTORIES, used + 1);
+  if (!resize((APTR *)&catalogue->directory_path, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->directory_date, sizeof(struct DateStamp), used, capacity))
+  {
+    return FALSE;
+  }
+  catalogue->directory_capacity = capacity;
+  return TRUE;
+}
+
+static BOOL reserve_members(struct Catalogue *catalogue, ULONG count)
+{
+  ULONG used = catalogue->num_members, capacity;
+
+  if (used + count <= catalogue->member_capacity)
+  {
+    return TRUE;
+  }
+  capacity = grown_capacity(catalogue->member_capacity, FIRST_MEMBERS, used + count);
+  if (!resize((APTR *)&catalogue->member_path, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->member_packed, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->member_original, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->member_time, sizeof(ULONG), used, capacity) ||
+      !resize((APTR *)&catalogue->member_crc, sizeof(UWORD), used, capacity) ||
+      !resize((APTR *)&catalogue->member_method, sizeof(UBYTE), used, capacity))
+  {
+    return FALSE;
+  }
+  catalogue->member_capacity = capacity;
+  return TRUE;
+}
+
+static ULONG hash_name(ULONG parent, const char *name, ULONG length)
+{
+  ULONG hash = FNV_OFFSET, i;
+
+  for (i = 0; i < 4; i++)
+  {
+    hash = (hash ^ (parent & 0xFF)) * FNV_PRIME;
+    parent >>= 8;
+  }
+  for (i = 0; i < length; i++)
+  {
+    hash = (hash ^ (UBYTE)name[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static void empty_buckets(ULONG *buckets, ULONG num_buckets)
+{
+  ULONG i;
+
+  for (i = 0; i < num_buckets; i++)
+  {
+    buckets[i] = CATALOGUE_NO_NODE;
+  }
+}
+
+/* Doubles the hash table; if there is no memory the chains just grow longer */
+static void rehash(struct Catalogue *catalogue)
+{
+  ULONG *buckets, num_buckets = catalogue->num_buckets * 2, node, bucket;
+  const char *name;
+
+  buckets = (ULONG *)AllocVec(num_buckets * sizeof(ULONG), MEMF_ANY);
+  if (buckets == NULL)
+  {
+    return;
+  }
+  empty_buckets(buckets, num_buckets);
+  for (node = 0; node < catalogue->num_nodes; node++)
+  {
+    name = catalogue->names + catalogue->node_name[node];
+    bucket = hash_name(catalogue->node_parent[node], name, strlen(name)) & (num_buckets - 1);
+    catalogue->node_next[node] = buckets[bucket];
+    buckets[bucket] = node;
+  }
+  FreeVec(catalogue->buckets);
+  catalogue->buckets = buckets;
+  catalogue->num_buckets = num_buckets;
+}
+
+/* Finds or adds the node for a name inside parent; CATALOGUE_NO_NODE if out of memory */
+static ULONG intern_name(struct Catalogue *catalogue, ULONG parent, const char *name, ULONG length)
+{
+  ULONG hash = hash_name(parent, name, length), node, capacity;
+  const char *known;
+
+  for (node = catalogue->buckets[hash & (catalogue->num_buckets - 1)]; node != CATALOGUE_NO_NODE;
+       node = catalogue->node_next[node])
+  {
+    known = catalogue->names + catalogue->node_name[node];
+    if (catalogue->node_parent[node] == parent && strncmp(known, name, length) == 0 && known[length] == '\0')
+    {
+      return node;
+    }
+  }
+
+  node = catalogue->num_nodes;
+  if (node == catalogue->node_capacity)
+  {
+    capacity = grown_capacity(catalogue->node_capacity, FIRST_NODES, node + 1);
+    if (!resize((APTR *)&catalogue->node_parent, sizeof(ULONG), node, capacity) ||
+        !resize((APTR *)&catalogue->node_name, sizeof(ULONG), node, capacity) ||
+        !resize((APTR *)&catalogue->node_next, sizeof(ULONG), node, capacity))
+    {
+      return CATALOGUE_NO_NODE;
+    }
+    catalogue->node_capacity = capacity;
+  }
+  if (catalogue->names_used + length + 1 > catalogue->names_capacity)
+  {
+    capacity = grown_capacity(catalogue->names_capacity, FIRST_NAMES, catalogue->names_used + length + 1);
+    if (!resize((APTR *)&catalogue->names, 1, catalogue->names_used, capacity))
+    {
+      return CATALOGUE_NO_NODE;
+    }
+    catalogue->names_capacity = capacity;
+  }
+  if (node >= catalogue->num_buckets * 2)
+  {
+    rehash(catalogue);
+  }
+
+  catalogue->node_parent[node] = parent;
+  catalogue->node_name[node] = catalogue->names_used;
+  memcpy(catalogue->names + catalogue->names_used, name, length);
+  catalogue->names[catalogue->names_used + length] = '\0';
+  catalogue->names_used += length + 1;
+  catalogue->node_next[node] = catalogue->buckets[hash & (catalogue->num_buckets - 1)];
+  catalogue->buckets[hash & (catalogue->num_buckets - 1)] = node;
+  catalogue->num_nodes++;
+  return node;
+}
+
+/*
+ * Finds or adds the nodes of every name in a path.  A leading '/' is
+ * kept as an empty first name; any other empty name, as in the trailing
+ * '/' of a directory member, is left out.
+ */
+static BOOL intern_path(struct Catalogue *catalogue, const char *path, ULONG *node)
+{
+  const char *name = path, *end;
+
+  *node = CATALOGUE_NO_NODE;
+  for (;;)
+  {
+    end = strchr(name, '/');
+    if (end == NULL)
+    {
+      end = name + strlen(name);
+    }
+    if (end > name || name == path)
+    {
+      *node = intern_name(catalogue, *node, name, end - name);
+      if (*node == CATALOGUE_NO_NODE)
+      {
+        return FALSE;
+      }
+    }
+    if (*end == '\0')
+    {
+      return TRUE;
+    }
+    name = end + 1;
+  }
+}
+
+static UBYTE method_code(const char *method)
+{
+  UBYTE i;
+
+  for (i = 0; i < NUM_METHODS; i++)
+  {
+    if (strcmp(method_names[i], method) == 0)
+    {
+      return i;
+    }
+  }
+  return CATALOGUE_METHOD_OTHER;
+}
+
+const char *catalogue_method_name(UBYTE method)
+{
+  return method < NUM_METHODS ? method_names[method] : "unknown";
+}
+
+static void add_size(ULONG *kb, ULONG *bytes, ULONG size)
+{
+  *bytes += size & 1023;
+  *kb += (size >> 10) + (*bytes >> 10);
+  *bytes &= 1023;
+}
+
+struct Catalogue *catalogue_create(void)
+{
+  struct Catalogue *catalogue;
+
+  catalogue = (struct Catalogue *)AllocVec(sizeof(struct Catalogue), MEMF_ANY | MEMF_CLEAR);
+  if (catalogue == NULL)
+  {
+    return NULL;
+  }
+  catalogue->buckets = (ULONG *)AllocVec(FIRST_BUCKETS * sizeof(ULONG), MEMF_ANY);
+  if (catalogue->buckets == NULL)
+  {
+    FreeVec(catalogue);
+    return NULL;
+  }
+  empty_buckets(catalogue->buckets, FIRST_BUCKETS);
+  catalogue->num_buckets = FIRST_BUCKETS;
+  InitSemaphore(&catalogue->lock);
+  return catalogue;
+}
+
+void catalogue_free(struct Catalogue *catalogue)
+{
+  free_array(catalogue->archive_path);
+  free_array(catalogue->archive_size);
+  free_array(catalogue->archive_members);
+  free_array(catalogue->archive_first);
+  free_array(catalogue->archive_packed);
+  free_array(catalogue->archive_original);
+  free_array(catalogue->archive_type);
+  free_array(catalogue->archive_native);
+  free_array(catalogue->archive_date);
+  free_array(catalogue->order);
+  free_array(catalogue->member_path);
+  free_array(catalogue->member_packed);
+  free_array(catalogue->member_original);
+  free_array(catalogue->member_time);
+  free_array(catalogue->member_crc);
+  free_array(catalogue->member_method);
+  free_array(catalogue->directory_path);
+  free_array(catalogue->directory_date);
+  free_array(catalogue->node_parent);
+  free_array(catalogue->node_name);
+  free_array(catalogue->node_next);
+  free_array(catalogue->names);
+  FreeVec(catalogue->buckets);
+  FreeVec(catalogue);
+}
+
+/* Adds an archive whose members have been stored from first on; under the lock */
+static void append_archive(struct Catalogue *catalogue, ULONG node, int archive_type, LONG size, const struct DateStamp *date,
+                           LONG num_members, ULONG first, BOOL native)
+{
+  ULONG archive = catalogue->num_archives++, count = num_members > 0 ? (ULONG)num_members : 0, i;
+  ULONG packed = 0, original = 0;
+
+  for (i = first; i < first + count; i++)
+  {
+    packed += catalogue->member_packed[i];
+    original += catalogue->member_original[i];
+  }
+  catalogue->archive_path[archive] = node;
+  catalogue->archive_size[archive] = size;
+  catalogue->archive_members[archive] = num_members;
+  catalogue->archive_first[archive] = first;
+  catalogue->archive_packed[archive] = packed;
+  catalogue->archive_original[archive] = original;
+  catalogue->archive_type[archive] = (UBYTE)archive_type;
+  catalogue->archive_native[archive] = native ? 1 : 0;
+  catalogue->archive_date[archive] = *date;
+  catalogue->num_members += count;
+  add_size(&catalogue->kb_packed, &catalogue->bytes_packed, size);
+  add_size(&catalogue->kb_original, &catalogue->bytes_original, original);
+
+  /* The sorted order no longer covers every archive */
+  free_array(catalogue->order);
+  catalogue->order = NULL;
+}
+
+BOOL catalogue_add(struct Catalogue *catalogue, const char *path, int archive_type, LONG size, const struct DateStamp *date,
+                   const struct LhaMember *members, LONG num_members, BOOL native)
+{
+  ULONG count = num_members > 0 ? (ULONG)num_members : 0, first, node, i;
+  BOOL ok;
+
+  ObtainSemaphore(&catalogue->lock);
+  first = catalogue->num_members;
+  ok = reserve_archives(catalogue) && reserve_members(catalogue, count) && intern_path(catalogue, path, &node);
+  for (i = 0; i < count && ok; i++)
+  {
+    ok = intern_path(catalogue, members[i].path, &catalogue->member_path[first + i]);
+    catalogue->member_packed[first + i] = members[i].packed_size;
+    catalogue->member_original[first + i] = members[i].original_size;
+    catalogue->member_time[first + i] = members[i].timestamp;
+    catalogue->member_crc[first + i] = members[i].crc;
+    catalogue->member_method[first + i] = method_code(members[i].method);
+  }
+
+  /* Names added before running out of memory stay in the tree, unused */
+  if (ok)
+  {
+    append_archive(catalogue, node, archive_type, size, date, num_members, first, native);
+  }
+  ReleaseSemaphore(&catalogue->lock);
+  return ok;
+}
+
+BOOL catalogue_add_directory(struct Catalogue *catalogue, const char *path, const struct DateStamp *date)
+{
+  ULONG node;
+  BOOL ok;
+
+  ObtainSemaphore(&catalogue->lock);
+  ok = reserve_directories(catalogue) && intern_path(catalogue, path, &node);
+  if (ok)
+  {
+    catalogue->directory_path[catalogue->num_directories] = node;
+    catalogue->directory_date[catalogue->num_directories] = *date;
+    catalogue->num_directories++;
+  }
+  ReleaseSemaphore(&catalogue->lock);
+  return ok;
+}
+
+LONG catalogue_count(struct Catalogue *catalogue)
+{
+  return (LONG)catalogue->num_archives;
+}
+
+void catalogue_get(struct Catalogue *catalogue, LONG index, struct CatalogueArchive *archive)
+{
+  ULONG a = catalogue->order != NULL ? catalogue->order[index] : (ULONG)index;
+
+  archive->path = catalogue->archive_path[a];
+  archive->archive_type = catalogue->archive_type[a];
+  archive->size = catalogue->archive_size[a];
+  archive->num_members = catalogue->archive_members[a];
+  archive->first_member = catalogue->archive_first[a];
+  archive->packed_size = catalogue->archive_packed[a];
+  archive->original_size = catalogue->archive_original[a];
+  archive->native = catalogue->archive_native[a] ? TRUE : FALSE;
+}
+
+void catalogue_member(struct Catalogue *catalogue, ULONG index, struct CatalogueMember *member)
+{
+  member->path = catalogue->member_path[index];
+  member->packed_size = catalogue->member_packed[index];
+  member->original_size = catalogue->member_original[index];
+  member->timestamp = catalogue->member_time[index];
+  member->crc = catalogue->member_crc[index];
+  member->method = catalogue->member_method[index];
+}
+
+/* Characters a node adds to a path: its name, and a '/' unless it follows "DH0:" */
+static ULONG node_length(const ULONG *parents, const ULONG *name_offsets, const char *names, ULONG node, ULONG *name_length)
+{
+  const char *parent_name;
+  ULONG length;
+
+  *name_length = strlen(names + name_offsets[node]);
+  if (parents[node] == CATALOGUE_NO_NODE)
+  {
+    return *name_length;
+  }
+  parent_name = names + name_offsets[parents[node]];
+  length = strlen(parent_name);
+  return *name_length + (length > 0 && parent_name[length - 1] == ':' ? 0 : 1);
+}
+
+/* Spells out the path of a node of the catalogue's tree or of an index's */
+static BOOL spell_path(const ULONG *parents, const ULONG *name_offsets, const char *names, ULONG node, char *buffer, ULONG size)
+{
+  ULONG length = 0, name_length, step, n;
+
+  /* Measure first, then fill in from the end */
+  for (n = node; n != CATALOGUE_NO_NODE; n = parents[n])
+  {
+    length += node_length(parents, name_offsets, names, n, &name_length);
+  }
+  if (length + 1 > size)
+  {
+    return FALSE;
+  }
+
+  buffer[length] = '\0';
+  for (n = node; n != CATALOGUE_NO_NODE; n = parents[n])
+  {
+    step = node_length(parents, name_offsets, names, n, &name_length);
+    length -= name_length;
+    memcpy(buffer + length, names + name_offsets[n], name_length);
+    if (step > name_length)
+    {
+      buffer[--length] = '/';
+    }
+  }
+  return TRUE;
+}
+
+BOOL catalogue_path(struct Catalogue *catalogue, ULONG node, char *buffer, ULONG size)
+{
+  return spell_path(catalogue->node_parent, catalogue->node_name, catalogue->names, node, buffer, size);
+}
+
+ULONG catalogue_kb_packed(struct Catalogue *catalogue)
+{
+  return catalogue->kb_packed;
+}
+
+ULONG catalogue_kb_original(struct Catalogue *catalogue)
+{
+  return catalogue->kb_original;
+}
+
+ULONG catalogue_memory(struct Catalogue *catalogue)
+{
+  return sizeof(struct Catalogue) +
+         catalogue->archive_capacity * (6 * sizeof(ULONG) + 2 + sizeof(struct DateStamp)) +
+         (catalogue->order != NULL ? catalogue->num_archives * sizeof(ULONG) : 0) +
+         catalogue->member_capacity * (4 * sizeof(ULONG) + sizeof(UWORD) + 1) +
+         catalogue->directory_capacity * (sizeof(ULONG) + sizeof(struct DateStamp)) +
+         catalogue->node_capacity * 3 * sizeof(ULONG) +
+         catalogue->num_buckets * sizeof(ULONG) +
+         catalogue->names_capacity;
+}
+
+static LONG compare_archives(struct Catalogue *catalogue, ULONG a, ULONG b, int order)
+{
+  char path_a[LHA_MAX_PATH], path_b[LHA_MAX_PATH];
+
+  if (order == CATALOGUE_BY_SIZE && catalogue->archive_size[a] != catalogue->archive_size[b])
+  {
+    return catalogue->archive_size[a] < catalogue->archive_size[b] ? -1 : 1;
+  }
+  catalogue_path(catalogue, catalogue->archive_path[a], path_a, sizeof(path_a));
+  catalogue_path(catalogue, catalogue->archive_path[b], path_b, sizeof(path_b));
+  return strcmp(path_a, path_b);
+}
+
+BOOL catalogue_sort(struct Catalogue *catalogue, int order)
+{
+  ULONG *sorted, count = catalogue->num_archives, gap, i, j, a;
+
+  sorted = (ULONG *)AllocVec((count > 0 ? count : 1) * sizeof(ULONG), MEMF_ANY);
+  if (sorted == NULL)
+  {
+    return FALSE;
+  }
+  for (i = 0; i < count; i++)
+  {
+    sorted[i] = i;
+  }
+
+  /* Shell sort with gaps of 1, 4, 13, 40...; a few thousand archives need no more */
+  for (gap = 1; gap < count / 3; gap = gap * 3 + 1)
+  {
+  }
+  for (; gap > 0; gap /= 3)
+  {
+    for (i = gap; i < count; i++)
+    {
+      a = sorted[i];
+      for (j = i; j >= gap && compare_archives(catalogue, sorted[j - gap], a, order) > 0; j -= gap)
+      {
+        sorted[j] = sorted[j - gap];
+      }
+      sorted[j] = a;
+    }
+  }
+
+  ObtainSemaphore(&catalogue->lock);
+  free_array(catalogue->order);
+  catalogue->order = sorted;
+  ReleaseSemaphore(&catalogue->lock);
+  return TRUE;
+}
+
+/*
+ * The index file: a header, then fixed records for the path tree, the
+ * directories, the archives and the members, the hash table of the
+ * directories and the names.  It is read in one piece and used where it
+ * lies in memory.  Parents come before their children in the tree and
+ * a hash chain only leads to earlier directories, so an index that
+ * passes validate_index() cannot send a walk round in circles.
+ */
+
+struct IndexHeader
+{
+  ULONG magic;
+  ULONG version;
+  ULONG num_nodes;
+  ULONG num_directories;
+  ULONG num_archives;
+  ULONG num_members;
+  ULONG num_buckets; /* Always a power of two */
+  ULONG names_size;
+};
+
+struct IndexDirectory
+{
+  ULONG path;          /* Node */
+  ULONG next;          /* Earlier directory in the same hash bucket */
+  struct DateStamp date;
+  ULONG first_child;   /* Subdirectories are stored together */
+  ULONG num_children;
+  ULONG first_archive; /* And so are the archives in it */
+  ULONG num_archives;
+};
+
+struct IndexArchive
+{
+  ULONG path;          /* Node; its name is the file name */
+  LONG  size;
+  struct DateStamp date;
+  LONG  num_members;   /* -1 if the headers could not be read */
+  ULONG first_member;
+  UBYTE type;
+  UBYTE native;
+  UWORD pad;
+};
+
+struct IndexMember
+{
+  ULONG path;
+  ULONG packed_size;
+  ULONG original_size;
+  ULONG timestamp;
+  UWORD crc;
+  UBYTE method;
+  UBYTE pad;
+};
+
+struct CatalogueIndex
+{
+  UBYTE *data;
+  struct IndexHeader *header;
+  ULONG *node_parent;
+  ULONG *node_name;
+  struct IndexDirectory *directories;
+  struct IndexArchive *archives;
+  struct IndexMember *members;
+  ULONG *buckets;
+  char  *names;
+  ULONG *node_map;     /* Catalogue node of each index node, once it has one */
+};
+
+static ULONG hash_path(const char *path)
+{
+  ULONG hash = FNV_OFFSET;
+
+  while (*path != '\0')
+  {
+    hash = (hash ^ (UBYTE)*path++) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static BOOL same_date(const struct DateStamp *a, const struct DateStamp *b)
+{
+  return a->ds_Days == b->ds_Days && a->ds_Minute == b->ds_Minute && a->ds_Tick == b->ds_Tick;
+}
+
+/* Size of the index; the names are padded to a long word */
+static ULONG index_size(const struct IndexHeader *header)
+{
+  return sizeof(struct IndexHeader) + header->num_nodes * 2 * sizeof(ULONG) +
+         header->num_directories * sizeof(struct IndexDirectory) + header->num_archives * sizeof(struct IndexArchive) +
+         header->num_members * sizeof(struct IndexMember) + header->num_buckets * sizeof(ULONG) +
+         ((header->names_size + 3) & ~3UL);
+}
+
+static void locate_records(struct CatalogueIndex *index)
+{
+  UBYTE *position = index->data + sizeof(struct IndexHeader);
+
+  index->header = (struct IndexHeader *)index->data;
+  index->node_parent = (ULONG *)position;
+  position += index->header->num_nodes * sizeof(ULONG);
+  index->node_name = (ULONG *)position;
+  position += index->header->num_nodes * sizeof(ULONG);
+  index->directories = (struct IndexDirectory *)position;
+  position += index->header->num_directories * sizeof(struct IndexDirectory);
+  index->archives = (struct IndexArchive *)position;
+  position += index->header->num_archives * sizeof(struct IndexArchive);
+  index->members = (struct IndexMember *)position;
+  position += index->header->num_members * sizeof(struct IndexMember);
+  index->buckets = (ULONG *)position;
+  position += index->header->num_buckets * sizeof(ULONG);
+  index->names = (char *)position;
+}
+
+/* Checks every offset and count, so nothing read from the file can point outside it */
+static BOOL validate_index(struct CatalogueIndex *index)
+{
+  const struct IndexHeader *header = index->header;
+  const struct IndexDirectory *directory;
+  const struct IndexArchive *archive;
+  ULONG i;
+
+  if (header->names_size == 0 || index->names[header->names_size - 1] != '\0')
+  {
+    return FALSE;
+  }
+  for (i = 0; i < header->num_nodes; i++)
+  {
+    if ((index->node_parent[i] != CATALOGUE_NO_NODE && index->node_parent[i] >= i) || index->node_name[i] >= header->names_size)
+    {
+      return FALSE;
+    }
+  }
+  for (i = 0; i < header->num_directories; i++)
+  {
+    directory = &index->directories[i];
+    if (directory->path >= header->num_nodes || (directory->next != CATALOGUE_NO_NODE && directory->next >= i) ||
+        directory->first_child > header->num_directories || directory->num_children > header->num_directories - directory->first_child ||
+        directory->first_archive > header->num_archives || directory->num_archives > header->num_archives - directory->first_archive)
+    {
+      return FALSE;
+    }
+  }
+  for (i = 0; i < header->num_archives; i++)
+  {
+    archive = &index->archives[i];
+    if (archive->path >= header->num_nodes || archive->first_member > header->num_members ||
+        (archive->num_members > 0 && (ULONG)archive->num_members > header->num_members - archive->first_member))
+    {
+      return FALSE;
+    }
+  }
+  for (i = 0; i < header->num_members; i++)
+  {
+    if (index->members[i].path >= header->num_nodes)
+    {
+      return FALSE;
+    }
+  }
+  for (i = 0; i < header->num_buckets; i++)
+  {
+    if (index->buckets[i] != CATALOGUE_NO_NODE && index->buckets[i] >= header->num_directories)
+    {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+struct CatalogueIndex *catalogue_load_index(CONST_STRPTR index_path)
+{
+  struct FileInfoBlock *file_info_block;
+  struct CatalogueIndex *index;
+  struct IndexHeader *header;
+  BPTR file;
+  LONG size = 0;
+
+  file = Open(index_path, MODE_OLDFILE);
+  if (file == 0)
+  {
+    return NULL;
+  }
+  file_info_block = (struct FileInfoBlock *)AllocMem(sizeof(struct FileInfoBlock), MEMF_CLEAR);
+  if (file_info_block != NULL)
+  {
+    if (ExamineFH(file, file_info_block))
+    {
+      size = file_info_block->fib_Size;
+    }
+    FreeMem(file_info_block, sizeof(struct FileInfoBlock));
+  }
+  index = (struct CatalogueIndex *)AllocVec(sizeof(struct CatalogueIndex), MEMF_ANY | MEMF_CLEAR);
+  if (index != NULL && size >= (LONG)sizeof(struct IndexHeader))
+  {
+    index->data = (UBYTE *)AllocVec(size, MEMF_ANY);
+  }
+  if (index == NULL || index->data == NULL || Read(file, index->data, size) != size)
+  {
+    Close(file);
+    if (index != NULL)
+    {
+      catalogue_free_index(index);
+    }
+    return NULL;
+  }
+  Close(file);
+
+  header = (struct IndexHeader *)index->data;
+  if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION || header->num_nodes > (ULONG)size ||
+      header->num_directories > (ULONG)size || header->num_archives > (ULONG)size || header->num_members > (ULONG)size ||
+      header->num_buckets > (ULONG)size || header->names_size > (ULONG)size || header->num_buckets == 0 || (header->num_buckets & (header->num_buckets - 1)) != 0 ||
+      index_size(header) != (ULONG)size)
+  {
+    catalogue_free_index(index);
+    return NULL;
+  }
+  locate_records(index);
+  if (!validate_index(index))
+  {
+    catalogue_free_index(index);
+    return NULL;
+  }
+  return index;
+}
+
+void catalogue_free_index(struct CatalogueIndex *index)
+{
+  free_array(index->data);
+  free_array(index->node_map);
+  FreeVec(index);
+}
+
+LONG catalogue_index_directory(struct CatalogueIndex *index, const char *path, const struct DateStamp *date, BOOL *unchanged)
+{
+  char indexed_path[LHA_MAX_PATH];
+  ULONG directory;
+
+  *unchanged = FALSE;
+  for (directory = index->buckets[hash_path(path) & (index->header->num_buckets - 1)]; directory != CATALOGUE_NO_NODE;
+       directory = index->directories[directory].next)
+  {
+    if (spell_path(index->node_parent, index->node_name, index->names, index->directories[directory].path,
+                   indexed_path, sizeof(indexed_path)) &&
+        strcmp(indexed_path, path) == 0)
+    {
+      *unchanged = same_date(&index->directories[directory].date, date);
+      return (LONG)directory;
+    }
+  }
+  return -1;
+}
+
+BOOL catalogue_index_subdirectory(struct CatalogueIndex *index, LONG directory, LONG n, char *path, ULONG size)
+{
+  const struct IndexDirectory *parent = &index->directories[directory];
+
+  if ((ULONG)n >= parent->num_children)
+  {
+    return FALSE;
+  }
+  return spell_path(index->node_parent, index->node_name, index->names,
+                    index->directories[parent->first_child + n].path, path, size);
+}
+
+LONG catalogue_index_archive(struct CatalogueIndex *index, LONG directory, LONG n)
+{
+  const struct IndexDirectory *parent = &index->directories[directory];
+
+  return (ULONG)n < parent->num_archives ? (LONG)(parent->first_archive + n) : -1;
+}
+
+LONG catalogue_index_find_archive(struct CatalogueIndex *index, LONG directory, const char *name, LONG size,
+                                  const struct DateStamp *date)
+{
+  const struct IndexDirectory *parent = &index->directories[directory];
+  const struct IndexArchive *archive;
+  ULONG i;
+
+  for (i = parent->first_archive; i < parent->first_archive + parent->num_archives; i++)
+  {
+    archive = &index->archives[i];
+    if (archive->size == size && same_date(&archive->date, date) &&
+        strcmp(index->names + index->node_name[archive->path], name) == 0)
+    {
+      return (LONG)i;
+    }
+  }
+  return -1;
+}
+
+/* The catalogue's node for an index node, adding the names it needs; under the lock */
+static ULONG map_node(struct Catalogue *catalogue, struct CatalogueIndex *index, ULONG node)
+{
+  ULONG parent, i;
+  const char *name;
+
+  if (index->node_map == NULL)
+  {
+    index->node_map = (ULONG *)AllocVec((index->header->num_nodes + 1) * sizeof(ULONG), MEMF_ANY);
+    if (index->node_map == NULL)
+    {
+      return CATALOGUE_NO_NODE;
+    }
+    for (i = 0; i < index->header->num_nodes; i++)
+    {
+      index->node_map[i] = CATALOGUE_NO_NODE;
+    }
+  }
+  if (index->node_map[node] == CATALOGUE_NO_NODE)
+  {
+    parent = CATALOGUE_NO_NODE;
+    if (index->node_parent[node] != CATALOGUE_NO_NODE)
+    {
+      parent = map_node(catalogue, index, index->node_parent[node]);
+      if (parent == CATALOGUE_NO_NODE)
+      {
+        return CATALOGUE_NO_NODE;
+      }
+    }
+    name = index->names + index->node_name[node];
+    index->node_map[node] = intern_name(catalogue, parent, name, strlen(name));
+  }
+  return index->node_map[node];
+}
+
+BOOL catalogue_add_indexed(struct Catalogue *catalogue, struct CatalogueIndex *index, LONG archive, int *archive_type)
+{
+  const struct IndexArchive *indexed = &index->archives[archive];
+  const struct IndexMember *member;
+  ULONG count = indexed->num_members > 0 ? (ULONG)indexed->num_members : 0, first, node, i;
+  BOOL ok;
+
+  *archive_type = indexed->type;
+
+  ObtainSemaphore(&catalogue->lock);
+  first = catalogue->num_members;
+  ok = reserve_archives(catalogue) && reserve_members(catalogue, count) &&
+       (node = map_node(catalogue, index, indexed->path)) != CATALOGUE_NO_NODE;
+  for (i = 0; i < count && ok; i++)
+  {
+    member = &index->members[indexed->first_member + i];
+    catalogue->member_path[first + i] = map_node(catalogue, index, member->path);
+    ok = catalogue->member_path[first + i] != CATALOGUE_NO_NODE;
+    catalogue->member_packed[first + i] = member->packed_size;
+    catalogue->member_original[first + i] = member->original_size;
+    catalogue->member_time[first + i] = member->timestamp;
+    catalogue->member_crc[first + i] = member->crc;
+    catalogue->member_method[first + i] = member->method;
+  }
+  if (ok)
+  {
+    append_archive(catalogue, node, indexed->type, indexed->size, &indexed->date, indexed->num_members, first,
+                   indexed->native ? TRUE : FALSE);
+  }
+  ReleaseSemaphore(&catalogue->lock);
+  return ok;
+}
+
+/*
+ * Orders items by a key below num_keys, keeping the items of each key
+ * together: a counting sort, as many items share a key.  The items of
+ * key k are then order[start[k]] to order[start[k + 1] - 1].
+ */
+static void group_by_key(const ULONG *key, ULONG count, ULONG num_keys, ULONG *order, ULONG *start)
+{
+  ULONG i, k;
+
+  for (k = 0; k <= num_keys; k++)
+  {
+    start[k] = 0;
+  }
+  for (i = 0; i < count; i++)
+  {
+    start[key[i] + 1]++;
+  }
+  for (k = 1; k <= num_keys; k++)
+  {
+    start[k] += start[k - 1];
+  }
+  for (i = 0; i < count; i++)
+  {
+    order[start[key[i]]++] = i;
+  }
+  /* Each start has moved on to the next key's; move them back */
+  for (k = num_keys; k > 0; k--)
+  {
+    start[k] = start[k - 1];
+  }
+  start[0] = 0;
+}
+
+LONG catalogue_save_index(struct Catalogue *catalogue, CONST_STRPTR index_path)
+{
+  struct IndexHeader header;
+  struct IndexDirectory *directory;
+  struct IndexArchive *archive;
+  struct IndexMember *member;
+  struct CatalogueIndex index;
+  ULONG num_directories = catalogue->num_directories, num_archives = catalogue->num_archives;
+  ULONG *directory_of_node, *directory_key, *directory_order, *directory_start;
+  ULONG *archive_key, *archive_order, *archive_start;
+  ULONG *work, size, i, d, a, m, next_member = 0, parent, bucket;
+  char path[LHA_MAX_PATH];
+  BPTR file;
+  LONG result = CATALOGUE_OK;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = INDEX_MAGIC;
+  header.version = INDEX_VERSION;
+  header.num_nodes = catalogue->num_nodes;
+  header.num_directories = num_directories;
+  header.num_archives = num_archives;
+  header.num_members = catalogue->num_members;
+  header.names_size = catalogue->names_used > 0 ? catalogue->names_used : 1;
+  for (header.num_buckets = 16; header.num_buckets < num_directories; header.num_buckets *= 2)
+  {
+  }
+  size = index_size(&header);
+
+  /* One block for the working arrays; the keys include one for "no directory" */
+  work = (ULONG *)AllocVec((catalogue->num_nodes + 2 * num_directories + 2 * num_archives + 2 * (num_directories + 2) + 1) *
+                           sizeof(ULONG), MEMF_ANY);
+  memset(&index, 0, sizeof(index));
+  index.data = (UBYTE *)AllocVec(size, MEMF_ANY | MEMF_CLEAR);
+  if (work == NULL || index.data == NULL)
+  {
+    free_array(work);
+    free_array(index.data);
+    return CATALOGUE_ERR_MEMORY;
+  }
+  directory_of_node = work;
+  directory_key = directory_of_node + catalogue->num_nodes;
+  directory_order = directory_key + num_directories;
+  directory_start = directory_order + num_directories;
+  archive_key = directory_start + num_directories + 2;
+  archive_order = archive_key + num_archives;
+  archive_start = archive_order + num_archives;
+
+  *(struct IndexHeader *)index.data = header;
+  locate_records(&index);
+  memcpy(index.node_parent, catalogue->node_parent, catalogue->num_nodes * sizeof(ULONG));
+  memcpy(index.node_name, catalogue->node_name, catalogue->num_nodes * sizeof(ULONG));
+  if (catalogue->names_used > 0)
+  {
+    memcpy(index.names, catalogue->names, catalogue->names_used);
+  }
+
+  /* Group the subdirectories of each directory, and the archives in it */
+  for (i = 0; i < catalogue->num_nodes; i++)
+  {
+    directory_of_node[i] = num_directories;
+  }
+  for (d = 0; d < num_directories; d++)
+  {
+    directory_of_node[catalogue->directory_path[d]] = d;
+  }
+  for (d = 0; d < num_directories; d++)
+  {
+    parent = catalogue->node_parent[catalogue->directory_path[d]];
+    directory_key[d] = parent != CATALOGUE_NO_NODE ? directory_of_node[parent] : num_directories;
+  }
+  for (a = 0; a < num_archives; a++)
+  {
+    parent = catalogue->node_parent[catalogue->archive_path[a]];
+    archive_key[a] = parent != CATALOGUE_NO_NODE ? directory_of_node[parent] : num_directories;
+  }
+  group_by_key(directory_key, num_directories, num_directories + 1, directory_order, directory_start);
+  group_by_key(archive_key, num_archives, num_directories + 1, archive_order, archive_start);
+
+  for (i = 0; i < header.num_buckets; i++)
+  {
+    index.buckets[i] = CATALOGUE_NO_NODE;
+  }
+  for (i = 0; i < num_directories; i++)
+  {
+    d = directory_order[i];
+    directory = &index.directories[i];
+    directory->path = catalogue->directory_path[d];
+    directory->date = catalogue->directory_date[d];
+    directory->first_child = directory_start[d];
+    directory->num_children = directory_start[d + 1] - directory_start[d];
+    directory->first_archive = archive_start[d];
+    directory->num_archives = archive_start[d + 1] - archive_start[d];
+
+    catalogue_path(catalogue, directory->path, path, sizeof(path));
+    bucket = hash_path(path) & (header.num_buckets - 1);
+    directory->next = index.buckets[bucket];
+    index.buckets[bucket] = i;
+  }
+
+  for (i = 0; i < num_archives; i++)
+  {
+    a = archive_order[i];
+    archive = &index.archives[i];
+    archive->path = catalogue->archive_path[a];
+    archive->size = catalogue->archive_size[a];
+    archive->date = catalogue->archive_date[a];
+    archive->num_members = catalogue->archive_members[a];
+    archive->first_member = next_member;
+    archive->type = catalogue->archive_type[a];
+    archive->native = catalogue->archive_native[a];
+    for (m = 0; archive->num_members > 0 && m < (ULONG)archive->num_members; m++)
+    {
+      member = &index.members[next_member++];
+      member->path = catalogue->member_path[catalogue->archive_first[a] + m];
+      member->packed_size = catalogue->member_packed[catalogue->archive_first[a] + m];
+      member->original_size = catalogue->member_original[catalogue->archive_first[a] + m];
+      member->timestamp = catalogue->member_time[catalogue->archive_first[a] + m];
+      member->crc = catalogue->member_crc[catalogue->archive_first[a] + m];
+      member->method = catalogue->member_method[catalogue->archive_first[a] + m];
+    }
+  }
+  FreeVec(work);
+
+  file = Open(index_path, MODE_NEWFILE);
+  if (file == 0 || Write(file, index.data, size) != (LONG)size)
+  {
+    result = CATALOGUE_ERR_WRITE;
+  }
+  if (file != 0 && !Close(file))
+  {
+    result = CATALOGUE_ERR_WRITE;
+  }
+  FreeVec(index.data);
+  return result;
+}
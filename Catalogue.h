@@ -0,0 +1,136 @@
+/*
+
+  Catalogue
+
+  The inventory of a source folder: every archive found, with the member
+  headers read from it, gathered before anything is extracted.  The run
+  is planned from it, so the totals, the space the members need and the
+  order of the work are known up front.  Archives may be added by
+  several processes at once.
+
+  A large collection holds hundreds of thousands of members, so nothing
+  is stored per member but a few numbers in arrays, and every path is a
+  node in one tree of names: directories that many archives or members
+  share are stored once.
+
+  A catalogue can be saved as an index file and loaded on the next run,
+  so directories that have not changed since need not be read again.
+
+  This program is released under the MIT License.
+*/
+
+#ifndef CATALOGUE_H
+#define CATALOGUE_H
+
+#include <exec/types.h>
+
+#include "LHAArchive.h"
+
+/* Orders for catalogue_sort() */
+#define CATALOGUE_BY_PATH 0 /* Directory by directory, as the source folder is laid out */
+#define CATALOGUE_BY_SIZE 1 /* Smallest first, then by path */
+
+#define CATALOGUE_OK 0
+#define CATALOGUE_ERR_MEMORY -1
+#define CATALOGUE_ERR_WRITE -2
+
+#define CATALOGUE_NO_NODE 0xFFFFFFFFUL /* Parent of the first name of a path */
+#define CATALOGUE_METHOD_OTHER 0xFF    /* A method not in the catalogue's table */
+
+struct CatalogueArchive
+{
+  ULONG path;          /* Node of the archive's path, for catalogue_path() */
+  int   archive_type;  /* The caller's own code for the kind of archive */
+  LONG  size;          /* Bytes on disk */
+  LONG  num_members;   /* -1 if the headers were not read */
+  ULONG first_member;  /* Index of the first member for catalogue_member() */
+  ULONG packed_size;   /* Of all members */
+  ULONG original_size; /* Of all members, so the space they need; 0 if unknown */
+  BOOL  native;        /* The built-in decoder supports every member */
+};
+
+struct CatalogueMember
+{
+  ULONG path;          /* Node of the member's path inside the archive */
+  ULONG packed_size;
+  ULONG original_size;
+  ULONG timestamp;     /* Seconds since 1978-01-01 */
+  UWORD crc;
+  UBYTE method;        /* For catalogue_method_name() */
+};
+
+struct Catalogue;
+struct CatalogueIndex;
+
+/* Returns NULL if out of memory */
+struct Catalogue *catalogue_create(void);
+void catalogue_free(struct Catalogue *catalogue);
+
+/*
+ * Adds an archive, dated as its file, and its members, which may be NULL
+ * with num_members -1 if its headers could not be read.  Returns FALSE
+ * if out of memory, without adding the archive.
+ */
+BOOL catalogue_add(struct Catalogue *catalogue, const char *path, int archive_type, LONG size, const struct DateStamp *date,
+                   const struct LhaMember *members, LONG num_members, BOOL native);
+
+/*
+ * Records a directory that was scanned, dated as it was before it was
+ * read, so a saved index knows which directories it covers fully.
+ */
+BOOL catalogue_add_directory(struct Catalogue *catalogue, const char *path, const struct DateStamp *date);
+
+LONG catalogue_count(struct Catalogue *catalogue);
+
+/* Fills in archive number index, in the order of the last catalogue_sort() */
+void catalogue_get(struct Catalogue *catalogue, LONG index, struct CatalogueArchive *archive);
+void catalogue_member(struct Catalogue *catalogue, ULONG index, struct CatalogueMember *member);
+
+/* Spells out the path of a node; returns FALSE if it does not fit */
+BOOL catalogue_path(struct Catalogue *catalogue, ULONG node, char *buffer, ULONG size);
+
+/* The method string, e.g. "-lh5-", or "unknown" for CATALOGUE_METHOD_OTHER */
+const char *catalogue_method_name(UBYTE method);
+
+/* Compressed and extracted size of everything in the catalogue, in whole KB */
+ULONG catalogue_kb_packed(struct Catalogue *catalogue);
+ULONG catalogue_kb_original(struct Catalogue *catalogue);
+
+/* Memory taken by the catalogue, in bytes */
+ULONG catalogue_memory(struct Catalogue *catalogue);
+
+/* Returns FALSE if out of memory, leaving the order as it was */
+BOOL catalogue_sort(struct Catalogue *catalogue, int order);
+
+/* Writes the catalogue to an index file; returns CATALOGUE_OK or an error */
+LONG catalogue_save_index(struct Catalogue *catalogue, CONST_STRPTR index_path);
+
+/*
+ * Loads an index file with a single Read().  Returns NULL if there is
+ * none, if it is of another version or damaged, or if out of memory.
+ * An index is meant for filling one catalogue.
+ */
+struct CatalogueIndex *catalogue_load_index(CONST_STRPTR index_path);
+void catalogue_free_index(struct CatalogueIndex *index);
+
+/*
+ * Finds a directory in the index and whether its date is still the one
+ * it had then, in which case its entries are the same.  Returns the
+ * directory's number, or -1 if the index does not have it.
+ */
+LONG catalogue_index_directory(struct CatalogueIndex *index, const char *path, const struct DateStamp *date, BOOL *unchanged);
+
+/* Spells out the path of subdirectory n of a directory; FALSE past the last */
+BOOL catalogue_index_subdirectory(struct CatalogueIndex *index, LONG directory, LONG n, char *path, ULONG size);
+
+/* The number of archive n in a directory, or -1 past the last */
+LONG catalogue_index_archive(struct CatalogueIndex *index, LONG directory, LONG n);
+
+/* The number of the archive of that name in a directory, if its size and date still match; otherwise -1 */
+LONG catalogue_index_find_archive(struct CatalogueIndex *index, LONG directory, const char *name, LONG size,
+                                  const struct DateStamp *date);
+
+/* Adds an archive from the index, with its members; returns FALSE if out of memory */
+BOOL catalogue_add_indexed(struct Catalogue *catalogue, struct CatalogueIndex *index, LONG archive, int *archive_type);
+
+#endif
@@ -0,0 +1,1007 @@
+/*
+
+  HDFImage
+
+  Builds an FFS hardfile image in one sequential pass.  Blocks are handed
+  out in ascending order and collected in a buffer that is written out as
+  it fills.  A file's data blocks come first, then its extension blocks
+  and finally its header, so a whole file is written without seeking.
+  The root and bitmap blocks sit in the middle of the image, where FFS
+  expects them, and are skipped until the image is closed.  Directory
+  blocks are given a block number when they are created, but since
+  their hash tables change as entries are added they are only written
+  at the end, along with the root and bitmap blocks.
+
+  This program is released under the MIT License.
+*/
+
+#include <dos/dos.h>
+#include <exec/memory.h>
+#include <exec/types.h>
+#include <proto/dos.h>
+#include <proto/exec.h>
+#include <string.h>
+
+#include "HDFImage.h"
+
+#define BLOCK_SIZE 512
+#define HT_SIZE 72           /* Hash table entries, and data block pointers per header */
+#define MAP_LONGS 127        /* Bitmap longs in a bitmap block */
+#define BM_PAGES 25          /* Bitmap block pointers in the root block */
+#define BUFFER_BLOCKS 64     /* Blocks collected before each Write() */
+#define TRACK_BLOCKS 32
+#define MAX_NAME 30
+#define MAX_COMMENT 79
+#define DOS_FFS_INTL 0x444F5303 /* "DOS\3" */
+
+/* Block types */
+#define T_HEADER 2
+#define T_LIST 16
+#define ST_ROOT 1
+#define ST_USERDIR 2
+#define ST_FILE -3
+
+/* Offsets within header blocks */
+#define OFS_TYPE 0
+#define OFS_HEADER_KEY 4
+#define OFS_HIGH_SEQ 8
+#define OFS_HT_SIZE 12
+#define OFS_FIRST_DATA 16
+#define OFS_CHECKSUM 20
+#define OFS_TABLE 24         /* Hash table, or data block pointers in reverse order */
+#define OFS_BM_FLAG 312
+#define OFS_BM_PAGES 316
+#define OFS_BM_EXT 416
+#define OFS_PROTECT 320
+#define OFS_BYTE_SIZE 324
+#define OFS_COMMENT 328
+#define OFS_DATE 420
+#define OFS_NAME 432
+#define OFS_VOLUME_DATE 472
+#define OFS_CREATION_DATE 484
+#define OFS_HASH_CHAIN 496
+#define OFS_PARENT 500
+#define OFS_EXTENSION 504
+#define OFS_SEC_TYPE 508
+
+struct HdfEntry
+{
+  struct HdfEntry *next;     /* Next entry in the same directory */
+  struct HdfEntry *children; /* Directories only */
+  ULONG *hash_table;         /* Directories only */
+  ULONG block;               /* Header or directory block */
+  ULONG hash_chain;
+  ULONG first_block;         /* Files: the blocks they use, to free them if replaced */
+  ULONG last_block;
+  struct DateStamp date;
+  BOOL  is_directory;
+  char  name[MAX_NAME + 1];
+};
+
+/* A file header already written whose hash chain changed since */
+struct HdfFixup
+{
+  struct HdfFixup *next;
+  ULONG block;
+  ULONG hash_chain;
+};
+
+struct HdfImage
+{
+  BPTR  file;
+  LONG  write_error;
+  ULONG num_blocks;
+  ULONG root_block;
+  ULONG num_reserved;  /* Root, bitmap and bitmap extension blocks */
+  ULONG num_bitmaps;
+  ULONG num_bitmap_ext;
+  ULONG *free_map;     /* One bit per block from block 2, set when free */
+
+  UBYTE *buffer;
+  ULONG buffer_start;  /* Block number of the first buffered block */
+  ULONG buffer_used;
+
+  struct HdfEntry root;
+  struct HdfFixup *fixups;
+  char  volume_name[MAX_NAME + 1];
+
+  /* The file being written */
+  BOOL  file_open;
+  LONG  file_error;
+  struct HdfEntry *file_directory;
+  char  file_name[MAX_NAME + 1];
+  ULONG file_first;
+  ULONG file_last;
+  ULONG file_blocks;   /* Data blocks */
+  ULONG file_size;
+  UBYTE *file_slot;    /* Data block being filled */
+  ULONG file_slot_used;
+  ULONG file_timestamp;
+  ULONG file_protection;
+  char  file_comment[MAX_COMMENT + 1];
+  UBYTE header[BLOCK_SIZE];
+};
+
+static void write_be32(UBYTE *p, ULONG value)
+{
+  p[0] = (UBYTE)(value >> 24);
+  p[1] = (UBYTE)(value >> 16);
+  p[2] = (UBYTE)(value >> 8);
+  p[3] = (UBYTE)value;
+}
+
+static ULONG read_be32(const UBYTE *p)
+{
+  return ((ULONG)p[0] << 24) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 8) | p[3];
+}
+
+static void set_checksum(UBYTE *block, int offset)
+{
+  ULONG sum = 0;
+  int i;
+
+  write_be32(block + offset, 0);
+  for (i = 0; i < BLOCK_SIZE; i += 4)
+  {
+    sum += read_be32(block + i);
+  }
+  write_be32(block + offset, (ULONG)0 - sum);
+}
+
+static void write_date(UBYTE *p, const struct DateStamp *date)
+{
+  write_be32(p, date->ds_Days);
+  write_be32(p + 4, date->ds_Minute);
+  write_be32(p + 8, date->ds_Tick);
+}
+
+static void write_bcpl_string(UBYTE *p, const char *text, ULONG max_length)
+{
+  ULONG length = strlen(text);
+
+  if (length > max_length)
+  {
+    length = max_length;
+  }
+  p[0] = (UBYTE)length;
+  memcpy(p + 1, text, length);
+}
+
+/* toupper() of the international FFS modes, which also folds Latin-1 */
+static UBYTE intl_toupper(UBYTE c)
+{
+  if ((c >= 'a' && c <= 'z') || (c >= 224 && c <= 254 && c != 247))
+  {
+    return (UBYTE)(c - 32);
+  }
+  return c;
+}
+
+static ULONG hash_name(const char *name)
+{
+  ULONG hash = strlen(name);
+
+  while (*name != '\0')
+  {
+    hash = (hash * 13 + intl_toupper((UBYTE)*name++)) & 0x7FF;
+  }
+  return hash % HT_SIZE;
+}
+
+static BOOL names_equal(const char *a, const char *b)
+{
+  while (*a != '\0' && intl_toupper((UBYTE)*a) == intl_toupper((UBYTE)*b))
+  {
+    a++;
+    b++;
+  }
+  return *a == '\0' && *b == '\0';
+}
+
+static BOOL is_reserved(struct HdfImage *image, ULONG block)
+{
+  return block < 2 || (block >= image->root_block && block < image->root_block + image->num_reserved);
+}
+
+/* The block that will be handed out at or after block */
+static ULONG skip_reserved(struct HdfImage *image, ULONG block)
+{
+  if (block >= image->root_block && block < image->root_block + image->num_reserved)
+  {
+    return image->root_block + image->num_reserved;
+  }
+  return block;
+}
+
+static void set_block_free(struct HdfImage *image, ULONG block, BOOL free)
+{
+  ULONG bit = block - 2;
+
+  if (free)
+  {
+    image->free_map[bit / 32] |= 1UL << (bit % 32);
+  }
+  else
+  {
+    image->free_map[bit / 32] &= ~(1UL << (bit % 32));
+  }
+}
+
+static void free_blocks(struct HdfImage *image, ULONG first, ULONG last)
+{
+  ULONG block;
+
+  for (block = first; block <= last && block != 0; block++)
+  {
+    if (!is_reserved(image, block))
+    {
+      set_block_free(image, block, TRUE);
+    }
+  }
+}
+
+static BOOL flush_buffer(struct HdfImage *image)
+{
+  LONG length = image->buffer_used * BLOCK_SIZE;
+
+  if (image->buffer_used > 0 && Write(image->file, image->buffer, length) != length)
+  {
+    image->write_error = SINK_ERR_WRITE;
+    return FALSE;
+  }
+  image->buffer_start += image->buffer_used;
+  image->buffer_used = 0;
+  return TRUE;
+}
+
+/*
+ * Hands out the next free block and returns its cleared buffer slot.
+ * Reserved blocks on the way are left as zeros to be written at close.
+ */
+static UBYTE *allocate_block(struct HdfImage *image, ULONG *block, LONG *error)
+{
+  UBYTE *slot;
+  ULONG next;
+
+  for (;;)
+  {
+    if (image->buffer_used == BUFFER_BLOCKS && !flush_buffer(image))
+    {
+      *error = image->write_error;
+      return NULL;
+    }
+    next = image->buffer_start + image->buffer_used;
+    if (next >= image->num_blocks)
+    {
+      *error = SINK_ERR_FULL;
+      return NULL;
+    }
+    slot = image->buffer + image->buffer_used * BLOCK_SIZE;
+    memset(slot, 0, BLOCK_SIZE);
+    image->buffer_used++;
+    if (!is_reserved(image, next))
+    {
+      set_block_free(image, next, FALSE);
+      *block = next;
+      return slot;
+    }
+  }
+}
+
+static BOOL write_block_at(struct HdfImage *image, ULONG block, UBYTE *data)
+{
+  if (Seek(image->file, (LONG)(block * BLOCK_SIZE), OFFSET_BEGINNING) < 0 ||
+      Write(image->file, data, BLOCK_SIZE) != BLOCK_SIZE)
+  {
+    image->write_error = SINK_ERR_WRITE;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+struct HdfImage *hdf_create_image(CONST_STRPTR image_path, ULONG size_mb, LONG *error)
+{
+  struct HdfImage *image;
+  ULONG map_longs, block;
+  char *name;
+  int i;
+
+  if (size_mb < 1 || size_mb > HDF_MAX_SIZE_MB)
+  {
+    *error = SINK_ERR_OPEN;
+    return NULL;
+  }
+
+  image = (struct HdfImage *)AllocVec(sizeof(struct HdfImage), MEMF_ANY | MEMF_CLEAR);
+  if (image == NULL)
+  {
+    *error = SINK_ERR_MEMORY;
+    return NULL;
+  }
+
+  image->num_blocks = size_mb * (1024 * 1024 / BLOCK_SIZE) / TRACK_BLOCKS * TRACK_BLOCKS;
+  image->root_block = (image->num_blocks - 1 + 2) / 2;
+  image->num_bitmaps = (image->num_blocks - 2 + MAP_LONGS * 32 - 1) / (MAP_LONGS * 32);
+  if (image->num_bitmaps > BM_PAGES)
+  {
+    image->num_bitmap_ext = (image->num_bitmaps - BM_PAGES + MAP_LONGS - 1) / MAP_LONGS;
+  }
+  image->num_reserved = 1 + image->num_bitmaps + image->num_bitmap_ext;
+
+  map_longs = image->num_bitmaps * MAP_LONGS;
+  image->free_map = (ULONG *)AllocVec(map_longs * sizeof(ULONG), MEMF_ANY | MEMF_CLEAR);
+  image->buffer = (UBYTE *)AllocVec(BUFFER_BLOCKS * BLOCK_SIZE, MEMF_ANY | MEMF_CLEAR);
+  image->root.hash_table = (ULONG *)AllocVec(HT_SIZE * sizeof(ULONG), MEMF_ANY | MEMF_CLEAR);
+  if (image->free_map == NULL || image->buffer == NULL || image->root.hash_table == NULL)
+  {
+    *error = SINK_ERR_MEMORY;
+    FreeVec(image->free_map);
+    FreeVec(image->buffer);
+    FreeVec(image->root.hash_table);
+    FreeVec(image);
+    return NULL;
+  }
+  for (block = 2; block < image->num_blocks; block++)
+  {
+    if (!is_reserved(image, block))
+    {
+      set_block_free(image, block, TRUE);
+    }
+  }
+
+  image->file = Open(image_path, MODE_NEWFILE);
+  if (image->file == 0)
+  {
+    *error = SINK_ERR_OPEN;
+    FreeVec(image->free_map);
+    FreeVec(image->buffer);
+    FreeVec(image->root.hash_table);
+    FreeVec(image);
+    return NULL;
+  }
+
+  /* The volume is named after the image file, without its extension */
+  name = (char *)FilePart(image_path);
+  for (i = 0; i < MAX_NAME && name[i] != '\0' && name[i] != '.'; i++)
+  {
+    image->volume_name[i] = name[i];
+  }
+  if (i == 0)
+  {
+    strcpy(image->volume_name, "WHDLoad");
+  }
+
+  image->root.block = image->root_block;
+  image->root.is_directory = TRUE;
+  DateStamp(&image->root.date);
+
+  /* Boot blocks: just the DOS type, the image is not bootable */
+  write_be32(image->buffer, DOS_FFS_INTL);
+  image->buffer_used = 2;
+
+  *error = SINK_OK;
+  return image;
+}
+
+static struct HdfEntry *find_entry(struct HdfEntry *directory, const char *name)
+{
+  struct HdfEntry *entry;
+
+  for (entry = directory->children; entry != NULL; entry = entry->next)
+  {
+    if (names_equal(entry->name, name))
+    {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/* Puts an entry at the head of its hash chain and in the directory's list */
+static void link_entry(struct HdfEntry *directory, struct HdfEntry *entry)
+{
+  ULONG hash = hash_name(entry->name);
+
+  entry->hash_chain = directory->hash_table[hash];
+  directory->hash_table[hash] = entry->block;
+  entry->next = directory->children;
+  directory->children = entry;
+}
+
+static void free_entry(struct HdfEntry *entry)
+{
+  struct HdfEntry *child, *next;
+
+  for (child = entry->children; child != NULL; child = next)
+  {
+    next = child->next;
+    free_entry(child);
+  }
+  FreeVec(entry->hash_table);
+  FreeVec(entry);
+}
+
+/*
+ * Takes a file out of its directory and frees its blocks.  A header that
+ * is already written and chained to it is corrected when the image is
+ * closed.
+ */
+static LONG unlink_file(struct HdfImage *image, struct HdfEntry *directory, struct HdfEntry *file)
+{
+  struct HdfEntry *entry, **link;
+  struct HdfFixup *fixup, **fixup_link;
+  ULONG hash = hash_name(file->name);
+
+  if (directory->hash_table[hash] == file->block)
+  {
+    directory->hash_table[hash] = file->hash_chain;
+  }
+  else
+  {
+    for (entry = directory->children; entry != NULL; entry = entry->next)
+    {
+      if (entry->hash_chain == file->block)
+      {
+        entry->hash_chain = file->hash_chain;
+        if (!entry->is_directory)
+        {
+          /* A header relinked again keeps one fixup, holding its latest link */
+          for (fixup = image->fixups; fixup != NULL && fixup->block != entry->block; fixup = fixup->next)
+          {
+          }
+          if (fixup == NULL)
+          {
+            fixup = (struct HdfFixup *)AllocVec(sizeof(struct HdfFixup), MEMF_ANY);
+            if (fixup == NULL)
+            {
+              entry->hash_chain = file->block;
+              return SINK_ERR_MEMORY;
+            }
+            fixup->block = entry->block;
+            fixup->next = image->fixups;
+            image->fixups = fixup;
+          }
+          fixup->hash_chain = entry->hash_chain;
+        }
+        break;
+      }
+    }
+  }
+
+  /* Its header block may be reused, so a fixup left for it must not be applied */
+  for (fixup_link = &image->fixups; (fixup = *fixup_link) != NULL; )
+  {
+    if (fixup->block == file->block)
+    {
+      *fixup_link = fixup->next;
+      FreeVec(fixup);
+    }
+    else
+    {
+      fixup_link = &fixup->next;
+    }
+  }
+
+  for (link = &directory->children; *link != file; link = &(*link)->next)
+  {
+  }
+  *link = file->next;
+  free_blocks(image, file->first_block, file->last_block);
+  free_entry(file);
+  return SINK_OK;
+}
+
+static LONG add_directory(struct HdfImage *image, struct HdfEntry *parent, const char *name, struct HdfEntry **directory)
+{
+  struct HdfEntry *entry;
+  LONG error;
+
+  entry = (struct HdfEntry *)AllocVec(sizeof(struct HdfEntry), MEMF_ANY | MEMF_CLEAR);
+  if (entry == NULL)
+  {
+    return SINK_ERR_MEMORY;
+  }
+  entry->hash_table = (ULONG *)AllocVec(HT_SIZE * sizeof(ULONG), MEMF_ANY | MEMF_CLEAR);
+  if (entry->hash_table == NULL)
+  {
+    FreeVec(entry);
+    return SINK_ERR_MEMORY;
+  }
+
+  /* The block stays empty until the image is closed */
+  if (allocate_block(image, &entry->block, &error) == NULL)
+  {
+    free_entry(entry);
+    return error;
+  }
+  strcpy(entry->name, name);
+  entry->is_directory = TRUE;
+  DateStamp(&entry->date);
+  link_entry(parent, entry);
+
+  *directory = entry;
+  return SINK_OK;
+}
+
+/*
+ * Finds or creates the directories along a path.  If file_name is not
+ * NULL the last name is a file: it is copied there and not created.
+ */
+static LONG walk_path(struct HdfImage *image, const char *path, struct HdfEntry **directory, char *file_name)
+{
+  struct HdfEntry *current = &image->root, *child;
+  char name[MAX_NAME + 1];
+  const char *start = path, *end, *rest;
+  ULONG length;
+  LONG error;
+
+  for (;;)
+  {
+    while (*start == '/')
+    {
+      start++;
+    }
+    if (*start == '\0')
+    {
+      break;
+    }
+    for (end = start; *end != '\0' && *end != '/'; end++)
+    {
+    }
+    length = end - start;
+    if (length > MAX_NAME)
+    {
+      return SINK_ERR_NAME;
+    }
+    memcpy(name, start, length);
+    name[length] = '\0';
+    if (strchr(name, ':') != NULL)
+    {
+      return SINK_ERR_NAME;
+    }
+
+    for (rest = end; *rest == '/'; rest++)
+    {
+    }
+    if (file_name != NULL && *rest == '\0')
+    {
+      strcpy(file_name, name);
+      *directory = current;
+      return SINK_OK;
+    }
+
+    child = find_entry(current, name);
+    if (child == NULL)
+    {
+      error = add_directory(image, current, name, &child);
+      if (error != SINK_OK)
+      {
+        return error;
+      }
+    }
+    else if (!child->is_directory)
+    {
+      return SINK_ERR_EXISTS;
+    }
+    current = child;
+    start = end;
+  }
+
+  if (file_name != NULL)
+  {
+    return SINK_ERR_NAME;
+  }
+  *directory = current;
+  return SINK_OK;
+}
+
+LONG hdf_make_directory(APTR handle, const char *path)
+{
+  struct HdfImage *image = (struct HdfImage *)handle;
+  struct HdfEntry *directory;
+
+  if (image->write_error != SINK_OK)
+  {
+    return image->write_error;
+  }
+  return walk_path(image, path, &directory, NULL);
+}
+
+LONG hdf_begin_file(APTR handle, const char *path, ULONG size, ULONG timestamp, ULONG protection, const char *comment)
+{
+  struct HdfImage *image = (struct HdfImage *)handle;
+
+  image->file_open = TRUE;
+  image->file_first = 0;
+  image->file_last = 0;
+  image->file_blocks = 0;
+  image->file_size = 0;
+  image->file_slot = NULL;
+  image->file_slot_used = 0;
+  image->file_timestamp = timestamp;
+  image->file_protection = protection;
+  image->file_comment[0] = '\0';
+  if (comment != NULL)
+  {
+    strncat(image->file_comment, comment, MAX_COMMENT);
+  }
+
+  image->file_error = image->write_error;
+  if (image->file_error == SINK_OK)
+  {
+    image->file_error = walk_path(image, path, &image->file_directory, image->file_name);
+  }
+  return image->file_error;
+}
+
+/* Allocates a block for the current file and keeps track of its extent */
+static UBYTE *allocate_file_block(struct HdfImage *image, ULONG *block)
+{
+  UBYTE *slot = allocate_block(image, block, &image->file_error);
+
+  if (slot != NULL)
+  {
+    if (image->file_first == 0)
+    {
+      image->file_first = *block;
+    }
+    image->file_last = *block;
+  }
+  return slot;
+}
+
+LONG hdf_write_file(APTR handle, const UBYTE *data, LONG length)
+{
+  struct HdfImage *image = (struct HdfImage *)handle;
+  ULONG block, count;
+  LONG written = 0;
+
+  if (!image->file_open || image->file_error != SINK_OK)
+  {
+    return -1;
+  }
+
+  while (written < length)
+  {
+    if (image->file_slot == NULL || image->file_slot_used == BLOCK_SIZE)
+    {
+      image->file_slot = allocate_file_block(image, &block);
+      if (image->file_slot == NULL)
+      {
+        return -1;
+      }
+      image->file_slot_used = 0;
+      image->file_blocks++;
+    }
+    count = BLOCK_SIZE - image->file_slot_used;
+    if (count > (ULONG)(length - written))
+    {
+      count = length - written;
+    }
+    memcpy(image->file_slot + image->file_slot_used, data + written, count);
+    image->file_slot_used += count;
+    written += count;
+  }
+
+  image->file_size += length;
+  return length;
+}
+
+/*
+ * Writes the extension blocks and the header after the file's data.
+ * Their block numbers are worked out first, as each block points to the
+ * next and to the header.
+ */
+static LONG write_file_header(struct HdfImage *image)
+{
+  struct HdfEntry *entry, *existing;
+  struct DateStamp date;
+  UBYTE *header = image->header, *slot;
+  ULONG num_ext, header_block, next_ext, block, data_block, count, i, k;
+  LONG error;
+
+  existing = find_entry(image->file_directory, image->file_name);
+  if (existing != NULL && existing->is_directory)
+  {
+    return SINK_ERR_EXISTS;
+  }
+
+  num_ext = image->file_blocks > HT_SIZE ? (image->file_blocks - 1) / HT_SIZE : 0;
+  block = image->buffer_start + image->buffer_used;
+  next_ext = 0;
+  for (i = 0; i < num_ext; i++)
+  {
+    block = skip_reserved(image, block);
+    if (i == 0)
+    {
+      next_ext = block;
+    }
+    block++;
+  }
+  header_block = skip_reserved(image, block);
+  if (header_block >= image->num_blocks)
+  {
+    return SINK_ERR_FULL;
+  }
+
+  entry = (struct HdfEntry *)AllocVec(sizeof(struct HdfEntry), MEMF_ANY | MEMF_CLEAR);
+  if (entry == NULL)
+  {
+    return SINK_ERR_MEMORY;
+  }
+
+  /* The header takes the first HT_SIZE data blocks, the extensions the rest */
+  memset(header, 0, BLOCK_SIZE);
+  data_block = image->file_first;
+  count = image->file_blocks < HT_SIZE ? image->file_blocks : HT_SIZE;
+  for (i = 0; i < count; i++)
+  {
+    write_be32(header + OFS_TABLE + (HT_SIZE - 1 - i) * 4, data_block);
+    data_block = skip_reserved(image, data_block + 1);
+  }
+  write_be32(header + OFS_HIGH_SEQ, count);
+
+  for (i = 0; i < num_ext; i++)
+  {
+    slot = allocate_file_block(image, &block);
+    if (slot == NULL)
+    {
+      FreeVec(entry);
+      return image->file_error;
+    }
+    count = image->file_blocks - HT_SIZE * (i + 1);
+    if (count > HT_SIZE)
+    {
+      count = HT_SIZE;
+    }
+    write_be32(slot + OFS_TYPE, T_LIST);
+    write_be32(slot + OFS_HEADER_KEY, block);
+    write_be32(slot + OFS_HIGH_SEQ, count);
+    for (k = 0; k < count; k++)
+    {
+      write_be32(slot + OFS_TABLE + (HT_SIZE - 1 - k) * 4, data_block);
+      data_block = skip_reserved(image, data_block + 1);
+    }
+    write_be32(slot + OFS_PARENT, header_block);
+    write_be32(slot + OFS_EXTENSION, i + 1 < num_ext ? skip_reserved(image, block + 1) : 0);
+    write_be32(slot + OFS_SEC_TYPE, (ULONG)ST_FILE);
+    set_checksum(slot, OFS_CHECKSUM);
+  }
+
+  slot = allocate_file_block(image, &block);
+  if (slot == NULL)
+  {
+    FreeVec(entry);
+    return image->file_error;
+  }
+
+  if (existing != NULL)
+  {
+    error = unlink_file(image, image->file_directory, existing);
+    if (error != SINK_OK)
+    {
+      FreeVec(entry);
+      return error;
+    }
+  }
+  strcpy(entry->name, image->file_name);
+  entry->block = block;
+  entry->first_block = image->file_first;
+  entry->last_block = block;
+  link_entry(image->file_directory, entry);
+
+  date.ds_Days = image->file_timestamp / 86400;
+  date.ds_Minute = (image->file_timestamp % 86400) / 60;
+  date.ds_Tick = (image->file_timestamp % 60) * TICKS_PER_SECOND;
+
+  write_be32(header + OFS_TYPE, T_HEADER);
+  write_be32(header + OFS_HEADER_KEY, block);
+  write_be32(header + OFS_FIRST_DATA, image->file_blocks > 0 ? image->file_first : 0);
+  write_be32(header + OFS_PROTECT, image->file_protection);
+  write_be32(header + OFS_BYTE_SIZE, image->file_size);
+  write_bcpl_string(header + OFS_COMMENT, image->file_comment, MAX_COMMENT);
+  write_date(header + OFS_DATE, &date);
+  write_bcpl_string(header + OFS_NAME, entry->name, MAX_NAME);
+  write_be32(header + OFS_HASH_CHAIN, entry->hash_chain);
+  write_be32(header + OFS_PARENT, image->file_directory->block);
+  write_be32(header + OFS_EXTENSION, next_ext);
+  write_be32(header + OFS_SEC_TYPE, (ULONG)ST_FILE);
+  set_checksum(header, OFS_CHECKSUM);
+  memcpy(slot, header, BLOCK_SIZE);
+  return SINK_OK;
+}
+
+LONG hdf_end_file(APTR handle, BOOL keep)
+{
+  struct HdfImage *image = (struct HdfImage *)handle;
+  LONG result;
+
+  if (!image->file_open)
+  {
+    return SINK_OK;
+  }
+  image->file_open = FALSE;
+
+  result = image->file_error;
+  if (result == SINK_OK && keep)
+  {
+    result = write_file_header(image);
+  }
+  if (result != SINK_OK || !keep)
+  {
+    free_blocks(image, image->file_first, image->file_last);
+  }
+  return result;
+}
+
+static void write_directories(struct HdfImage *image, struct HdfEntry *directory, ULONG parent_block)
+{
+  struct HdfEntry *entry;
+  UBYTE *block = image->header;
+  int i;
+
+  for (entry = directory->children; entry != NULL && image->write_error == SINK_OK; entry = entry->next)
+  {
+    if (!entry->is_directory)
+    {
+      continue;
+    }
+    memset(block, 0, BLOCK_SIZE);
+    write_be32(block + OFS_TYPE, T_HEADER);
+    write_be32(block + OFS_HEADER_KEY, entry->block);
+    for (i = 0; i < HT_SIZE; i++)
+    {
+      write_be32(block + OFS_TABLE + i * 4, entry->hash_table[i]);
+    }
+    write_date(block + OFS_DATE, &entry->date);
+    write_bcpl_string(block + OFS_NAME, entry->name, MAX_NAME);
+    write_be32(block + OFS_HASH_CHAIN, entry->hash_chain);
+    write_be32(block + OFS_PARENT, parent_block);
+    write_be32(block + OFS_SEC_TYPE, ST_USERDIR);
+    set_checksum(block, OFS_CHECKSUM);
+    write_block_at(image, entry->block, block);
+
+    write_directories(image, entry, entry->block);
+  }
+}
+
+/* Writes the root block, followed by the bitmap and bitmap extension blocks */
+static void write_root_and_bitmaps(struct HdfImage *image)
+{
+  UBYTE *block = image->header;
+  ULONG bitmap_block, ext_block;
+  ULONG i, k;
+
+  memset(block, 0, BLOCK_SIZE);
+  write_be32(block + OFS_TYPE, T_HEADER);
+  write_be32(block + OFS_HT_SIZE, HT_SIZE);
+  for (i = 0; i < HT_SIZE; i++)
+  {
+    write_be32(block + OFS_TABLE + i * 4, image->root.hash_table[i]);
+  }
+  write_be32(block + OFS_BM_FLAG, 0xFFFFFFFFUL);
+  for (i = 0; i < image->num_bitmaps && i < BM_PAGES; i++)
+  {
+    write_be32(block + OFS_BM_PAGES + i * 4, image->root_block + 1 + i);
+  }
+  if (image->num_bitmap_ext > 0)
+  {
+    write_be32(block + OFS_BM_EXT, image->root_block + 1 + image->num_bitmaps);
+  }
+  write_date(block + OFS_DATE, &image->root.date);
+  write_bcpl_string(block + OFS_NAME, image->volume_name, MAX_NAME);
+  write_date(block + OFS_VOLUME_DATE, &image->root.date);
+  write_date(block + OFS_CREATION_DATE, &image->root.date);
+  write_be32(block + OFS_SEC_TYPE, ST_ROOT);
+  set_checksum(block, OFS_CHECKSUM);
+  write_block_at(image, image->root_block, block);
+
+  for (i = 0; i < image->num_bitmaps && image->write_error == SINK_OK; i++)
+  {
+    memset(block, 0, BLOCK_SIZE);
+    for (k = 0; k < MAP_LONGS; k++)
+    {
+      write_be32(block + 4 + k * 4, image->free_map[i * MAP_LONGS + k]);
+    }
+    set_checksum(block, 0);
+    write_block_at(image, image->root_block + 1 + i, block);
+  }
+
+  bitmap_block = BM_PAGES;
+  for (i = 0; i < image->num_bitmap_ext && image->write_error == SINK_OK; i++)
+  {
+    memset(block, 0, BLOCK_SIZE);
+    for (k = 0; k < MAP_LONGS && bitmap_block < image->num_bitmaps; k++, bitmap_block++)
+    {
+      write_be32(block + k * 4, image->root_block + 1 + bitmap_block);
+    }
+    ext_block = image->root_block + 1 + image->num_bitmaps + i;
+    if (i + 1 < image->num_bitmap_ext)
+    {
+      write_be32(block + MAP_LONGS * 4, ext_block + 1);
+    }
+    write_block_at(image, ext_block, block);
+  }
+}
+
+static void apply_fixups(struct HdfImage *image)
+{
+  struct HdfFixup *fixup;
+  UBYTE *block = image->header;
+
+  for (fixup = image->fixups; fixup != NULL && image->write_error == SINK_OK; fixup = fixup->next)
+  {
+    if (Seek(image->file, (LONG)(fixup->block * BLOCK_SIZE), OFFSET_BEGINNING) < 0 ||
+        Read(image->file, block, BLOCK_SIZE) != BLOCK_SIZE)
+    {
+      image->write_error = SINK_ERR_WRITE;
+      break;
+    }
+    write_be32(block + OFS_HASH_CHAIN, fixup->hash_chain);
+    set_checksum(block, OFS_CHECKSUM);
+    write_block_at(image, fixup->block, block);
+  }
+}
+
+LONG hdf_close_image(APTR handle)
+{
+  struct HdfImage *image = (struct HdfImage *)handle;
+  struct HdfEntry *entry, *next;
+  struct HdfFixup *fixup;
+  LONG result, length;
+  ULONG remaining;
+
+  hdf_end_file(image, FALSE);
+
+  /* Finish the sequential pass with empty blocks up to the end of the image */
+  if (image->write_error == SINK_OK && flush_buffer(image))
+  {
+    memset(image->buffer, 0, BUFFER_BLOCKS * BLOCK_SIZE);
+    remaining = image->num_blocks - image->buffer_start;
+    while (remaining > 0)
+    {
+      length = (remaining < BUFFER_BLOCKS ? remaining : BUFFER_BLOCKS) * BLOCK_SIZE;
+      if (Write(image->file, image->buffer, length) != length)
+      {
+        image->write_error = SINK_ERR_WRITE;
+        break;
+      }
+      remaining -= length / BLOCK_SIZE;
+    }
+  }
+
+  if (image->write_error == SINK_OK)
+  {
+    write_root_and_bitmaps(image);
+  }
+  if (image->write_error == SINK_OK)
+  {
+    write_directories(image, &image->root, image->root_block);
+  }
+  if (image->write_error == SINK_OK)
+  {
+    apply_fixups(image);
+  }
+  result = image->write_error;
+
+  if (!Close(image->file) && result == SINK_OK)
+  {
+    result = SINK_ERR_WRITE;
+  }
+
+  for (entry = image->root.children; entry != NULL; entry = next)
+  {
+    next = entry->next;
+    free_entry(entry);
+  }
+  while ((fixup = image->fixups) != NULL)
+  {
+    image->fixups = fixup->next;
+    FreeVec(fixup);
+  }
+  FreeVec(image->root.hash_table);
+  FreeVec(image->free_map);
+  FreeVec(image->buffer);
+  FreeVec(image);
+  return result;
+}
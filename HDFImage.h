@@ -0,0 +1,45 @@
+/*
+
+  HDFImage
+
+  Writes an FFS (DOS\3) hardfile image for emulators and FPGA boards.
+  File data is written sequentially as it is decoded, each file followed
+  by its extension and header blocks.  Directory, root and bitmap blocks
+  are kept in memory and written when the image is closed.
+
+  This program is released under the MIT License.
+*/
+
+#ifndef HDFIMAGE_H
+#define HDFIMAGE_H
+
+#include <dos/dos.h>
+#include <exec/types.h>
+
+#include "OutputSink.h"
+
+#define HDF_MAX_SIZE_MB 2047 /* Seek() offsets are signed 32 bit */
+
+struct HdfImage;
+
+/*
+ * Creates an image of size_mb megabytes, rounded down to whole tracks of
+ * 32 blocks, named after the image file.  Returns NULL on failure with
+ * the SINK_ERR_ reason in *error.
+ */
+struct HdfImage *hdf_create_image(CONST_STRPTR image_path, ULONG size_mb, LONG *error);
+
+/*
+ * The OutputSink functions.  Names longer than 30 characters give
+ * SINK_ERR_NAME.  A file replaces an existing file with the same name,
+ * and a discarded file leaves no trace in the image.
+ */
+LONG hdf_make_directory(APTR image, const char *path);
+LONG hdf_begin_file(APTR image, const char *path, ULONG size, ULONG timestamp, ULONG protection, const char *comment);
+LONG hdf_write_file(APTR image, const UBYTE *data, LONG length);
+LONG hdf_end_file(APTR image, BOOL keep);
+
+/* Writes the remaining blocks and closes the image */
+LONG hdf_close_image(APTR image);
+
+#endif
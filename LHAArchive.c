@@ -0,0 +1,396 @@
+/*
+
+  LHAArchive
+
+  Minimal reader for the member headers of LHA archives (header levels
+  0, 1 and 2).  Only the headers are read; the compressed data of each
+  member is skipped with Seek(), or by the caller for a stream.
+
+  This program is released under the MIT License.
+*/
+
+#include <dos/dos.h>
+#include <exec/memory.h>
+#include <exec/types.h>
+#include <proto/dos.h>
+#include <proto/exec.h>
+#include <string.h>
+
+#include "LHAArchive.h"
+
+#define LHA_BASE_HEADER_SIZE 21   /* Bytes common to every header level */
+#define LHA_INITIAL_MEMBERS 32
+#define UNIX_TO_AMIGA_EPOCH 252460800UL /* Seconds from 1970-01-01 to 1978-01-01 */
+
+static ULONG read_le16(const UBYTE *p)
+{
+  return (ULONG)p[0] | ((ULONG)p[1] << 8);
+}
+
+static ULONG read_le32(const UBYTE *p)
+{
+  return (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+/*
+ * Returns the number of days from 1978-01-01 to the given date.
+ */
+static ULONG days_since_1978(int year, int month, int day)
+{
+  static const int days_before_month[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  ULONG days = 0;
+  int y;
+
+  for (y = 1978; y < year; y++)
+  {
+    days += ((y % 4 == 0 && y % 100 != 0) || y % 400 == 0) ? 366 : 365;
+  }
+  if (month >= 1 && month <= 12)
+  {
+    days += days_before_month[month - 1];
+    if (month > 2 && ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0))
+    {
+      days++;
+    }
+  }
+  if (day > 0)
+  {
+    days += day - 1;
+  }
+  return days;
+}
+
+/*
+ * Converts an MS-DOS packed date and time, as stored in level 0 and 1
+ * headers, to seconds since the AmigaDOS epoch.
+ */
+static ULONG dos_time_to_amiga(ULONG dos_time)
+{
+  ULONG date = dos_time >> 16;
+  ULONG time_of_day = dos_time & 0xFFFF;
+  int year = (int)(date >> 9) + 1980;
+
+  if (year < 1978)
+  {
+    return 0;
+  }
+  return days_since_1978(year, (int)((date >> 5) & 15), (int)(date & 31)) * 86400UL +
+         (time_of_day >> 11) * 3600UL + ((time_of_day >> 5) & 63) * 60UL + (time_of_day & 31) * 2UL;
+}
+
+/*
+ * Copies a member name into the path buffer, converting the '\' and 0xFF
+ * separators used by other LHA implementations to '/'.  Amiga LHA stores
+ * the file comment after a NUL in the name field, so copying stops there.
+ */
+static void append_path(char *path, const UBYTE *name, ULONG name_length)
+{
+  ULONG length = strlen(path);
+  ULONG i;
+
+  for (i = 0; i < name_length && name[i] != '\0' && length < LHA_MAX_PATH - 1; i++)
+  {
+    path[length++] = (name[i] == '\\' || name[i] == 0xFF) ? '/' : (char)name[i];
+  }
+  path[length] = '\0';
+}
+
+/*
+ * Copies the file comment that Amiga LHA stores after a NUL in the name
+ * field of level 0 and 1 headers.
+ */
+static void copy_comment(struct LhaMember *member, const UBYTE *name, ULONG name_length)
+{
+  ULONG i, length = 0;
+
+  for (i = 0; i < name_length && name[i] != '\0'; i++)
+  {
+  }
+  for (i++; i < name_length && length < sizeof(member->comment) - 1; i++)
+  {
+    member->comment[length++] = (char)name[i];
+  }
+  member->comment[length] = '\0';
+}
+
+/*
+ * Reads the chain of extended headers used by level 1 and 2 headers.
+ * Each extended header is a type byte, its data and the size of the next
+ * extended header.  Returns the number of bytes consumed, or -1 on error.
+ */
+static LONG read_extended_headers(LhaReadFunc read, APTR handle, ULONG next_size, struct LhaMember *member)
+{
+  char directory[LHA_MAX_PATH];
+  char file_name[LHA_MAX_PATH];
+  UBYTE *buffer;
+  LONG consumed = 0;
+
+  directory[0] = '\0';
+  file_name[0] = '\0';
+
+  while (next_size != 0)
+  {
+    if (next_size < 3)
+    {
+      return -1;
+    }
+    buffer = (UBYTE *)AllocVec(next_size, MEMF_ANY);
+    if (buffer == NULL)
+    {
+      return -1;
+    }
+    if (read(handle, buffer, next_size) != (LONG)next_size)
+    {
+      FreeVec(buffer);
+      return -1;
+    }
+
+    switch (buffer[0])
+    {
+    case 0x01: /* File name */
+      file_name[0] = '\0';
+      append_path(file_name, buffer + 1, next_size - 3);
+      break;
+    case 0x02: /* Directory name, components separated by 0xFF */
+      directory[0] = '\0';
+      append_path(directory, buffer + 1, next_size - 3);
+      break;
+    case 0x54: /* UNIX modification time */
+      if (next_size >= 7)
+      {
+        ULONG unix_time = read_le32(buffer + 1);
+        member->timestamp = unix_time > UNIX_TO_AMIGA_EPOCH ? unix_time - UNIX_TO_AMIGA_EPOCH : 0;
+      }
+      break;
+    default:
+      break;
+    }
+
+    consumed += next_size;
+    next_size = read_le16(buffer + next_size - 2);
+    FreeVec(buffer);
+  }
+
+  if (file_name[0] != '\0')
+  {
+    strcpy(member->path, file_name);
+  }
+  if (directory[0] != '\0')
+  {
+    char joined[LHA_MAX_PATH];
+
+    strcpy(joined, directory);
+    if (joined[strlen(joined) - 1] != '/' && member->path[0] != '\0')
+    {
+      append_path(joined, (const UBYTE *)"/", 1);
+    }
+    append_path(joined, (const UBYTE *)member->path, strlen(member->path));
+    strcpy(member->path, joined);
+  }
+
+  return consumed;
+}
+
+/*
+ * Reads one member header at the current position of the stream.
+ * Returns 1 when a member was read, 0 at the end of the archive and a
+ * negative error code on failure.  *header_length receives the full
+ * header size.
+ */
+static LONG read_member_header(LhaReadFunc read, APTR handle, struct LhaMember *member, ULONG *header_length)
+{
+  UBYTE header[LHA_BASE_HEADER_SIZE + 260];
+  LONG bytes_read;
+  LONG extended;
+  ULONG name_length, padding;
+
+  memset(member, 0, sizeof(struct LhaMember));
+
+  bytes_read = read(handle, header, 1);
+  if (bytes_read <= 0 || header[0] == 0)
+  {
+    return 0; /* End of archive marker or end of file */
+  }
+  if (read(handle, header + 1, LHA_BASE_HEADER_SIZE - 1) != LHA_BASE_HEADER_SIZE - 1)
+  {
+    return LHA_ERR_FORMAT;
+  }
+  if (header[2] != '-' || header[6] != '-')
+  {
+    return LHA_ERR_FORMAT;
+  }
+
+  memcpy(member->method, header + 2, 5);
+  member->method[5] = '\0';
+  member->packed_size = read_le32(header + 7);
+  member->original_size = read_le32(header + 11);
+  member->attributes = header[19];
+  member->header_level = header[20];
+  member->is_directory = strcmp(member->method, "-lhd-") == 0;
+
+  switch (member->header_level)
+  {
+  case 0:
+  case 1:
+    *header_length = (ULONG)header[0] + 2;
+    if (*header_length < LHA_BASE_HEADER_SIZE + 3 ||
+        read(handle, header + LHA_BASE_HEADER_SIZE, *header_length - LHA_BASE_HEADER_SIZE) != (LONG)(*header_length - LHA_BASE_HEADER_SIZE))
+    {
+      return LHA_ERR_FORMAT;
+    }
+    member->timestamp = dos_time_to_amiga(read_le32(header + 15));
+    name_length = header[21];
+    if (22 + name_length + 2 > *header_length)
+    {
+      return LHA_ERR_FORMAT;
+    }
+    append_path(member->path, header + 22, name_length);
+    copy_comment(member, header + 22, name_length);
+    member->crc = (UWORD)read_le16(header + 22 + name_length);
+    if (22 + name_length + 3 <= *header_length)
+    {
+      member->os_id = header[24 + name_length];
+    }
+
+    if (member->header_level == 1)
+    {
+      extended = read_extended_headers(read, handle, read_le16(header + *header_length - 2), member);
+      if (extended < 0 || (ULONG)extended > member->packed_size)
+      {
+        return LHA_ERR_FORMAT;
+      }
+      /* Level 1 counts the extended headers as part of the packed size */
+      member->packed_size -= extended;
+      *header_length += extended;
+    }
+    break;
+
+  case 2:
+    if (read(handle, header + LHA_BASE_HEADER_SIZE, 5) != 5)
+    {
+      return LHA_ERR_FORMAT;
+    }
+    *header_length = read_le16(header);
+    member->timestamp = read_le32(header + 15);
+    member->timestamp = member->timestamp > UNIX_TO_AMIGA_EPOCH ? member->timestamp - UNIX_TO_AMIGA_EPOCH : 0;
+    member->crc = (UWORD)read_le16(header + 21);
+    member->os_id = header[23];
+    extended = read_extended_headers(read, handle, read_le16(header + 24), member);
+    if (extended < 0 || (ULONG)extended + 26 > *header_length)
+    {
+      return LHA_ERR_FORMAT;
+    }
+    /* LHa for Unix pads a header whose size would end in a zero byte */
+    for (padding = *header_length - 26 - extended; padding > 0; padding -= bytes_read)
+    {
+      bytes_read = padding > sizeof(header) ? sizeof(header) : padding;
+      if (read(handle, header, bytes_read) != bytes_read)
+      {
+        return LHA_ERR_FORMAT;
+      }
+    }
+    break;
+
+  default:
+    return LHA_ERR_FORMAT;
+  }
+
+  name_length = strlen(member->path);
+  if (name_length > 0 && member->path[name_length - 1] == '/')
+  {
+    member->path[name_length - 1] = '\0';
+  }
+  return 1;
+}
+
+static LONG read_file(APTR handle, UBYTE *buffer, LONG length)
+{
+  return Read((BPTR)handle, buffer, length);
+}
+
+LONG lha_read_members(CONST_STRPTR archive_path, struct LhaMember **members, LONG *num_members)
+{
+  struct LhaMember *list, *grown;
+  LONG capacity = LHA_INITIAL_MEMBERS;
+  LONG count = 0;
+  ULONG offset = 0;
+  ULONG header_length;
+  LONG result = LHA_OK;
+  LONG status;
+  BPTR file;
+
+  *members = NULL;
+  *num_members = 0;
+
+  file = Open(archive_path, MODE_OLDFILE);
+  if (file == 0)
+  {
+    return LHA_ERR_OPEN;
+  }
+
+  list = (struct LhaMember *)AllocVec(capacity * sizeof(struct LhaMember), MEMF_ANY);
+  if (list == NULL)
+  {
+    Close(file);
+    return LHA_ERR_MEMORY;
+  }
+
+  for (;;)
+  {
+    if (count == capacity)
+    {
+      grown = (struct LhaMember *)AllocVec(capacity * 2 * sizeof(struct LhaMember), MEMF_ANY);
+      if (grown == NULL)
+      {
+        result = LHA_ERR_MEMORY;
+        break;
+      }
+      memcpy(grown, list, capacity * sizeof(struct LhaMember));
+      FreeVec(list);
+      list = grown;
+      capacity *= 2;
+    }
+
+    status = read_member_header(read_file, (APTR)file, &list[count], &header_length);
+    if (status <= 0)
+    {
+      result = status;
+      break;
+    }
+
+    list[count].data_offset = offset + header_length;
+    offset = list[count].data_offset + list[count].packed_size;
+    count++;
+
+    if (Seek(file, offset, OFFSET_BEGINNING) < 0)
+    {
+      result = LHA_ERR_FORMAT;
+      break;
+    }
+  }
+
+  Close(file);
+
+  if (result != LHA_OK)
+  {
+    FreeVec(list);
+    return result;
+  }
+
+  *members = list;
+  *num_members = count;
+  return LHA_OK;
+}
+
+void lha_free_members(struct LhaMember *members)
+{
+  if (members != NULL)
+  {
+    FreeVec(members);
+  }
+}
+
+LONG lha_read_next_member(LhaReadFunc read, APTR handle, struct LhaMember *member, ULONG *header_length)
+{
+  return read_member_header(read, handle, member, header_length);
+}
@@ -0,0 +1,64 @@
+/*
+
+  LHAArchive
+
+  Minimal reader for the member headers of LHA archives (header levels
+  0, 1 and 2).  It lets WHDArchiveExtractor find member boundaries,
+  sizes and names without launching c:lha.
+
+  This program is released under the MIT License.
+*/
+
+#ifndef LHAARCHIVE_H
+#define LHAARCHIVE_H
+
+#include <dos/dos.h>
+#include <exec/types.h>
+
+#define LHA_MAX_PATH 256
+
+/* Return codes, negative on failure in the style of check_disk_space() */
+#define LHA_OK 0
+#define LHA_ERR_OPEN -1
+#define LHA_ERR_MEMORY -2
+#define LHA_ERR_FORMAT -3
+
+/* Reads up to length bytes, returns the number read or -1 on error */
+typedef LONG (*LhaReadFunc)(APTR handle, UBYTE *buffer, LONG length);
+
+struct LhaMember
+{
+  char  method[6];      /* Compression method, e.g. "-lh5-" */
+  ULONG packed_size;    /* Size of the compressed data only */
+  ULONG original_size;  /* Size of the decoded member */
+  ULONG data_offset;    /* Archive offset of the compressed data */
+  ULONG timestamp;      /* Seconds since 1978-01-01, the AmigaDOS epoch */
+  UWORD crc;            /* CRC-16 of the decoded data */
+  UBYTE attributes;     /* Attribute byte from the header */
+  UBYTE header_level;
+  UBYTE os_id;          /* 'A' for archives made on the Amiga */
+  BOOL  is_directory;
+  char  path[LHA_MAX_PATH]; /* Member path using '/' separators */
+  char  comment[80];    /* Amiga file comment, if any */
+};
+
+/*
+ * Reads every member header of an LHA archive without decoding any data.
+ * On success *members holds an AllocVec'd array of *num_members entries
+ * which must be released with lha_free_members().
+ */
+LONG lha_read_members(CONST_STRPTR archive_path, struct LhaMember **members, LONG *num_members);
+void lha_free_members(struct LhaMember *members);
+
+/*
+ * Reads the header of the next member from a stream that is positioned
+ * at one, leaving it at the member's compressed data, so an archive can
+ * be read front to back without seeking.  read must only return fewer
+ * bytes than asked for at the end of the stream.  Returns 1 when a
+ * member was read, 0 at the end of the archive and a negative LHA_ERR_
+ * code on failure.  *header_length receives the size of the header;
+ * data_offset is left 0.
+ */
+LONG lha_read_next_member(LhaReadFunc read, APTR handle, struct LhaMember *member, ULONG *header_length);
+
+#endif
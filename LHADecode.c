@@ -0,0 +1,836 @@
+/*
+
+  LHADecode
+
+  Native decoder for the -lh4- to -lh7- static Huffman methods and the
+  -lh0-/-lz4- store methods.  The Huffman decoding follows the public
+  domain ar002 decoder by Haruhiko Okumura that LHA itself is based on.
+
+  Built with LHA_68020 defined, for a 68020 or later, the bit stream is
+  read with the BFEXTU instruction and matches are copied with an
+  unrolled loop, the two things that decide the speed of -lh5- on a
+  real Amiga.  The portable C code stays the reference.
+
+  This program is released under the MIT License.
+*/
+
+#include <exec/memory.h>
+#include <exec/types.h>
+#include <proto/exec.h>
+#include <string.h>
+
+#include "LHADecode.h"
+
+#define BITBUFSIZ 16
+#define MAX_DICBIT 16
+#define MIN_DICBIT 12                       /* -lh4-, and the chunk size for stored data */
+#define THRESHOLD 3
+#define NC (255 + 256 + 2 - THRESHOLD) /* Literals plus match lengths */
+#define CBIT 9
+#define NT (BITBUFSIZ + 3)
+#define TBIT 5
+#define NP_MAX (MAX_DICBIT + 1)
+#define NPT NT /* NT is larger than any position table */
+#define C_TABLE_BITS 12
+#define PT_TABLE_BITS 8
+#define INPUT_BUFFER_SIZE 4096
+#define MIN_INPUT_BUFFER_SIZE 256
+
+struct LhaDecoder
+{
+  /* Input */
+  LhaReadFunc read;
+  APTR   read_handle;
+  ULONG  packed_left;
+  UBYTE *input;
+  ULONG  input_size;
+  LONG   input_pos;
+  LONG   input_length;
+  BOOL   read_failed;
+
+  /* Bit buffer */
+#ifdef LHA_68020
+  ULONG  bitpos;       /* Of the next bit in input, with 32 more bits read behind it */
+#else
+  UWORD  bitbuf;
+  UWORD  subbitbuf;
+  int    bitcount;
+#endif
+
+  /* Huffman tables for the current block */
+  UWORD  blocksize;
+  BOOL   bad_table;
+  UBYTE  c_len[NC];
+  UBYTE  pt_len[NPT];
+  UWORD  c_table[1 << C_TABLE_BITS];
+  UWORD  pt_table[1 << PT_TABLE_BITS];
+  UWORD  left[2 * NC - 1];
+  UWORD  right[2 * NC - 1];
+
+  UWORD  crc_table[256];
+  UBYTE *window;
+  ULONG  window_size;  /* Grown to the dictionary of the largest method met so far */
+};
+
+/* Fast memory where there is some, as the decoder works on these buffers the most */
+static APTR allocate_buffer(ULONG size)
+{
+  APTR buffer = AllocVec(size, MEMF_FAST);
+
+  return buffer != NULL ? buffer : AllocVec(size, MEMF_ANY);
+}
+
+/* Makes the window at least size bytes; the old contents are not kept */
+static BOOL reserve_window(struct LhaDecoder *decoder, ULONG size)
+{
+  UBYTE *window;
+
+  if (decoder->window_size >= size)
+  {
+    return TRUE;
+  }
+  window = (UBYTE *)allocate_buffer(size);
+  if (window == NULL)
+  {
+    return FALSE;
+  }
+  if (decoder->window != NULL)
+  {
+    FreeVec(decoder->window);
+  }
+  decoder->window = window;
+  decoder->window_size = size;
+  return TRUE;
+}
+
+struct LhaDecoder *lha_create_decoder(void)
+{
+  return lha_create_decoder_sized(INPUT_BUFFER_SIZE);
+}
+
+struct LhaDecoder *lha_create_decoder_sized(ULONG input_size)
+{
+  struct LhaDecoder *decoder;
+  UWORD crc;
+  int i, bit;
+
+  decoder = (struct LhaDecoder *)AllocVec(sizeof(struct LhaDecoder), MEMF_ANY | MEMF_CLEAR);
+  if (decoder == NULL)
+  {
+    return NULL;
+  }
+
+  /* A smaller input buffer only means more calls to read */
+  decoder->input_size = input_size < MIN_INPUT_BUFFER_SIZE ? MIN_INPUT_BUFFER_SIZE : input_size;
+  while ((decoder->input = (UBYTE *)allocate_buffer(decoder->input_size)) == NULL &&
+         decoder->input_size > MIN_INPUT_BUFFER_SIZE)
+  {
+    decoder->input_size /= 2;
+  }
+  if (decoder->input == NULL || !reserve_window(decoder, 1UL << MIN_DICBIT))
+  {
+    lha_free_decoder(decoder);
+    return NULL;
+  }
+
+  /* CRC-16 as used by LHA, polynomial 0xA001 */
+  for (i = 0; i < 256; i++)
+  {
+    crc = (UWORD)i;
+    for (bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 1) ? (UWORD)((crc >> 1) ^ 0xA001) : (UWORD)(crc >> 1);
+    }
+    decoder->crc_table[i] = crc;
+  }
+
+  return decoder;
+}
+
+void lha_free_decoder(struct LhaDecoder *decoder)
+{
+  if (decoder != NULL)
+  {
+    if (decoder->window != NULL)
+    {
+      FreeVec(decoder->window);
+    }
+    if (decoder->input != NULL)
+    {
+      FreeVec(decoder->input);
+    }
+    FreeVec(decoder);
+  }
+}
+
+static UWORD update_crc(struct LhaDecoder *decoder, UWORD crc, const UBYTE *data, ULONG length)
+{
+  while (length-- > 0)
+  {
+    crc = (UWORD)(decoder->crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8));
+  }
+  return crc;
+}
+
+#ifdef LHA_68020
+
+/* BFEXTU takes a field of up to 32 bits at any bit offset from base, counting from the top bit of each byte as LHA does */
+#if defined(__GNUC__)
+static __inline__ ULONG bit_field(const UBYTE *base, ULONG offset, ULONG width)
+{
+  ULONG value;
+
+  __asm__ __volatile__("bfextu (%1){%2:%3},%0" : "=d"(value) : "a"(base), "d"(offset), "d"(width) : "cc", "memory");
+  return value;
+}
+#elif defined(__VBCC__)
+ULONG bit_field(__reg("a0") const UBYTE *base, __reg("d0") ULONG offset, __reg("d1") ULONG width) = "\tbfextu\t(a0){d0:d1},d0";
+#else
+#error "LHA_68020 needs the inline assembly of GCC or VBCC"
+#endif
+
+/*
+ * Moves the bytes not yet used to the front of the input buffer and
+ * reads more behind them.  Past the end of the member the stream reads
+ * as zeros.
+ */
+static void refill_input(struct LhaDecoder *decoder)
+{
+  ULONG start = decoder->bitpos >> 3;
+  LONG keep = decoder->input_length - (LONG)start, count = 0, wanted;
+
+  memmove(decoder->input, decoder->input + start, keep);
+  decoder->bitpos &= 7;
+
+  wanted = (LONG)decoder->input_size - keep;
+  if ((ULONG)wanted > decoder->packed_left)
+  {
+    wanted = (LONG)decoder->packed_left;
+  }
+  if (wanted > 0)
+  {
+    count = decoder->read(decoder->read_handle, decoder->input + keep, wanted);
+    if (count <= 0)
+    {
+      count = 0;
+      decoder->packed_left = 0;
+      decoder->read_failed = TRUE;
+    }
+    decoder->packed_left -= count;
+  }
+  if (count == 0)
+  {
+    memset(decoder->input + keep, 0, 4);
+    count = 4;
+  }
+  decoder->input_length = keep + count;
+}
+
+/* Skips n bits */
+static void fillbuf(struct LhaDecoder *decoder, int n)
+{
+  decoder->bitpos += n;
+  while (decoder->bitpos + 32 > (ULONG)decoder->input_length * 8)
+  {
+    refill_input(decoder);
+  }
+}
+
+/* The next n bits, 1 to 16, without skipping them */
+static UWORD peekbits(struct LhaDecoder *decoder, int n)
+{
+  return (UWORD)bit_field(decoder->input, decoder->bitpos, n);
+}
+
+static UWORD getbits(struct LhaDecoder *decoder, int n)
+{
+  UWORD x = n > 0 ? peekbits(decoder, n) : 0; /* A width of 0 would be 32 to BFEXTU */
+
+  fillbuf(decoder, n);
+  return x;
+}
+
+#else
+
+static UBYTE next_input_byte(struct LhaDecoder *decoder)
+{
+  LONG wanted;
+
+  if (decoder->input_pos == decoder->input_length)
+  {
+    if (decoder->packed_left == 0)
+    {
+      return 0; /* Pad with zeros past the end of the member */
+    }
+    wanted = decoder->packed_left < decoder->input_size ? (LONG)decoder->packed_left : (LONG)decoder->input_size;
+    decoder->input_length = decoder->read(decoder->read_handle, decoder->input, wanted);
+    decoder->input_pos = 0;
+    if (decoder->input_length <= 0)
+    {
+      decoder->input_length = 0;
+      decoder->packed_left = 0;
+      decoder->read_failed = TRUE;
+      return 0;
+    }
+    decoder->packed_left -= decoder->input_length;
+  }
+  return decoder->input[decoder->input_pos++];
+}
+
+/* Shifts bitbuf n bits left and reads n new bits */
+static void fillbuf(struct LhaDecoder *decoder, int n)
+{
+  decoder->bitbuf = (UWORD)(decoder->bitbuf << n);
+  while (n > decoder->bitcount)
+  {
+    n -= decoder->bitcount;
+    decoder->bitbuf |= (UWORD)(decoder->subbitbuf << n);
+    decoder->subbitbuf = next_input_byte(decoder);
+    decoder->bitcount = 8;
+  }
+  decoder->bitcount -= n;
+  decoder->bitbuf |= (UWORD)(decoder->subbitbuf >> decoder->bitcount);
+}
+
+/* The next n bits, 1 to 16, without skipping them */
+static UWORD peekbits(struct LhaDecoder *decoder, int n)
+{
+  return (UWORD)(decoder->bitbuf >> (BITBUFSIZ - n));
+}
+
+static UWORD getbits(struct LhaDecoder *decoder, int n)
+{
+  UWORD x = (UWORD)(decoder->bitbuf >> (BITBUFSIZ - n));
+
+  fillbuf(decoder, n);
+  return x;
+}
+
+#endif
+
+/*
+ * Builds a lookup table for the first table_bits bits of each code,
+ * with longer codes continuing into the left/right tree.
+ */
+static void make_table(struct LhaDecoder *decoder, int nchar, const UBYTE *bitlen, int table_bits, UWORD *table)
+{
+  ULONG count[17], weight[17], start[18];
+  ULONG i, k, len, ch, jutbits, avail, nextcode, mask;
+  UWORD *p;
+
+  for (i = 1; i <= 16; i++)
+  {
+    count[i] = 0;
+  }
+  for (i = 0; i < (ULONG)nchar; i++)
+  {
+    if (bitlen[i] > 16)
+    {
+      decoder->bad_table = TRUE;
+      return;
+    }
+    count[bitlen[i]]++;
+  }
+
+  start[1] = 0;
+  for (i = 1; i <= 16; i++)
+  {
+    start[i + 1] = start[i] + (count[i] << (16 - i));
+  }
+  if (start[17] != 0x10000UL)
+  {
+    decoder->bad_table = TRUE;
+    return;
+  }
+
+  jutbits = 16 - table_bits;
+  for (i = 1; i <= (ULONG)table_bits; i++)
+  {
+    start[i] >>= jutbits;
+    weight[i] = 1UL << (table_bits - i);
+  }
+  while (i <= 16)
+  {
+    weight[i] = 1UL << (16 - i);
+    i++;
+  }
+
+  i = start[table_bits + 1] >> jutbits;
+  if (i != 0x10000UL)
+  {
+    k = 1UL << table_bits;
+    while (i != k)
+    {
+      table[i++] = 0;
+    }
+  }
+
+  avail = nchar;
+  mask = 1UL << (15 - table_bits);
+  for (ch = 0; ch < (ULONG)nchar; ch++)
+  {
+    if ((len = bitlen[ch]) == 0)
+    {
+      continue;
+    }
+    nextcode = start[len] + weight[len];
+    if (len <= (ULONG)table_bits)
+    {
+      for (i = start[len]; i < nextcode; i++)
+      {
+        table[i] = (UWORD)ch;
+      }
+    }
+    else
+    {
+      k = start[len];
+      p = &table[k >> jutbits];
+      i = len - table_bits;
+      while (i != 0)
+      {
+        if (*p == 0)
+        {
+          if (avail >= 2 * NC - 1)
+          {
+            decoder->bad_table = TRUE;
+            return;
+          }
+          decoder->right[avail] = decoder->left[avail] = 0;
+          *p = (UWORD)avail++;
+        }
+        if (k & mask)
+        {
+          p = &decoder->right[*p];
+        }
+        else
+        {
+          p = &decoder->left[*p];
+        }
+        k <<= 1;
+        i--;
+      }
+      *p = (UWORD)ch;
+    }
+    start[len] = nextcode;
+  }
+}
+
+static void read_pt_len(struct LhaDecoder *decoder, int nn, int nbit, int i_special)
+{
+  int i, c, n;
+  UWORD bits, mask;
+
+  n = getbits(decoder, nbit);
+  if (n == 0)
+  {
+    c = getbits(decoder, nbit);
+    for (i = 0; i < nn; i++)
+    {
+      decoder->pt_len[i] = 0;
+    }
+    for (i = 0; i < (1 << PT_TABLE_BITS); i++)
+    {
+      decoder->pt_table[i] = (UWORD)c;
+    }
+    return;
+  }
+  if (n > nn)
+  {
+    decoder->bad_table = TRUE;
+    return;
+  }
+
+  i = 0;
+  while (i < n)
+  {
+    bits = peekbits(decoder, BITBUFSIZ);
+    c = bits >> (BITBUFSIZ - 3);
+    if (c == 7)
+    {
+      mask = 1U << (BITBUFSIZ - 1 - 3);
+      while (mask & bits)
+      {
+        mask >>= 1;
+        c++;
+      }
+    }
+    fillbuf(decoder, (c < 7) ? 3 : c - 3);
+    decoder->pt_len[i++] = (UBYTE)c;
+    if (i == i_special)
+    {
+      c = getbits(decoder, 2);
+      while (--c >= 0 && i < nn)
+      {
+        decoder->pt_len[i++] = 0;
+      }
+    }
+  }
+  while (i < nn)
+  {
+    decoder->pt_len[i++] = 0;
+  }
+  make_table(decoder, nn, decoder->pt_len, PT_TABLE_BITS, decoder->pt_table);
+}
+
+static void read_c_len(struct LhaDecoder *decoder)
+{
+  int i, c, n;
+  UWORD bits, mask;
+
+  n = getbits(decoder, CBIT);
+  if (n == 0)
+  {
+    c = getbits(decoder, CBIT);
+    for (i = 0; i < NC; i++)
+    {
+      decoder->c_len[i] = 0;
+    }
+    for (i = 0; i < (1 << C_TABLE_BITS); i++)
+    {
+      decoder->c_table[i] = (UWORD)c;
+    }
+    return;
+  }
+  if (n > NC)
+  {
+    decoder->bad_table = TRUE;
+    return;
+  }
+
+  i = 0;
+  while (i < n)
+  {
+    bits = peekbits(decoder, BITBUFSIZ);
+    c = decoder->pt_table[bits >> (BITBUFSIZ - PT_TABLE_BITS)];
+    if (c >= NT)
+    {
+      mask = 1U << (BITBUFSIZ - 1 - PT_TABLE_BITS);
+      do
+      {
+        c = (bits & mask) ? decoder->right[c] : decoder->left[c];
+        mask >>= 1;
+      } while (c >= NT && mask != 0);
+      if (c >= NT)
+      {
+        decoder->bad_table = TRUE;
+        return;
+      }
+    }
+    fillbuf(decoder, decoder->pt_len[c]);
+    if (c <= 2)
+    {
+      if (c == 0)
+      {
+        c = 1;
+      }
+      else if (c == 1)
+      {
+        c = getbits(decoder, 4) + 3;
+      }
+      else
+      {
+        c = getbits(decoder, CBIT) + 20;
+      }
+      while (--c >= 0 && i < NC)
+      {
+        decoder->c_len[i++] = 0;
+      }
+    }
+    else
+    {
+      decoder->c_len[i++] = (UBYTE)(c - 2);
+    }
+  }
+  while (i < NC)
+  {
+    decoder->c_len[i++] = 0;
+  }
+  make_table(decoder, NC, decoder->c_len, C_TABLE_BITS, decoder->c_table);
+}
+
+static UWORD decode_c(struct LhaDecoder *decoder, int np, int pbit)
+{
+  UWORD bits, j, mask;
+
+  if (decoder->blocksize == 0)
+  {
+    decoder->blocksize = getbits(decoder, 16);
+    read_pt_len(decoder, NT, TBIT, 3);
+    read_c_len(decoder);
+    read_pt_len(decoder, np, pbit, -1);
+  }
+  decoder->blocksize--;
+
+  bits = peekbits(decoder, BITBUFSIZ);
+  j = decoder->c_table[bits >> (BITBUFSIZ - C_TABLE_BITS)];
+  if (j >= NC)
+  {
+    mask = 1U << (BITBUFSIZ - 1 - C_TABLE_BITS);
+    do
+    {
+      j = (bits & mask) ? decoder->right[j] : decoder->left[j];
+      mask >>= 1;
+    } while (j >= NC && mask != 0);
+    if (j >= NC)
+    {
+      decoder->bad_table = TRUE;
+      return 0;
+    }
+  }
+  fillbuf(decoder, decoder->c_len[j]);
+  return j;
+}
+
+static UWORD decode_p(struct LhaDecoder *decoder, int np)
+{
+  UWORD bits, j, mask;
+
+  bits = peekbits(decoder, BITBUFSIZ);
+  j = decoder->pt_table[bits >> (BITBUFSIZ - PT_TABLE_BITS)];
+  if (j >= np)
+  {
+    mask = 1U << (BITBUFSIZ - 1 - PT_TABLE_BITS);
+    do
+    {
+      j = (bits & mask) ? decoder->right[j] : decoder->left[j];
+      mask >>= 1;
+    } while (j >= np && mask != 0);
+    if (j >= np)
+    {
+      decoder->bad_table = TRUE;
+      return 0;
+    }
+  }
+  fillbuf(decoder, decoder->pt_len[j]);
+  if (j != 0)
+  {
+    j = (UWORD)((1U << (j - 1)) + getbits(decoder, j - 1));
+  }
+  return j;
+}
+
+static LONG decode_stored(struct LhaDecoder *decoder, const struct LhaMember *member,
+                          LhaWriteFunc write, APTR write_handle, UWORD *crc)
+{
+  ULONG left = member->original_size;
+  LONG length;
+
+  while (left > 0)
+  {
+    length = left < decoder->window_size ? (LONG)left : (LONG)decoder->window_size;
+    if (decoder->read(decoder->read_handle, decoder->window, length) != length)
+    {
+      return LHA_ERR_READ;
+    }
+    *crc = update_crc(decoder, *crc, decoder->window, length);
+    if (write(write_handle, decoder->window, length) != length)
+    {
+      return LHA_ERR_WRITE;
+    }
+    left -= length;
+  }
+  return LHA_OK;
+}
+
+#ifdef LHA_68020
+
+/*
+ * Copies a match within the window, where neither range wraps.  Nearly
+ * every match is a few bytes, which a call to memcpy() costs more than,
+ * so it is copied forwards a byte at a time, four to a pass.  That also
+ * repeats the pattern of a match overlapping the bytes it produces.
+ */
+static void copy_match(UBYTE *window, ULONG to, ULONG from, ULONG length)
+{
+  UBYTE *destination = window + to;
+  const UBYTE *source = window + from;
+  ULONG count;
+
+  for (count = length & 3; count > 0; count--)
+  {
+    *destination++ = *source++;
+  }
+  for (count = length >> 2; count > 0; count--)
+  {
+    destination[0] = source[0];
+    destination[1] = source[1];
+    destination[2] = source[2];
+    destination[3] = source[3];
+    destination += 4;
+    source += 4;
+  }
+}
+
+#else
+
+/*
+ * Copies a match within the window, where neither range wraps.  A match
+ * may overlap the bytes it produces, repeating a short pattern; copying
+ * from the fixed start lets each piece be twice as long as the last, so
+ * even those are done with memcpy() rather than a byte at a time.  A
+ * source ahead of the destination is the older data of the ring and
+ * copies forwards like memmove().
+ */
+static void copy_match(UBYTE *window, ULONG to, ULONG from, ULONG length)
+{
+  ULONG count;
+
+  if (from >= to)
+  {
+    memmove(window + to, window + from, length);
+  }
+  else if (to - from == 1)
+  {
+    memset(window + to, window[from], length);
+  }
+  else
+  {
+    while (length > 0)
+    {
+      count = to - from < length ? to - from : length;
+      memcpy(window + to, window + from, count);
+      to += count;
+      length -= count;
+    }
+  }
+}
+
+#endif
+
+static void start_huffman(struct LhaDecoder *decoder)
+{
+  decoder->blocksize = 0;
+  decoder->bad_table = FALSE;
+#ifdef LHA_68020
+  decoder->bitpos = 0;
+  fillbuf(decoder, 0);
+#else
+  decoder->bitbuf = 0;
+  decoder->subbitbuf = 0;
+  decoder->bitcount = 0;
+  fillbuf(decoder, BITBUFSIZ);
+#endif
+}
+
+/* Hands the first length bytes of the window to the writer */
+static BOOL flush_window(struct LhaDecoder *decoder, ULONG length, LhaWriteFunc write, APTR write_handle, UWORD *crc)
+{
+  *crc = update_crc(decoder, *crc, decoder->window, length);
+  return write(write_handle, decoder->window, length) == (LONG)length;
+}
+
+/* -lh4- shares the position table of -lh5- */
+#define KERNEL_NAME decode_lh4
+#define KERNEL_DICBIT 12
+#define KERNEL_NP 14
+#define KERNEL_PBIT 4
+#include "LHAKernel.h"
+
+#define KERNEL_NAME decode_lh5
+#define KERNEL_DICBIT 13
+#define KERNEL_NP 14
+#define KERNEL_PBIT 4
+#include "LHAKernel.h"
+
+#define KERNEL_NAME decode_lh6
+#define KERNEL_DICBIT 15
+#define KERNEL_NP 16
+#define KERNEL_PBIT 5
+#include "LHAKernel.h"
+
+#define KERNEL_NAME decode_lh7
+#define KERNEL_DICBIT 16
+#define KERNEL_NP 17
+#define KERNEL_PBIT 5
+#include "LHAKernel.h"
+
+typedef LONG (*DecodeFunc)(struct LhaDecoder *decoder, const struct LhaMember *member,
+                           LhaWriteFunc write, APTR write_handle, UWORD *crc);
+
+static const struct
+{
+  const char *method;
+  DecodeFunc decode;
+  int dicbit; /* Size of the window the method needs, in bits */
+} methods[] =
+{
+  {"-lh5-", decode_lh5, 13}, /* By far the most common in WHDLoad archives */
+  {"-lh6-", decode_lh6, 15},
+  {"-lh7-", decode_lh7, 16},
+  {"-lh4-", decode_lh4, 12},
+  {"-lh0-", decode_stored, MIN_DICBIT},
+  {"-lz4-", decode_stored, MIN_DICBIT}
+};
+
+/* Returns the index of a method in methods[], or -1 if it is not supported */
+static int find_method(const char *method)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(methods) / sizeof(methods[0])); i++)
+  {
+    if (strcmp(method, methods[i].method) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+BOOL lha_method_supported(const char *method)
+{
+  return find_method(method) >= 0 || strcmp(method, "-lhd-") == 0;
+}
+
+LONG lha_decode_member(struct LhaDecoder *decoder, const struct LhaMember *member,
+                       LhaReadFunc read, APTR read_handle, LhaWriteFunc write, APTR write_handle)
+{
+  int method = find_method(member->method);
+  UWORD crc = 0;
+  LONG result;
+
+  if (member->is_directory)
+  {
+    return LHA_OK;
+  }
+  if (method < 0)
+  {
+    return LHA_ERR_METHOD;
+  }
+  if (!reserve_window(decoder, 1UL << methods[method].dicbit))
+  {
+    return LHA_ERR_MEMORY;
+  }
+
+  decoder->read = read;
+  decoder->read_handle = read_handle;
+  decoder->packed_left = member->packed_size;
+  decoder->input_pos = 0;
+  decoder->input_length = 0;
+  decoder->read_failed = FALSE;
+
+  result = methods[method].decode(decoder, member, write, write_handle, &crc);
+  if (result == LHA_OK && crc != member->crc)
+  {
+    result = LHA_ERR_CRC;
+  }
+  return result;
+}
+
+LONG lha_compute_crc(struct LhaDecoder *decoder, LhaReadFunc read, APTR read_handle, ULONG length, UWORD *crc)
+{
+  LONG count;
+
+  *crc = 0;
+  while (length > 0)
+  {
+    count = read(read_handle, decoder->window, length < decoder->window_size ? length : decoder->window_size);
+    if (count <= 0)
+    {
+      return LHA_ERR_READ;
+    }
+    *crc = update_crc(decoder, *crc, decoder->window, count);
+    length -= count;
+  }
+  return LHA_OK;
+}
@@ -0,0 +1,62 @@
+/*
+
+  LHADecode
+
+  Native decoder for the LHA compression methods used by WHDLoad
+  archives: -lh4-, -lh5-, -lh6- and -lh7- (static Huffman LZ77) and the
+  -lh0-/-lz4- store methods.  Input and output go through callbacks so
+  members can be decoded from any source to any destination.
+
+  This program is released under the MIT License.
+*/
+
+#ifndef LHADECODE_H
+#define LHADECODE_H
+
+#include <exec/types.h>
+
+#include "LHAArchive.h"
+
+#define LHA_ERR_READ -4
+#define LHA_ERR_WRITE -5
+#define LHA_ERR_METHOD -6
+#define LHA_ERR_CRC -7
+
+/* Writes length bytes, returns length on success */
+typedef LONG (*LhaWriteFunc)(APTR handle, const UBYTE *data, LONG length);
+
+struct LhaDecoder;
+
+/*
+ * A decoder takes an input buffer and a window as large as the biggest
+ * method it has decoded needs: 8KB for -lh5-, up to 64KB for -lh7-.
+ * Both are taken from fast memory where there is some.
+ */
+struct LhaDecoder *lha_create_decoder(void);
+
+/*
+ * Creates a decoder with an input buffer of about input_size bytes, for
+ * when memory is short; a smaller buffer is taken if that much is not
+ * free.  Returns NULL if out of memory.
+ */
+struct LhaDecoder *lha_create_decoder_sized(ULONG input_size);
+void lha_free_decoder(struct LhaDecoder *decoder);
+BOOL lha_method_supported(const char *method);
+
+/*
+ * Decodes one member.  Reads exactly member->packed_size bytes and writes
+ * member->original_size bytes, then checks the CRC from the header.
+ * Returns LHA_OK or a negative LHA_ERR_ code; LHA_ERR_MEMORY if the
+ * window for the member's method cannot be had.
+ */
+LONG lha_decode_member(struct LhaDecoder *decoder, const struct LhaMember *member,
+                       LhaReadFunc read, APTR read_handle, LhaWriteFunc write, APTR write_handle);
+
+/*
+ * Reads length bytes and returns their LHA CRC-16 in *crc, so existing
+ * data can be compared with a member without decoding it.  Returns
+ * LHA_OK, or LHA_ERR_READ if fewer than length bytes could be read.
+ */
+LONG lha_compute_crc(struct LhaDecoder *decoder, LhaReadFunc read, APTR read_handle, ULONG length, UWORD *crc);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+
+  LHAKernel
+
+  The Huffman decode loop of LHADecode.c, included there once for each
+  method with these defined, so every copy is compiled with a constant
+  window size, mask and position table size:
+
+    KERNEL_NAME    name of the decode function
+    KERNEL_DICBIT  dictionary size in bits
+    KERNEL_NP      number of position codes
+    KERNEL_PBIT    bits used to send the position code lengths
+
+  This file is not compiled on its own.
+
+  This program is released under the MIT License.
+*/
+
+#define KERNEL_WINDOW_SIZE (1UL << KERNEL_DICBIT)
+#define KERNEL_WINDOW_MASK (KERNEL_WINDOW_SIZE - 1)
+
+static LONG KERNEL_NAME(struct LhaDecoder *decoder, const struct LhaMember *member,
+                        LhaWriteFunc write, APTR write_handle, UWORD *crc)
+{
+  ULONG left = member->original_size;
+  ULONG pos = 0, from, length, count;
+  UBYTE *window = decoder->window;
+  UWORD c;
+
+  start_huffman(decoder);
+
+  /* Matches may reach back before the first byte, which LHA treats as spaces */
+  memset(window, ' ', KERNEL_WINDOW_SIZE);
+
+  while (left > 0)
+  {
+    c = decode_c(decoder, KERNEL_NP, KERNEL_PBIT);
+    if (decoder->bad_table || decoder->read_failed)
+    {
+      return decoder->read_failed ? LHA_ERR_READ : LHA_ERR_FORMAT;
+    }
+
+    if (c < 256)
+    {
+      window[pos++] = (UBYTE)c;
+      left--;
+      if (pos == KERNEL_WINDOW_SIZE)
+      {
+        if (!flush_window(decoder, pos, write, write_handle, crc))
+        {
+          return LHA_ERR_WRITE;
+        }
+        pos = 0;
+      }
+    }
+    else
+    {
+      length = c - (256 - THRESHOLD);
+      from = (pos - decode_p(decoder, KERNEL_NP) - 1) & KERNEL_WINDOW_MASK;
+      if (length > left)
+      {
+        length = left;
+      }
+      left -= length;
+      while (length > 0)
+      {
+        /* Copy as much as fits before either end of the ring */
+        count = length;
+        if (count > KERNEL_WINDOW_SIZE - pos)
+        {
+          count = KERNEL_WINDOW_SIZE - pos;
+        }
+        if (count > KERNEL_WINDOW_SIZE - from)
+        {
+          count = KERNEL_WINDOW_SIZE - from;
+        }
+        copy_match(window, pos, from, count);
+        pos += count;
+        from = (from + count) & KERNEL_WINDOW_MASK;
+        length -= count;
+        if (pos == KERNEL_WINDOW_SIZE)
+        {
+          if (!flush_window(decoder, pos, write, write_handle, crc))
+          {
+            return LHA_ERR_WRITE;
+          }
+          pos = 0;
+        }
+      }
+    }
+  }
+
+  if (pos > 0 && !flush_window(decoder, pos, write, write_handle, crc))
+  {
+    return LHA_ERR_WRITE;
+  }
+  return decoder->read_failed ? LHA_ERR_READ : LHA_OK;
+}
+
+#undef KERNEL_WINDOW_SIZE
+#undef KERNEL_WINDOW_MASK
+#undef KERNEL_NAME
+#undef KERNEL_DICBIT
+#undef KERNEL_NP
+#undef KERNEL_PBIT
@@ -0,0 +1,363 @@
+/*
+
+  MemberCache
+
+  Entries live in a hash table chained by method, sizes and CRC, which
+  are all known from the member header, so most members that were never
+  seen cost no extra reading at all.  The index file is read and written
+  in one piece: a header followed by one record per entry, each padded
+  to a long word so records can be used where they lie in memory.
+
+  This program is released under the MIT License.
+*/
+
+#include <dos/dos.h>
+#include <exec/memory.h>
+#include <exec/semaphores.h>
+#include <exec/types.h>
+#include <proto/dos.h>
+#include <proto/exec.h>
+#include <string.h>
+
+#include "MemberCache.h"
+
+#define CACHE_MAGIC 0x57484443 /* "WHDC" */
+#define CACHE_VERSION 1
+#define CACHE_BUCKETS 1024
+#define FNV_PRIME 16777619UL
+
+struct CacheEntry
+{
+  struct CacheEntry *next;
+  ULONG hash;
+  ULONG packed_size;
+  ULONG original_size;
+  UWORD crc;
+  char  method[6];
+  char *path; /* Stored after the structure */
+};
+
+struct CacheHeader
+{
+  ULONG magic;
+  ULONG version;
+  ULONG count;
+};
+
+struct CacheRecord
+{
+  ULONG hash;
+  ULONG packed_size;
+  ULONG original_size;
+  UWORD crc;
+  UWORD path_length; /* The path follows, padded to a long word */
+  char  method[8];
+};
+
+struct MemberCache
+{
+  struct SignalSemaphore lock; /* Workers look up and add entries at the same time */
+  char  index_path[256];
+  struct CacheEntry *buckets[CACHE_BUCKETS];
+  ULONG count;
+  BOOL  changed;
+};
+
+#define RECORD_SIZE(path_length) ((sizeof(struct CacheRecord) + (path_length) + 3) & ~3UL)
+
+static ULONG bucket_of(ULONG original_size, UWORD crc)
+{
+  return (original_size * 31 + crc) % CACHE_BUCKETS;
+}
+
+static BOOL same_member(const struct CacheEntry *entry, const struct LhaMember *member)
+{
+  return entry->crc == member->crc && entry->original_size == member->original_size &&
+         entry->packed_size == member->packed_size && strcmp(entry->method, member->method) == 0;
+}
+
+static struct CacheEntry **find_entry(struct MemberCache *cache, const struct LhaMember *member, ULONG hash)
+{
+  struct CacheEntry **link = &cache->buckets[bucket_of(member->original_size, member->crc)];
+
+  while (*link != NULL && !((*link)->hash == hash && same_member(*link, member)))
+  {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+static struct CacheEntry *new_entry(ULONG hash, ULONG packed_size, ULONG original_size, UWORD crc,
+                                    const char *method, const char *path, ULONG path_length)
+{
+  struct CacheEntry *entry;
+
+  entry = (struct CacheEntry *)AllocVec(sizeof(struct CacheEntry) + path_length + 1, MEMF_ANY);
+  if (entry == NULL)
+  {
+    return NULL;
+  }
+  entry->hash = hash;
+  entry->packed_size = packed_size;
+  entry->original_size = original_size;
+  entry->crc = crc;
+  strncpy(entry->method, method, sizeof(entry->method) - 1);
+  entry->method[sizeof(entry->method) - 1] = '\0';
+  entry->path = (char *)(entry + 1);
+  memcpy(entry->path, path, path_length);
+  entry->path[path_length] = '\0';
+  return entry;
+}
+
+static void load_index(struct MemberCache *cache)
+{
+  struct FileInfoBlock *file_info_block;
+  struct CacheHeader *header;
+  struct CacheRecord *record;
+  struct CacheEntry *entry;
+  UBYTE *data = NULL, *position, *end;
+  BPTR file;
+  LONG size = 0;
+  ULONG i, bucket;
+
+  file = Open((CONST_STRPTR)cache->index_path, MODE_OLDFILE);
+  if (file == 0)
+  {
+    return;
+  }
+  file_info_block = (struct FileInfoBlock *)AllocMem(sizeof(struct FileInfoBlock), MEMF_CLEAR);
+  if (file_info_block != NULL)
+  {
+    if (ExamineFH(file, file_info_block))
+    {
+      size = file_info_block->fib_Size;
+    }
+    FreeMem(file_info_block, sizeof(struct FileInfoBlock));
+  }
+  if (size >= (LONG)sizeof(struct CacheHeader))
+  {
+    data = (UBYTE *)AllocVec(size, MEMF_ANY);
+  }
+  if (data == NULL || Read(file, data, size) != size)
+  {
+    Close(file);
+    if (data != NULL)
+    {
+      FreeVec(data);
+    }
+    return;
+  }
+  Close(file);
+
+  header = (struct CacheHeader *)data;
+  if (header->magic == CACHE_MAGIC && header->version == CACHE_VERSION)
+  {
+    position = data + sizeof(struct CacheHeader);
+    end = data + size;
+    for (i = 0; i < header->count && position + sizeof(struct CacheRecord) <= end; i++)
+    {
+      record = (struct CacheRecord *)position;
+      if (position + RECORD_SIZE(record->path_length) > end)
+      {
+        break; /* Truncated; keep what was read */
+      }
+      record->method[sizeof(record->method) - 1] = '\0';
+      entry = new_entry(record->hash, record->packed_size, record->original_size, record->crc,
+                        record->method, (const char *)(record + 1), record->path_length);
+      if (entry == NULL)
+      {
+        break;
+      }
+      bucket = bucket_of(entry->original_size, entry->crc);
+      entry->next = cache->buckets[bucket];
+      cache->buckets[bucket] = entry;
+      cache->count++;
+      position += RECORD_SIZE(record->path_length);
+    }
+  }
+  FreeVec(data);
+}
+
+struct MemberCache *cache_open(CONST_STRPTR index_path)
+{
+  struct MemberCache *cache;
+
+  cache = (struct MemberCache *)AllocVec(sizeof(struct MemberCache), MEMF_ANY | MEMF_CLEAR);
+  if (cache == NULL)
+  {
+    return NULL;
+  }
+  InitSemaphore(&cache->lock);
+  strncpy(cache->index_path, (const char *)index_path, sizeof(cache->index_path) - 1);
+  load_index(cache);
+  return cache;
+}
+
+static LONG save_index(struct MemberCache *cache)
+{
+  struct CacheHeader *header;
+  struct CacheRecord *record;
+  struct CacheEntry *entry;
+  UBYTE *data, *position;
+  ULONG size = sizeof(struct CacheHeader), path_length, i;
+  BPTR file;
+  LONG result = CACHE_OK;
+
+  for (i = 0; i < CACHE_BUCKETS; i++)
+  {
+    for (entry = cache->buckets[i]; entry != NULL; entry = entry->next)
+    {
+      size += RECORD_SIZE(strlen(entry->path));
+    }
+  }
+  data = (UBYTE *)AllocVec(size, MEMF_ANY | MEMF_CLEAR);
+  if (data == NULL)
+  {
+    return CACHE_ERR_MEMORY;
+  }
+
+  header = (struct CacheHeader *)data;
+  header->magic = CACHE_MAGIC;
+  header->version = CACHE_VERSION;
+  header->count = cache->count;
+  position = data + sizeof(struct CacheHeader);
+  for (i = 0; i < CACHE_BUCKETS; i++)
+  {
+    for (entry = cache->buckets[i]; entry != NULL; entry = entry->next)
+    {
+      path_length = strlen(entry->path);
+      record = (struct CacheRecord *)position;
+      record->hash = entry->hash;
+      record->packed_size = entry->packed_size;
+      record->original_size = entry->original_size;
+      record->crc = entry->crc;
+      record->path_length = (UWORD)path_length;
+      strcpy(record->method, entry->method);
+      memcpy(record + 1, entry->path, path_length);
+      position += RECORD_SIZE(path_length);
+    }
+  }
+
+  file = Open((CONST_STRPTR)cache->index_path, MODE_NEWFILE);
+  if (file == 0 || Write(file, data, size) != (LONG)size)
+  {
+    result = CACHE_ERR_WRITE;
+  }
+  if (file != 0 && !Close(file))
+  {
+    result = CACHE_ERR_WRITE;
+  }
+  FreeVec(data);
+  return result;
+}
+
+LONG cache_close(struct MemberCache *cache)
+{
+  struct CacheEntry *entry, *next;
+  LONG result = CACHE_OK;
+  ULONG i;
+
+  if (cache->changed)
+  {
+    result = save_index(cache);
+  }
+  for (i = 0; i < CACHE_BUCKETS; i++)
+  {
+    for (entry = cache->buckets[i]; entry != NULL; entry = next)
+    {
+      next = entry->next;
+      FreeVec(entry);
+    }
+  }
+  FreeVec(cache);
+  return result;
+}
+
+ULONG cache_hash(ULONG hash, const UBYTE *data, LONG length)
+{
+  while (length-- > 0)
+  {
+    hash = (hash ^ *data++) * FNV_PRIME;
+  }
+  return hash;
+}
+
+BOOL cache_may_contain(struct MemberCache *cache, const struct LhaMember *member)
+{
+  struct CacheEntry *entry;
+  BOOL found = FALSE;
+
+  ObtainSemaphoreShared(&cache->lock);
+  for (entry = cache->buckets[bucket_of(member->original_size, member->crc)]; entry != NULL && !found; entry = entry->next)
+  {
+    found = same_member(entry, member);
+  }
+  ReleaseSemaphore(&cache->lock);
+  return found;
+}
+
+BOOL cache_lookup(struct MemberCache *cache, const struct LhaMember *member, ULONG hash, char *path, ULONG path_size)
+{
+  struct CacheEntry *entry;
+
+  ObtainSemaphoreShared(&cache->lock);
+  entry = *find_entry(cache, member, hash);
+  if (entry != NULL)
+  {
+    strncpy(path, entry->path, path_size - 1);
+    path[path_size - 1] = '\0';
+  }
+  ReleaseSemaphore(&cache->lock);
+  return entry != NULL;
+}
+
+void cache_add(struct MemberCache *cache, const struct LhaMember *member, ULONG hash, const char *path)
+{
+  struct CacheEntry **link, *entry;
+  ULONG path_length = strlen(path);
+
+  if (path_length > 0xFFFF)
+  {
+    return;
+  }
+  entry = new_entry(hash, member->packed_size, member->original_size, member->crc, member->method, path, path_length);
+  if (entry == NULL)
+  {
+    return; /* The member is just not cached */
+  }
+
+  ObtainSemaphore(&cache->lock);
+  link = find_entry(cache, member, hash);
+  if (*link != NULL)
+  {
+    /* Keep the newest copy, the older one is more likely to be replaced or deleted */
+    entry->next = (*link)->next;
+    FreeVec(*link);
+    *link = entry;
+  }
+  else
+  {
+    entry->next = NULL;
+    *link = entry;
+    cache->count++;
+  }
+  cache->changed = TRUE;
+  ReleaseSemaphore(&cache->lock);
+}
+
+void cache_remove(struct MemberCache *cache, const struct LhaMember *member, ULONG hash)
+{
+  struct CacheEntry **link, *entry;
+
+  ObtainSemaphore(&cache->lock);
+  link = find_entry(cache, member, hash);
+  if (*link != NULL)
+  {
+    entry = *link;
+    *link = entry->next;
+    FreeVec(entry);
+    cache->count--;
+    cache->changed = TRUE;
+  }
+  ReleaseSemaphore(&cache->lock);
+}
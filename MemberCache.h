@@ -0,0 +1,57 @@
+/*
+
+  MemberCache
+
+  Remembers where the decoded data of LHA members already lives, keyed
+  by a hash of each member's compressed data together with its method,
+  sizes and CRC.  The same data file often appears, packed identically,
+  in many archives and in every revision of a WHDLoad set; with the
+  cache such a member is copied from the earlier file instead of being
+  decoded again.  The cache is kept in an index file between runs.
+
+  This program is released under the MIT License.
+*/
+
+#ifndef MEMBERCACHE_H
+#define MEMBERCACHE_H
+
+#include <exec/types.h>
+
+#include "LHAArchive.h"
+
+#define CACHE_OK 0
+#define CACHE_ERR_MEMORY -1
+#define CACHE_ERR_WRITE -2
+
+#define CACHE_HASH_INIT 2166136261UL /* FNV-1a offset basis */
+
+struct MemberCache;
+
+/*
+ * Loads the index, or starts an empty cache if it does not exist or is
+ * not a valid index.  Returns NULL if out of memory.
+ */
+struct MemberCache *cache_open(CONST_STRPTR index_path);
+
+/* Writes the index back if anything changed, then frees the cache */
+LONG cache_close(struct MemberCache *cache);
+
+/* Adds compressed data to a hash started with CACHE_HASH_INIT */
+ULONG cache_hash(ULONG hash, const UBYTE *data, LONG length);
+
+/*
+ * Whether any entry matches the member's method, sizes and CRC, so that
+ * hashing its compressed data is worth the extra read.
+ */
+BOOL cache_may_contain(struct MemberCache *cache, const struct LhaMember *member);
+
+/* Copies the path of a matching entry to path and returns TRUE, if there is one */
+BOOL cache_lookup(struct MemberCache *cache, const struct LhaMember *member, ULONG hash, char *path, ULONG path_size);
+
+/* Records, or moves, where the member's data now lives; path must be absolute */
+void cache_add(struct MemberCache *cache, const struct LhaMember *member, ULONG hash, const char *path);
+
+/* Forgets an entry whose file turned out to be missing or changed */
+void cache_remove(struct MemberCache *cache, const struct LhaMember *member, ULONG hash);
+
+#endif
@@ -0,0 +1,45 @@
+/*
+
+  OutputSink
+
+  The interface extracted members are written through when they go into
+  a single output, such as a hardfile image or a tar stream, instead of
+  a folder.  Members arrive one at a time and in order: begin_file(),
+  any number of write_file() calls, then end_file().
+
+  This program is released under the MIT License.
+*/
+
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+#include <exec/types.h>
+
+#define SINK_OK 0
+#define SINK_ERR_OPEN -1
+#define SINK_ERR_MEMORY -2
+#define SINK_ERR_FULL -3
+#define SINK_ERR_WRITE -4
+#define SINK_ERR_NAME -5   /* Not a valid name for this output */
+#define SINK_ERR_EXISTS -6 /* A file would replace a directory, or the other way round */
+
+/*
+ * All functions return SINK_OK or a SINK_ERR_ code, except write_file(),
+ * which has the LhaWriteFunc signature so members can be decoded
+ * straight into the sink.  Paths are relative and '/' separated.
+ * timestamp is in seconds since 1978 and protection holds the Amiga
+ * protection bits.  end_file() returns the first error that occurred
+ * while writing the file; with keep FALSE the file is dropped if the
+ * sink can still do so.
+ */
+struct OutputSink
+{
+  APTR handle;
+  LONG (*make_directory)(APTR handle, const char *path);
+  LONG (*begin_file)(APTR handle, const char *path, ULONG size, ULONG timestamp, ULONG protection, const char *comment);
+  LONG (*write_file)(APTR handle, const UBYTE *data, LONG length);
+  LONG (*end_file)(APTR handle, BOOL keep);
+  LONG (*close)(APTR handle);
+};
+
+#endif
@@ -0,0 +1,431 @@
+/*
+
+  TARStream
+
+  Each entry is a 512 byte ustar header followed by the data, padded to
+  a whole block.  Entries whose path does not fit the ustar name field,
+  or that carry protection bits or a comment, are preceded by a pax
+  extended header.  Output is collected in a buffer and written in large
+  pieces, which suits pipes.
+
+  This program is released under the MIT License.
+*/
+
+#include <dos/dos.h>
+#include <exec/memory.h>
+#include <exec/types.h>
+#include <proto/dos.h>
+#include <proto/exec.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "TARStream.h"
+
+#define TAR_BLOCK 512
+#define TAR_BUFFER_SIZE 16384
+#define TAR_NAME_SIZE 100
+#define MAX_PATH 512
+#define MAX_RECORDS 2048
+#define UNIX_EPOCH_OFFSET 252460800UL /* Seconds from 1970 to 1978 */
+
+/* ustar header fields */
+#define TAR_NAME 0
+#define TAR_MODE 100
+#define TAR_UID 108
+#define TAR_GID 116
+#define TAR_SIZE 124
+#define TAR_MTIME 136
+#define TAR_CHECKSUM 148
+#define TAR_TYPEFLAG 156
+#define TAR_MAGIC 257
+#define TAR_VERSION 263
+
+struct TarStream
+{
+  BPTR  file;
+  BOOL  close_file;
+  LONG  write_error;
+  UBYTE *buffer;
+  ULONG buffer_used;
+  char  last_directory[MAX_PATH];
+
+  /* The file being written */
+  BOOL  file_open;
+  LONG  file_error;
+  ULONG file_size;
+  ULONG file_written;
+
+  UBYTE header[TAR_BLOCK];
+  char  records[MAX_RECORDS];
+};
+
+static BOOL flush_buffer(struct TarStream *stream)
+{
+  if (stream->buffer_used > 0 && Write(stream->file, stream->buffer, stream->buffer_used) != (LONG)stream->buffer_used)
+  {
+    stream->write_error = IoErr() == ERROR_DISK_FULL ? SINK_ERR_FULL : SINK_ERR_WRITE;
+    return FALSE;
+  }
+  stream->buffer_used = 0;
+  return TRUE;
+}
+
+/* Appends data to the stream; NULL appends zeros */
+static BOOL put_bytes(struct TarStream *stream, const UBYTE *data, ULONG length)
+{
+  ULONG count;
+
+  while (length > 0)
+  {
+    if (stream->buffer_used == TAR_BUFFER_SIZE && !flush_buffer(stream))
+    {
+      return FALSE;
+    }
+    count = TAR_BUFFER_SIZE - stream->buffer_used;
+    if (count > length)
+    {
+      count = length;
+    }
+    if (data != NULL)
+    {
+      memcpy(stream->buffer + stream->buffer_used, data, count);
+      data += count;
+    }
+    else
+    {
+      memset(stream->buffer + stream->buffer_used, 0, count);
+    }
+    stream->buffer_used += count;
+    length -= count;
+  }
+  return TRUE;
+}
+
+static BOOL pad_to_block(struct TarStream *stream, ULONG length)
+{
+  ULONG remainder = length % TAR_BLOCK;
+
+  return remainder == 0 || put_bytes(stream, NULL, TAR_BLOCK - remainder);
+}
+
+struct TarStream *tar_create_stream(BPTR file, BOOL close_file, LONG *error)
+{
+  struct TarStream *stream;
+
+  stream = (struct TarStream *)AllocVec(sizeof(struct TarStream), MEMF_ANY | MEMF_CLEAR);
+  if (stream != NULL)
+  {
+    stream->buffer = (UBYTE *)AllocVec(TAR_BUFFER_SIZE, MEMF_ANY);
+  }
+  if (stream == NULL || stream->buffer == NULL)
+  {
+    if (stream != NULL)
+    {
+      FreeVec(stream);
+    }
+    *error = SINK_ERR_MEMORY;
+    return NULL;
+  }
+  stream->file = file;
+  stream->close_file = close_file;
+  *error = SINK_OK;
+  return stream;
+}
+
+/* pax records are UTF-8; Amiga names are Latin-1 */
+static void latin1_to_utf8(char *output, const char *input, ULONG size)
+{
+  ULONG length = 0;
+  UBYTE c;
+
+  while ((c = (UBYTE)*input++) != '\0' && length + 3 <= size)
+  {
+    if (c < 0x80)
+    {
+      output[length++] = (char)c;
+    }
+    else
+    {
+      output[length++] = (char)(0xC0 | (c >> 6));
+      output[length++] = (char)(0x80 | (c & 0x3F));
+    }
+  }
+  output[length] = '\0';
+}
+
+/* Adds "<length> key=value\n", where length counts the whole record */
+static ULONG add_record(char *records, ULONG used, const char *key, const char *value)
+{
+  ULONG body = strlen(key) + strlen(value) + 3;
+  ULONG length = body + 1, digits;
+  char number[12];
+
+  for (;;)
+  {
+    digits = sprintf(number, "%lu", length);
+    if (body + digits == length)
+    {
+      break;
+    }
+    length = body + digits;
+  }
+  if (used + length >= MAX_RECORDS)
+  {
+    return used;
+  }
+  sprintf(records + used, "%lu %s=%s\n", length, key, value);
+  return used + length;
+}
+
+static BOOL needs_utf8(const char *text)
+{
+  while (*text != '\0')
+  {
+    if ((UBYTE)*text++ >= 0x80)
+    {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static BOOL write_header(struct TarStream *stream, const char *name, ULONG size, ULONG mtime, ULONG mode, char typeflag)
+{
+  UBYTE *header = stream->header;
+  ULONG checksum = 0;
+  int i;
+
+  memset(header, 0, TAR_BLOCK);
+  strncpy((char *)header + TAR_NAME, name, TAR_NAME_SIZE);
+  sprintf((char *)header + TAR_MODE, "%07lo", mode);
+  sprintf((char *)header + TAR_UID, "%07lo", 0UL);
+  sprintf((char *)header + TAR_GID, "%07lo", 0UL);
+  sprintf((char *)header + TAR_SIZE, "%011lo", size);
+  sprintf((char *)header + TAR_MTIME, "%011lo", mtime);
+  header[TAR_TYPEFLAG] = (UBYTE)typeflag;
+  memcpy(header + TAR_MAGIC, "ustar", 6);
+  memcpy(header + TAR_VERSION, "00", 2);
+
+  /* The checksum is taken with its own field filled with spaces */
+  memset(header + TAR_CHECKSUM, ' ', 8);
+  for (i = 0; i < TAR_BLOCK; i++)
+  {
+    checksum += header[i];
+  }
+  sprintf((char *)header + TAR_CHECKSUM, "%06lo", checksum);
+  header[TAR_CHECKSUM + 7] = ' ';
+
+  return put_bytes(stream, header, TAR_BLOCK);
+}
+
+/* Protection bits 0-3 are set to deny, so they map to cleared mode bits */
+static ULONG unix_mode(ULONG protection, BOOL is_directory)
+{
+  ULONG mode = 0;
+
+  if (is_directory)
+  {
+    return 0755;
+  }
+  if ((protection & FIBF_READ) == 0)
+  {
+    mode |= 0444;
+  }
+  if ((protection & FIBF_WRITE) == 0)
+  {
+    mode |= 0200;
+  }
+  if ((protection & FIBF_EXECUTE) == 0)
+  {
+    mode |= 0111;
+  }
+  return mode;
+}
+
+static LONG write_entry(struct TarStream *stream, const char *path, ULONG size, ULONG timestamp, ULONG protection, const char *comment, char typeflag)
+{
+  char value[MAX_PATH * 2];
+  ULONG used = 0;
+  ULONG mtime = timestamp + UNIX_EPOCH_OFFSET;
+
+  if (strlen(path) > TAR_NAME_SIZE || needs_utf8(path))
+  {
+    latin1_to_utf8(value, path, sizeof(value));
+    used = add_record(stream->records, used, "path", value);
+  }
+  if (protection != 0)
+  {
+    sprintf(value, "%08lx", protection);
+    used = add_record(stream->records, used, "AMIGA.protection", value);
+  }
+  if (comment != NULL && comment[0] != '\0')
+  {
+    latin1_to_utf8(value, comment, sizeof(value));
+    used = add_record(stream->records, used, "AMIGA.comment", value);
+  }
+
+  if (used > 0 &&
+      (!write_header(stream, "PaxHeader", used, mtime, 0644, 'x') ||
+       !put_bytes(stream, (const UBYTE *)stream->records, used) ||
+       !pad_to_block(stream, used)))
+  {
+    return stream->write_error;
+  }
+  if (!write_header(stream, path, size, mtime, unix_mode(protection, typeflag == '5'), typeflag))
+  {
+    return stream->write_error;
+  }
+  return SINK_OK;
+}
+
+/*
+ * Writes an entry for each directory along the path that the previous
+ * call did not already write.
+ */
+LONG tar_make_directory(APTR handle, const char *path)
+{
+  struct TarStream *stream = (struct TarStream *)handle;
+  struct DateStamp now;
+  char directory[MAX_PATH];
+  ULONG length, i, timestamp;
+  LONG result;
+
+  /* Entries are relative to the archive's root, as in tar_begin_file() */
+  while (*path == '/')
+  {
+    path++;
+  }
+  length = strlen(path);
+  while (length > 0 && path[length - 1] == '/')
+  {
+    length--;
+  }
+  if (length == 0 || length + 2 > sizeof(directory))
+  {
+    return length == 0 ? SINK_OK : SINK_ERR_NAME;
+  }
+  if (stream->write_error != SINK_OK)
+  {
+    return stream->write_error;
+  }
+
+  DateStamp(&now);
+  timestamp = now.ds_Days * 86400 + now.ds_Minute * 60 + now.ds_Tick / TICKS_PER_SECOND;
+
+  for (i = 1; i <= length; i++)
+  {
+    if (i < length && path[i] != '/')
+    {
+      continue;
+    }
+    if (strncmp(stream->last_directory, path, i) == 0 &&
+        (stream->last_directory[i] == '\0' || stream->last_directory[i] == '/'))
+    {
+      continue;
+    }
+    memcpy(directory, path, i);
+    directory[i] = '/';
+    directory[i + 1] = '\0';
+    result = write_entry(stream, directory, 0, timestamp, 0, NULL, '5');
+    if (result != SINK_OK)
+    {
+      return result;
+    }
+  }
+  memcpy(stream->last_directory, path, length);
+  stream->last_directory[length] = '\0';
+  return SINK_OK;
+}
+
+LONG tar_begin_file(APTR handle, const char *path, ULONG size, ULONG timestamp, ULONG protection, const char *comment)
+{
+  struct TarStream *stream = (struct TarStream *)handle;
+
+  while (*path == '/')
+  {
+    path++;
+  }
+  stream->file_open = TRUE;
+  stream->file_size = size;
+  stream->file_written = 0;
+  stream->file_error = stream->write_error;
+  if (stream->file_error == SINK_OK)
+  {
+    stream->file_error = strlen(path) < MAX_PATH ? write_entry(stream, path, size, timestamp, protection, comment, '0') : SINK_ERR_NAME;
+  }
+  if (stream->file_error != SINK_OK)
+  {
+    /* No header, so no data may follow */
+    stream->file_open = FALSE;
+  }
+  return stream->file_error;
+}
+
+LONG tar_write_file(APTR handle, const UBYTE *data, LONG length)
+{
+  struct TarStream *stream = (struct TarStream *)handle;
+  ULONG count = length;
+
+  if (!stream->file_open || stream->file_error != SINK_OK)
+  {
+    return -1;
+  }
+
+  /* The size is already in the header, so nothing past it can be written */
+  if (count > stream->file_size - stream->file_written)
+  {
+    count = stream->file_size - stream->file_written;
+    stream->file_error = SINK_ERR_WRITE;
+  }
+  if (!put_bytes(stream, data, count))
+  {
+    stream->file_error = stream->write_error;
+  }
+  stream->file_written += count;
+  return stream->file_error == SINK_OK ? length : -1;
+}
+
+LONG tar_end_file(APTR handle, BOOL keep)
+{
+  struct TarStream *stream = (struct TarStream *)handle;
+
+  if (!stream->file_open)
+  {
+    return stream->file_error;
+  }
+  stream->file_open = FALSE;
+
+  /* Make up what is missing so the entries that follow stay in place */
+  if (!put_bytes(stream, NULL, stream->file_size - stream->file_written) ||
+      !pad_to_block(stream, stream->file_size))
+  {
+    if (stream->file_error == SINK_OK)
+    {
+      stream->file_error = stream->write_error;
+    }
+  }
+  return stream->file_error;
+}
+
+LONG tar_close_stream(APTR handle)
+{
+  struct TarStream *stream = (struct TarStream *)handle;
+  LONG result;
+
+  tar_end_file(stream, FALSE);
+
+  /* Two empty blocks end the archive */
+  if (stream->write_error == SINK_OK && put_bytes(stream, NULL, TAR_BLOCK * 2))
+  {
+    flush_buffer(stream);
+  }
+  result = stream->write_error;
+
+  if (stream->close_file && !Close(stream->file) && result == SINK_OK)
+  {
+    result = SINK_ERR_WRITE;
+  }
+  FreeVec(stream->buffer);
+  FreeVec(stream);
+  return result;
+}
@@ -0,0 +1,45 @@
+/*
+
+  TARStream
+
+  Writes extracted members as a POSIX (pax) tar stream to a file or a
+  pipe, so a collection can be shipped to another host without first
+  being written out as thousands of files.  The stream is written
+  strictly in order and never seeks.  Amiga protection bits and file
+  comments are kept in pax extended headers as AMIGA.protection and
+  AMIGA.comment; dates go in the usual modification time.
+
+  This program is released under the MIT License.
+*/
+
+#ifndef TARSTREAM_H
+#define TARSTREAM_H
+
+#include <dos/dos.h>
+#include <exec/types.h>
+
+#include "OutputSink.h"
+
+struct TarStream;
+
+/*
+ * Starts a stream on an open file.  If close_file is TRUE the file is
+ * closed by tar_close_stream().  Returns NULL with the SINK_ERR_ reason
+ * in *error.
+ */
+struct TarStream *tar_create_stream(BPTR file, BOOL close_file, LONG *error);
+
+/*
+ * The OutputSink functions.  The header of a file is written by
+ * tar_begin_file() with the size given there, so a file cannot be taken
+ * back: one that is not kept stays in the stream, padded with zeros.
+ */
+LONG tar_make_directory(APTR stream, const char *path);
+LONG tar_begin_file(APTR stream, const char *path, ULONG size, ULONG timestamp, ULONG protection, const char *comment);
+LONG tar_write_file(APTR stream, const UBYTE *data, LONG length);
+LONG tar_end_file(APTR stream, BOOL keep);
+
+/* Writes the end of archive marker and, if it owns it, closes the file */
+LONG tar_close_stream(APTR stream);
+
+#endif
@@ -32,254 +32,56 @@
   This program is released under the MIT License.
 */
 
-#include <ctype.h>
 #include <dos/dos.h>
-#include <exec/memory.h>
 #include <exec/types.h>
 #include <proto/dos.h>
 #include <proto/exec.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-
-#define bool int
-#define true 1
-#define false 0
-#define MAX_ERRORS 40
-#define MAX_ERROR_LENGTH 256
-#define DEBUG 1
-#define BUFFER_SIZE 1024
-
-bool skip_disk_space_check = false, test_archives_only = false;
-char *input_file_path;
-char *output_file_path;
-char single_error_message[MAX_ERROR_LENGTH];
-char error_messages_array[MAX_ERRORS][MAX_ERROR_LENGTH];
-char version_number[] = "1.1.0";
-int  num_archives_found;
-int  error_count = 0;
-int  num_directories_scanned;
-int  should_stop_app = 0; /* used to stop the app if the lha extraction fails */
-long start_time;
-int  resetProtectionBits = 1;
-
-STRPTR input_directory_path;
-STRPTR output_directory_path;
-
-/* Function prototypes */
-char *get_file_path(const char *full_path);
-char *remove_text(char *input_str, STRPTR text_to_remove);
-int   check_disk_space(STRPTR path, int min_space_mb);
-int   does_file_exist(char *filename);
-int   does_folder_exists(const char *folder_name);
-int   ends_with_lha(const char *filename);
-void  sanitizeAmigaPath(char *path);
-void  get_directory_contents(STRPTR input_directory_path, STRPTR output_directory_path);
-void  logError(const char *errorMessage);
-void  printErrors(void);
-void  remove_trailing_slash(char *str);
-char *findFirstDirectory(char *filePath);
-char *get_file_extension(const char *filename, char *outputBuffer);
-
-int num_lzx_archives_found = 0;
-int num_lha_archives_found = 0;
-
-/*
- * Function to sanitize an Amiga file path in-place by correcting specific path issues.
- * It ensures no slashes immediately follow a colon, replaces "//" with "/", and removes consecutive colons.
- * Assumes the input buffer is large enough for the sanitized path.
- */
-void sanitizeAmigaPath(char *path)
-{
-  ULONG len;
-  char *sanitizedPath;
-  int i, j;
-
-  if (path == NULL)
-  {
-    return;
-  }
-
-  len = strlen(path) + 1; /* Include null terminator*/
-  sanitizedPath = (char *)AllocVec(len, MEMF_ANY | MEMF_CLEAR);
-  if (sanitizedPath == NULL)
-  {
-    /* Memory allocation failed */
-    return;
-  }
-
-  i = 0;
-  j = 0;
-  while (path[i] != '\0')
-  {
-    if (path[i] == ':')
-    {
-      /* Copy the colon */
-      sanitizedPath[j++] = path[i++];
-      /* Skip all following slashes */
-      while (path[i] == '/')
-      {
-        i++;
-      }
-    }
-    else if (path[i] == '/' && path[i + 1] == '/')
-    {
-      /* Skip redundant slashes */
-      i++;
-    }
-    else
-    {
-      /* Copy other characters */
-      sanitizedPath[j++] = path[i++];
-    }
-  }
-
-  sanitizedPath[j] = '\0'; /* Ensure the result is null-terminated */
-
-  /* Copy back to the original path and free the allocated memory */
-  strcpy(path, sanitizedPath);
-  FreeVec(sanitizedPath);
-}
 
-char *remove_text(char *input_str, STRPTR text_to_remove)
-{
-  int remove_len = strlen(text_to_remove);
+#include "HDFImage.h"
+#include "WHDExtract.h"
 
-  /* Check if the second string exists at the start of the first string */
-  if (strncmp(input_str, text_to_remove, remove_len) == 0)
-  {
-    /* If the second string is found, return a pointer to the rest of the
-     * first string*/
-    return input_str + remove_len;
-  }
+char version_number[] = "1.1.0";
 
-  /*If the second string is not found, return the original first string*/
-  return input_str;
-}
+/* Console window used for messages while a tar stream goes to standard output */
+static BPTR console = 0;
 
-int ends_with_lha(const char *filename)
-{
-  size_t len = strlen(filename);
-  return len > 4 && strcmp(filename + len - 4, ".lha") == 0;
-}
+void printErrors(struct WhdContext *context, const struct WhdStats *stats);
+static void close_console(void);
 
-/*
- * Extracts the file extension from a given filename and converts it to uppercase.
- * Assumes the extension is exactly 4 characters long, including the dot.
- *
- * Parameters:
- *     filename - the name of the file from which to extract the extension.
- *     outputBuffer - a buffer to hold the uppercase extension, must be at least 5 characters long.
- *
- * Returns:
- *     A pointer to the outputBuffer containing the uppercase extension, or NULL if the operation fails.
- */
-char *get_file_extension(const char *filename, char *outputBuffer)
+static void close_console(void)
 {
-  const char *extensionStart;
-  int i;
-  size_t len = strlen(filename);
-
-  if (len < 4 || outputBuffer == NULL)
-  {
-    return NULL; /* Return NULL if the string is too short or outputBuffer is NULL */
-  }
-
-  extensionStart = filename + len - 4;
-  for (i = 0; i < 4; i++)
+  if (console != 0)
   {
-    outputBuffer[i] = toupper((unsigned char)extensionStart[i]);
+    Close(console);
+    console = 0;
   }
-  outputBuffer[4] = '\0';
-
-  return outputBuffer;
 }
 
-char *get_file_path(const char *full_path)
+void printErrors(struct WhdContext *context, const struct WhdStats *stats)
 {
-  char *file_path = NULL;
-
-  /* Find the last occurrence of the path separator character */
-  const char *last_slash = strrchr(full_path, '/');
-  const char *last_back_slash = strrchr(full_path, '\\');
-  const char *last_path_separator = last_slash > last_back_slash ? last_slash : last_back_slash;
+  const struct WhdEvent *event;
+  int i = 0;
 
-  if (last_path_separator != NULL)
+  if (stats->error_count > 0)
   {
-    /* Calculate the length of the file path */
-    size_t file_path_length = last_path_separator - full_path + 1;
-
-    /* Allocate memory for the file path string */
-    file_path = malloc(file_path_length + 1);
-
-    if (file_path != NULL)
+    printf("\n\x1B[1mErrors encountered during execution:\x1B[0m\n");
+    for (event = whd_first_error(context); event != NULL; event = event->next)
     {
-      /* Copy the file path string to the newly allocated memory */
-      strncpy(file_path, full_path, file_path_length);
-      file_path[file_path_length] = '\0';
+      printf("\x1B[1mError:\x1B[0m %d: %s%s%s%s %s\n", ++i, event->archive,
+             event->member != NULL ? " (" : "", event->member != NULL ? event->member : "",
+             event->member != NULL ? ")" : "", event->message);
     }
-  }
-
-  return file_path;
-}
-
-int does_file_exist(char *filename)
-{
-  FILE *file;
-  /* Try to open the file for reading*/
-  if ((file = fopen(filename, "r")))
-  {
-    /* If successful, close the file and return 1*/
-    fclose(file);
-    return 1;
-  }
-  else
-  {
-    /* If not successful, return 0*/
-    return 0;
-  }
-}
-
-int does_folder_exists(const char *folder_name)
-{
-  BPTR lock = Lock((CONST_STRPTR)folder_name, ACCESS_READ);
-  if (lock != 0)
-  {
-    UnLock(lock);
-    return 1; /* Folder exists*/
-  }
-  else
-  {
-    return 0; /* Folder does not exist */
-  }
-}
-
-void remove_trailing_slash(char *str)
-{
-  if (str != NULL && strlen(str) > 0 && str[strlen(str) - 1] == '/')
-  {
-    str[strlen(str) - 1] = '\0';
-  }
-}
-
-void logError(const char *errorMessage)
-{
-  strncpy(error_messages_array[error_count], errorMessage, MAX_ERROR_LENGTH);
-  error_messages_array[error_count][MAX_ERROR_LENGTH - 1] = '\0'; /* Ensure null-termination */
-  error_count++;
-}
-
-void printErrors()
-{
-  int i;
-  if (error_count > 0)
-  {
-    printf("\n\x1B[1mErrors encountered during execution:\x1B[0m\n");
-    for (i = 0; i < error_count; i++)
+    if (i < stats->error_count)
     {
-      printf("\x1B[1mError:\x1B[0m %d: %s\n", i + 1, error_messages_array[i]);
+      printf("%ld further errors could not be recorded (out of memory).\n", stats->error_count - i);
     }
+    printf("\x1B[1m%ld\x1B[0m corrupt, \x1B[1m%ld\x1B[0m I/O, \x1B[1m%ld\x1B[0m missing tool, "
+           "\x1B[1m%ld\x1B[0m out of space, \x1B[1m%ld\x1B[0m other.\n",
+           stats->event_counts[WHD_ERROR_CORRUPT], stats->event_counts[WHD_ERROR_IO], stats->event_counts[WHD_ERROR_MISSING_TOOL],
+           stats->event_counts[WHD_ERROR_SPACE], stats->event_counts[WHD_ERROR_MEMORY] + stats->event_counts[WHD_ERROR_UNKNOWN]);
   }
   else
   {
@@ -287,302 +89,48 @@ void printErrors()
   }
 }
 
-char *findFirstDirectory(char *filePath)
+int main(int argc, char *argv[])
 {
-  static char directoryName[256]; /* Static buffer to hold the directory name */
-  FILE *file;
-  char line[256]; /* Buffer to read each line into */
+  struct WhdOptions options;
+  struct WhdContext *context;
+  struct WhdStats stats;
+  ULONG tools;
+  LONG result;
+  int i;
+  struct DateStamp start_time, end_time;
+  long elapsed_ticks, hours, minutes, seconds, hundredths;
 
-  if (does_file_exist(filePath) == 0)
-  {
-    printf("File does not exist: %s\n", filePath);
-    return NULL; /* Return NULL if file can't be opened */
-  }
+  /* Black text:  printf("\x1B[30m 30:\x1B[0m \n"); */
+  /* White text:  printf("\x1B[31m 31:\x1B[0m \n"); */
+  /* Blue text:   printf("\x1B[32m 32:\x1B[0m \n"); */
+  /* Grey text:   printf("\x1B[33m 33:\x1B[0m \n"); */
 
-  /* Open the file for reading */
-  if ((file = fopen(filePath, "r")) == NULL)
+  whd_default_options(&options);
+  options.show_progress = TRUE;
+  if (argc > 1 && strcmp(argv[1], "-") == 0)
   {
-    return NULL; /* Return NULL if file can't be opened */
+    options.native = TRUE; /* Only the built-in decoder can read standard input */
   }
-
-  while (fgets(line, sizeof(line), file) != NULL)
-  {                                          /* Read each line */
-    char *slashPosition = strchr(line, '/'); /* Find the first '/' */
-    if (slashPosition != NULL)
+  for (i = 3; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-native") == 0 || strncmp(argv[i], "-hdf=", 5) == 0 || strcmp(argv[i], "-tar") == 0 ||
+        strcmp(argv[i], "-lowmemory") == 0)
     {
-      /* Calculate the directory name length */
-      int dirLength = slashPosition - line;
-      /* Copy the directory name to the static buffer */
-      strncpy(directoryName, line, dirLength);
-      directoryName[dirLength] = '\0'; /* Null-terminate the string */
-      fclose(file);                    /* Close the file */
-      return directoryName;            /* Return the directory name */
+      options.native = TRUE; /* Images and tar files are always written by the built-in decoder */
     }
-  }
-
-  fclose(file); /* Close the file if no directory is found */
-  return NULL;  /* Return NULL if no directory is found */
-}
-
-void get_directory_contents(STRPTR input_directory_path, STRPTR output_directory_path)
-{
-  BPTR dir_lock;
-  char file_extension[5];
-  char current_file_path[256];
-  char ExtractCommand[20];
-  char extraction_command[256];
-  char *directoryName;
-  char program_name[6];
-  char fileCommandStore[256];
-  LONG command_result;
-
-  struct FileInfoBlock *file_info_block;
-  resetProtectionBits = 1;
-
-  printf("Scanning directory: %s\n", input_directory_path);
-
-  dir_lock = Lock((CONST_STRPTR)input_directory_path, ACCESS_READ);
-  if (dir_lock)
-  {
-    file_info_block = (struct FileInfoBlock *)AllocMem(sizeof(struct FileInfoBlock), MEMF_CLEAR);
-    if (file_info_block)
+    if (strcmp(argv[i], "-tar") == 0 && strcmp(argv[2], "-") == 0)
     {
-      if (Examine(dir_lock, file_info_block))
+      /* The tar stream has standard output to itself, so talk to the console window */
+      console = Open((CONST_STRPTR)"*", MODE_NEWFILE);
+      if (console == 0 || freopen("*", "w", stdout) == NULL)
       {
-        while (ExNext(dir_lock, file_info_block) && should_stop_app == 0)
-        {
-          if (strcmp(file_info_block->fib_FileName, ".") != 0 && strcmp(file_info_block->fib_FileName, "..") != 0)
-          {
-            strcpy(current_file_path, input_directory_path);
-            strcat(current_file_path, "/");
-            strcat(current_file_path, file_info_block->fib_FileName);
-            sanitizeAmigaPath(current_file_path);
-
-            if (file_info_block->fib_DirEntryType > 0)
-            {
-              num_directories_scanned++;
-
-              get_directory_contents(current_file_path, output_directory_path);
-            }
-            else
-            {
-              get_file_extension(file_info_block->fib_FileName, file_extension);
-
-              if (strcmp(file_extension, ".LHA") == 0 || strcmp(file_extension, ".LZX") == 0)
-              {
-                sprintf(fileCommandStore, "%s/%s", output_directory_path, get_file_path(remove_text(current_file_path, input_file_path)));
-                sanitizeAmigaPath(fileCommandStore);
-                printf("Extracting \x1B[1m%s\x1B[0m to \x1B[1m%s\x1B[0m\n", file_info_block->fib_FileName, fileCommandStore);
-                if (strcmp(file_extension, ".LHA") == 0)
-                {
-                  num_lha_archives_found++;
-                  strcpy(program_name, "lha");
-                  if (test_archives_only)
-                  {
-                    strcpy(ExtractCommand, "t\0");
-                  }
-                  else
-                  {
-                    strcpy(ExtractCommand, "-T -M -N -m x\0");
-
-                    if (resetProtectionBits == 1)
-                    {
-
-                      sprintf(extraction_command, "lha vq \"%s\" >ram:listing.txt", current_file_path);
-                      sanitizeAmigaPath(extraction_command);
-                      SystemTagList(extraction_command, NULL);
-                      directoryName = findFirstDirectory("ram:listing.txt");
-                      if (directoryName != NULL)
-                      {
-                        sprintf(fileCommandStore, "%s/%s/%s", output_directory_path, get_file_path(remove_text(current_file_path, input_file_path)), directoryName);
-                        sanitizeAmigaPath(fileCommandStore);
-                        if (does_folder_exists(fileCommandStore) == 1)
-                        {
-                          sprintf(fileCommandStore, "protect %s/%s/%s/#? ALL rwed >NIL:", output_directory_path, get_file_path(remove_text(current_file_path, input_file_path)), directoryName);
-                          sanitizeAmigaPath(fileCommandStore);
-                          printf("Prepping any protected files for potential replacement...\n");
-                          SystemTagList(fileCommandStore, NULL);
-                        }
-                      }
-                      else
-                      {
-                        printf("Unable to get the file path from the LHA output for file %s.\n", current_file_path);
-                      }
-                    }
-                    DeleteFile("ram:listing.txt");
-                    ExtractCommand[0] = '\0';
-                    strcpy(ExtractCommand, "-T -M -N -m x\0");
-                  }
-                }
-                else
-                {
-                  num_lzx_archives_found++;
-                  strcpy(program_name, "unlzx");
-                  if (test_archives_only)
-                  {
-                    strcpy(ExtractCommand, "-v\0");
-                  }
-                  else
-                  {
-                    strcpy(ExtractCommand, "-x\0");
-                  }
-                }
-
-                
-                /* Check for disk space before extracting */
-                should_stop_app = 0;
-                if (skip_disk_space_check == false)
-                {
-                  int disk_check_result = check_disk_space(output_directory_path, 20);
-                  if (disk_check_result < 0)
-                  {
-                    /* To do: handle various error cases based
-                       on the result code */
-                    printf(
-                        "\x1B[1mError:\x1B[0m Not enough "
-                        "space on the target drive or cannot "
-                        "check space.\n20MB minimum checked "
-                        "for.  To disable this check, launch "
-                        "the program\nwithout the "
-                        "'-enablediskcheck' command.\n");
-                    should_stop_app = 1;
-                  }
-                }
-                if (should_stop_app == 0)
-                {
-                  num_archives_found++;
-
-                  /* Combine the extraction command, source
-                   * path, and output path */
-                  sprintf(extraction_command, "%s %s \"%s\" \"%s/%s\"", program_name, ExtractCommand, current_file_path, output_directory_path, get_file_path(remove_text(current_file_path, input_file_path)));
-                  sanitizeAmigaPath(extraction_command);
-
-                  /* Execute the command*/
-                  command_result = SystemTagList(extraction_command, NULL);
-
-                  /* Check for error */
-                  if (command_result != 0)
-                  {
-                    if (command_result == 10)
-                    {
-                      printf(
-                          "\n\x1B[1mError:\x1B[0m "
-                          "Corrupt archive %s\n",
-                          current_file_path);
-                      /* Copy the first part of the
-                         message */
-                      strncpy(single_error_message, current_file_path, MAX_ERROR_LENGTH - 1);
-                      single_error_message[MAX_ERROR_LENGTH - 1] = '\0'; /* Ensure null-termination */
-
-                      /* Concatenate the error message if there's space */
-                      if (strlen(single_error_message) + strlen(" is corrupt") < MAX_ERROR_LENGTH)
-                      {
-                        strcat(single_error_message, " is corrupt");
-                      }
-                      logError(single_error_message);
-                    }
-                    else
-                    {
-                      printf(
-                          "\n\x1B[1mError:\x1B[0m "
-                          "Failed to execute command "
-                          "lha for file %s.\nPlease "
-                          "check the archive is not "
-                          "damaged, and there is "
-                          "enough space in the\ntarget "
-                          "directory.\n",
-                          current_file_path);
-                      /* Copy the first part of the message */
-
-                      strncpy(single_error_message, current_file_path, MAX_ERROR_LENGTH - 1);
-                      single_error_message[MAX_ERROR_LENGTH - 1] = '\0'; /* Ensure null-termination
-
-                     /* Concatenate the error message if there's space */
-                      if (strlen(single_error_message) + strlen(" failed to extract. "
-                                                                "Unknown error") <
-                          MAX_ERROR_LENGTH)
-                      {
-                        strcat(single_error_message,
-                               " failed to extract. "
-                               "Unknown error");
-                      }
-                      logError(single_error_message);
-                    }
-                  }
-                  /* if the number of errors is greater then MAX_ERRORS, then quit */
-                  if (error_count >= MAX_ERRORS)
-                  {
-                    printf(
-                        "Maximum number of errors "
-                        "reached. Aborting.\n");
-                    should_stop_app = 1;
-                  }
-                }
-              }
-            }
-          }
-        }
+        close_console();
+        return 20;
       }
-      FreeMem(file_info_block, sizeof(struct FileInfoBlock));
-    }
-    UnLock(dir_lock);
-  }
-}
-
-int check_disk_space(STRPTR path, int min_space_mb)
-{
-  struct InfoData *info = AllocMem(sizeof(struct InfoData), MEMF_CLEAR);
-  BPTR lock = Lock(path, ACCESS_READ);
-  long free_space;
-  int result;
-
-  if (!info)
-    return -1; /* Allocation failed, can't check disk space */
-  if (!lock)
-  {
-    FreeMem(info, sizeof(struct InfoData));
-    return -2; /* Unable to lock the path, can't check disk space */
-  }
-
-  result = 0; /* Default to 0, meaning there's enough space */
-
-  if (Info(lock, info))
-  {
-    /* Convert available blocks to bytes and then to megabytes */
-    free_space = ((long)info->id_NumBlocks - (long)info->id_NumBlocksUsed) * (long)info->id_BytesPerBlock / 1024 / 1024;
-
-#ifdef DEBUG
-    printf("Free space: %ld\n", free_space);
-#endif
-
-    if (free_space < 0)
-    {
-      result = 0; /* Assume very large disk, so return 0 */
-    }
-    else if (free_space < min_space_mb)
-    {
-      result = -3; /* Not enough space */
+      atexit(close_console);
+      options.output = console;
     }
   }
-  else
-  {
-    result = -4; /* Info call failed */
-  }
-
-  UnLock(lock);
-  FreeMem(info, sizeof(struct InfoData));
-  return result;
-}
-
-int main(int argc, char *argv[])
-{
-  int i, disk_check_result;
-  long elapsed_seconds, hours, minutes, seconds;
-
-  /* Black text:  printf("\x1B[30m 30:\x1B[0m \n"); */
-  /* White text:  printf("\x1B[31m 31:\x1B[0m \n"); */
-  /* Blue text:   printf("\x1B[32m 32:\x1B[0m \n"); */
-  /* Grey text:   printf("\x1B[33m 33:\x1B[0m \n"); */
 
   printf("\n");
   printf("\x1B[1m\x1B[32mWHDArchiveExtractor V%s\x1B[0m\x1B[0m  \n", version_number);
@@ -593,7 +141,8 @@ int main(int argc, char *argv[])
       "extract their contents to a specified\ndestination, and preserve the original directory "
       "hierarchy in which the \narchives were located.\x1B[0m \n\n");
 
-  if (!does_file_exist("c:lha"))
+  tools = whd_available_tools();
+  if (!options.native && !(tools & WHD_TOOL_LHA))
   {
     printf(
         "File c:lha does not exist. As this program requires it to "
@@ -602,7 +151,7 @@ int main(int argc, char *argv[])
     return 0;
   }
 
-  if (!does_file_exist("c:unlzx"))
+  if (!(tools & WHD_TOOL_UNLZX))
   {
     printf(
         "File c:unlzx does not exist. There are a few LZX compressed "
@@ -611,96 +160,255 @@ int main(int argc, char *argv[])
         "of UnLZX2.lha from www.aminet.org\n");
   }
 
-  if (argc < 2)
+  if (argc < 3)
   {
     printf(
         "\x1B[1mUsage:\x1B[0m WHDArchiveExtractor <source_directory> "
-        "<output_directory_path> [-enablespacecheck (experimental)] \n\n");
+        "<output_directory_path> [-enablespacecheck (experimental)] "
+        "[-workers=<n>] [-splitsize=<KB>] [-batchsize=<KB>] [-queuesize=<KB>] [-native] [-maxerrors=<n>] "
+        "[-eventlog=<file>] [-watch] [-hdf=<MB>] [-tar] [-force] [-cache=<file>] [-index=<file>] [-dryrun] [-framed] [-lowmemory] [-noprogress] [-durable=none|archive|run]\n\n");
     return 1;
   }
 
-  input_directory_path = argv[1];
-  output_directory_path = argv[2];
+  options.source_path = argv[1];
+  options.target_path = argv[2];
+  if (strcmp(options.source_path, "-") == 0)
+  {
+    options.input = Input();
+  }
 
-  skip_disk_space_check = true;
-  for (i = 4; i < argc; i++)
+  for (i = 3; i < argc; i++)
   {
     if (strcmp(argv[i], "-enablespacecheck") == 0)
     {
-      skip_disk_space_check = false;
+      options.space_check = TRUE;
     }
     if (strcmp(argv[i], "-testarchivesonly") == 0)
     {
-      test_archives_only = true;
+      options.test_only = TRUE;
+    }
+    if (strncmp(argv[i], "-workers=", 9) == 0)
+    {
+      options.workers = atoi(argv[i] + 9);
+    }
+    if (strncmp(argv[i], "-splitsize=", 11) == 0)
+    {
+      options.split_size_kb = atol(argv[i] + 11);
+    }
+    if (strncmp(argv[i], "-batchsize=", 11) == 0)
+    {
+      options.batch_kb = atol(argv[i] + 11);
+    }
+    if (strncmp(argv[i], "-queuesize=", 11) == 0)
+    {
+      options.queue_kb = atol(argv[i] + 11);
+    }
+    if (strncmp(argv[i], "-maxerrors=", 11) == 0)
+    {
+      options.max_errors = atol(argv[i] + 11);
+    }
+    if (strncmp(argv[i], "-eventlog=", 10) == 0)
+    {
+      options.event_log_path = argv[i] + 10;
+    }
+    if (strcmp(argv[i], "-watch") == 0)
+    {
+      options.watch = TRUE;
+    }
+    if (strcmp(argv[i], "-tar") == 0)
+    {
+      options.output_format = WHD_OUTPUT_TAR;
+    }
+    if (strcmp(argv[i], "-force") == 0)
+    {
+      options.force = TRUE;
+    }
+    if (strcmp(argv[i], "-dryrun") == 0)
+    {
+      options.dry_run = TRUE;
+    }
+    if (strcmp(argv[i], "-framed") == 0)
+    {
+      options.framed_input = TRUE;
+    }
+    if (strcmp(argv[i], "-lowmemory") == 0)
+    {
+      options.low_memory = TRUE;
+    }
+    if (strncmp(argv[i], "-cache=", 7) == 0)
+    {
+      options.cache_path = argv[i] + 7;
+    }
+    if (strncmp(argv[i], "-index=", 7) == 0)
+    {
+      options.index_path = argv[i] + 7;
+    }
+    if (strncmp(argv[i], "-durable=", 9) == 0)
+    {
+      if (strcmp(argv[i] + 9, "archive") == 0)
+      {
+        options.durability = WHD_DURABLE_ARCHIVE;
+      }
+      else if (strcmp(argv[i] + 9, "run") == 0)
+      {
+        options.durability = WHD_DURABLE_RUN;
+      }
+      else if (strcmp(argv[i] + 9, "none") == 0)
+      {
+        options.durability = WHD_DURABLE_NONE;
+      }
+      else
+      {
+        printf("\nThe durability must be none, archive or run\n\n");
+        return 1;
+      }
+    }
+    if (strcmp(argv[i], "-noprogress") == 0)
+    {
+      options.show_progress = FALSE;
+    }
+    if (strncmp(argv[i], "-hdf=", 5) == 0)
+    {
+      options.output_format = WHD_OUTPUT_HDF;
+      options.image_size_mb = atol(argv[i] + 5);
+      if (options.image_size_mb < 1 || options.image_size_mb > HDF_MAX_SIZE_MB)
+      {
+        printf("\nThe image size must be between 1 and %d MB\n\n", HDF_MAX_SIZE_MB);
+        return 1;
+      }
     }
   }
 
-  remove_trailing_slash(input_directory_path);
-  remove_trailing_slash(output_directory_path);
-
-  input_file_path = input_directory_path;
-
-  printf("\x1B[1mScanning directory:    \x1B[0m %s\n", input_directory_path);
-  printf("\x1B[1mExtracting archives to:\x1B[0m %s\n", output_directory_path);
-
-  if (does_folder_exists(input_directory_path) == 0)
+  if (options.input != 0)
   {
-    printf("\nUnable to find the source folder %s\n\n", input_directory_path);
-    return 0;
+    printf("\x1B[1mReading archives from: \x1B[0m standard input%s\n", options.framed_input ? " (framed)" : "");
+  }
+  else
+  {
+    printf("\x1B[1mScanning directory:    \x1B[0m %s\n", options.source_path);
+  }
+  if (options.dry_run && options.input == 0)
+  {
+    printf("\x1B[1mPlanning extraction to:\x1B[0m %s (dry run)\n", options.target_path);
+  }
+  else if (options.output_format == WHD_OUTPUT_HDF)
+  {
+    printf("\x1B[1mExtracting archives to:\x1B[0m %s (%luMB FFS image)\n", options.target_path, options.image_size_mb);
   }
-  if (does_folder_exists(output_directory_path) == 0)
+  else if (options.output_format == WHD_OUTPUT_TAR)
   {
-    printf("\nUnable to find the target folder %s\n\n", output_directory_path);
+    printf("\x1B[1mExtracting archives to:\x1B[0m %s (tar)\n", strcmp(options.target_path, "-") == 0 ? "standard output" : options.target_path);
+  }
+  else
+  {
+    printf("\x1B[1mExtracting archives to:\x1B[0m %s\n", options.target_path);
+  }
+
+  context = whd_create_context(&options);
+  if (context == NULL)
+  {
+    printf("\nOut of memory\n\n");
     return 0;
   }
 
-  if (!skip_disk_space_check)
+  /* Everything from here on may be printed by worker processes */
+  fflush(stdout);
+
+  /* Start timer */
+  DateStamp(&start_time);
+
+  result = whd_run(context);
+  if (result != WHD_OK)
   {
-    disk_check_result = check_disk_space(output_directory_path, 20);
-    if (disk_check_result < 0)
+    switch (result)
     {
+    case WHD_ERR_SOURCE:
+      printf("\nUnable to find the source folder %s\n\n", options.source_path);
+      break;
+    case WHD_ERR_TARGET:
+      printf("\nUnable to find the target folder %s\n\n", options.target_path);
+      break;
+    case WHD_ERR_SPACE:
       /* To do: handle various error cases based on the result code*/
       printf(
           "\n\x1B[1mError:\x1B[0m Not enough space on the target drive "
           "or cannot check space.\n20MB minimum checked for.  To "
           "disable this check, do not launch the\nprogram with the "
           "\x1B[3m-enablespacecheck\x1B[23m command.\n\n");
-      return 0;
+      break;
+    case WHD_ERR_OUTPUT:
+      printf("\nUnable to create %s\n\n", options.target_path);
+      break;
+    case WHD_ERR_EVENT_LOG:
+      printf("\nUnable to create the event log %s\n\n", options.event_log_path);
+      break;
+    default:
+      printf("\nOut of memory\n\n");
+      break;
     }
+    whd_free_context(context);
+    return 0;
   }
 
-  /* Start timer */
-  start_time = time(NULL);
-
-  get_directory_contents(input_directory_path, output_directory_path);
+  whd_get_stats(context, &stats);
 
-  /* Calculate elapsed time */
-  elapsed_seconds = time(NULL) - start_time;
-  hours = elapsed_seconds / 3600;
-  minutes = (elapsed_seconds % 3600) / 60;
-  seconds = elapsed_seconds % 60;
+  /* Calculate elapsed time, to a tick */
+  DateStamp(&end_time);
+  elapsed_ticks = ((end_time.ds_Days - start_time.ds_Days) * 1440 + end_time.ds_Minute - start_time.ds_Minute) * 60 * TICKS_PER_SECOND +
+                  end_time.ds_Tick - start_time.ds_Tick;
+  hours = elapsed_ticks / (3600 * TICKS_PER_SECOND);
+  minutes = elapsed_ticks / (60 * TICKS_PER_SECOND) % 60;
+  seconds = elapsed_ticks / TICKS_PER_SECOND % 60;
+  hundredths = elapsed_ticks % TICKS_PER_SECOND * 100 / TICKS_PER_SECOND;
   printf(
-      "Scanned \x1B[1m%d\x1B[0m directories and found \x1B[1m%d\x1B[0m "
+      "Scanned \x1B[1m%ld\x1B[0m directories and found \x1B[1m%ld\x1B[0m "
       "archives.\n",
-      num_directories_scanned, num_lha_archives_found + num_lzx_archives_found);
+      stats.directories_scanned, stats.lha_archives_found + stats.lzx_archives_found);
   printf(
-      "Archives composed of \x1B[1m%d\x1B[0m LHA and \x1B[1m%d\x1B[0m "
+      "Archives composed of \x1B[1m%ld\x1B[0m LHA and \x1B[1m%ld\x1B[0m "
       "LZX archives.\n",
-      num_lha_archives_found, num_lzx_archives_found);
+      stats.lha_archives_found, stats.lzx_archives_found);
 
-  if (num_lzx_archives_found > 0)
+  if (stats.lzx_archives_found > 0)
   {
-    if (!does_file_exist("c:unlzx"))
+    if (!(tools & WHD_TOOL_UNLZX))
     {
 
       printf(
-          "UnLZX is not installed.  \x1B[1m%d\x1B[0m LZX archives were found but not expanded.\n",
-          num_lzx_archives_found);
+          "UnLZX is not installed.  \x1B[1m%ld\x1B[0m LZX archives were found but not expanded.\n",
+          stats.lzx_archives_found);
     }
   }
 
-  printf("\nElapsed time: \x1B[1m%ld:%02ld:%02ld\x1B[0m\n", hours, minutes, seconds);
-  printErrors();
+  if (stats.members_unchanged > 0)
+  {
+    printf("\x1B[1m%ld\x1B[0m files were already up to date and not extracted again.\n", stats.members_unchanged);
+  }
+  if (stats.members_copied > 0)
+  {
+    printf("\x1B[1m%ld\x1B[0m files were copied from the cache instead of being decoded.\n", stats.members_copied);
+  }
+
+  if (options.durability != WHD_DURABLE_NONE && stats.event_counts[WHD_EVENT_EXTRACTED] > 0)
+  {
+    printf("\x1B[1m%ld\x1B[0m of \x1B[1m%ld\x1B[0m archives extracted are safely on disk.\n", stats.archives_durable,
+           stats.event_counts[WHD_EVENT_EXTRACTED]);
+  }
+
+  for (i = 0; i < stats.num_workers; i++)
+  {
+    printf("Worker %d ran \x1B[1m%lu\x1B[0m jobs, %lu of them stolen.\n", i + 1, stats.jobs_run[i], stats.jobs_stolen[i]);
+  }
+  if (stats.num_workers > 0)
+  {
+    printf("At most \x1B[1m%ld\x1B[0m jobs were queued at once; scanning waited %lu.%02lu seconds for the queue.\n",
+           stats.max_queue_depth, stats.queue_stall_ticks / TICKS_PER_SECOND,
+           stats.queue_stall_ticks % TICKS_PER_SECOND * 100 / TICKS_PER_SECOND);
+  }
+
+  printf("\nElapsed time: \x1B[1m%ld:%02ld:%02ld.%02ld\x1B[0m\n", hours, minutes, seconds, hundredths);
+  printErrors(context, &stats);
+  whd_free_context(context);
   printf("\nWHDArchiveExtractor V%s\n\n", version_number);
   return 0;
 }
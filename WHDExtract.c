@@ -0,0 +1,4444 @@
+/*
+
+  WHDExtract
+
+  Scans a source folder for LHA and LZX archives and extracts them to a
+  target folder that mirrors its structure, using c:lha, c:unlzx or the
+  built-in LHA decoder, on one process or a pool of worker processes.
+  See WHDExtract.h for the interface.
+
+  This program is released under the MIT License.
+*/
+
+#include <ctype.h>
+#include <dos/dos.h>
+#include <dos/dosextens.h>
+#include <dos/dostags.h>
+#include <dos/notify.h>
+#include <exec/memory.h>
+#include <exec/semaphores.h>
+#include <exec/types.h>
+#include <proto/dos.h>
+#include <proto/exec.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "AsyncIO.h"
+#include "Catalogue.h"
+#include "HDFImage.h"
+#include "LHAArchive.h"
+#include "LHADecode.h"
+#include "MemberCache.h"
+#include "OutputSink.h"
+#include "TARStream.h"
+#include "WHDExtract.h"
+#include "WriteBatch.h"
+
+#define bool int
+#define true 1
+#define false 0
+#define DEBUG 1
+#define BUFFER_SIZE 1024
+#define WORKER_STACK_SIZE 16384
+#define DEFAULT_SPLIT_SIZE_KB 1024 /* LHA archives at least this big are split into member jobs */
+#define MIN_PART_SIZE 65536        /* Smallest amount of packed data worth a job of its own */
+#define CACHE_READ_SIZE 16384      /* Buffer for hashing compressed data */
+#define DEFAULT_INPUT_SIZE 4096    /* Compressed data read at a time by the built-in decoder */
+#define LOW_MEMORY_SHARE 8         /* -lowmemory: buffers take at most this part of the free memory */
+#define MIN_WRITE_BUFFER 4096      /* Below this a member's file is written without buffers */
+#define MIN_BATCH_SIZE 16384       /* Below this small files are not batched at all */
+#define DEFAULT_BATCH_KB 256       /* Small files held in memory per job before they are written */
+#define DEFAULT_QUEUE_KB 2048      /* Queued and running jobs, with their read-ahead, before the scanner waits */
+#define PREALLOCATE_MIN_SIZE 16384 /* Smaller members reach the disk in one or two writes anyway */
+#define MAX_WRITE_BUFFER 65536     /* Largest set of write buffers given to a member's file */
+#define ARCHIVE_READ_SIZE 49152    /* Read-ahead buffers for an archive being extracted */
+#define ASYNC_BUFFERS 3            /* Each file's buffers: one for the decoder, the rest with the file system */
+#define MAX_MEMBER_ARGS 400        /* Keeps member lists within the shell's line length */
+#define INITIAL_DEQUE_SIZE 64      /* Must be a power of two */
+#define WATCH_SETTLE_SECONDS 3     /* -watch: quiet time before a changed directory is rescanned */
+#define WATCH_POLL_SECONDS 60      /* -watch: rescan interval where notification is not supported */
+#define SEEN_HASH_SIZE 1024        /* Must be a power of two */
+#define BAR_INTERVAL_TICKS 10      /* Redraw the progress bar at most five times a second */
+#define LINE_INTERVAL_TICKS 250    /* Write a progress line at most every five seconds */
+#define BAR_WIDTH 30
+#define STREAM_UNLIMITED 0xFFFFFFFFUL /* A single archive runs to the end of the stream */
+#define SKIP_BUFFER_SIZE 512       /* Stream data read and dropped at a time */
+
+#define ARCHIVE_LHA 0
+#define ARCHIVE_LZX 1
+
+#define JOB_ARCHIVE 0 /* Extract a whole archive */
+#define JOB_MEMBERS 1 /* Extract a group of members from a large archive */
+#define JOB_INVENTORY 2 /* Add the archives below a directory to the catalogue */
+
+/* Worker entry points must set up the small data base register */
+#if defined(__SASC) || defined(__VBCC__)
+#define WORKER_SAVEDS __saveds
+#else
+#define WORKER_SAVEDS
+#endif
+
+/*
+ * Member headers of one archive, shared by the jobs decoding its members.
+ * Parts of an archive split for lha share one without headers, so the
+ * archive is reported once, when its last part is done.
+ */
+struct MemberSet
+{
+  LONG refcount;
+  LONG num_members;
+  struct LhaMember *members;
+  LONG failed_parts;  /* Parts not extracted completely; under pool_lock */
+};
+
+struct ArchiveJob
+{
+  struct Message message; /* Replied to the main process once a worker has run the job */
+  int    job_type;
+  int    archive_type;
+  LONG   archive_size;
+  int    part;         /* JOB_MEMBERS: 1-based part number */
+  int    num_parts;
+  STRPTR member_args;  /* JOB_MEMBERS: quoted member names for lha */
+  struct MemberSet *member_set; /* Members for the native decoder, or the parts of an archive split for lha */
+  LONG   first_member;
+  LONG   last_member;  /* One past the last member to decode */
+  ULONG  progress_bytes; /* Compressed bytes of the job not yet counted as done */
+  ULONG  queue_cost;   /* Bytes charged to the queue budget until the job comes back */
+  char   archive_name[108];
+  char   archive_path[256]; /* JOB_INVENTORY: the directory */
+  char   output_path[256]; /* Destination directory, ending in '/' */
+};
+
+/*
+ * Work-stealing deque.  The owning worker pushes and pops at the bottom,
+ * idle workers steal the oldest job from the top.
+ */
+struct JobDeque
+{
+  struct SignalSemaphore lock;
+  struct ArchiveJob **slots;
+  ULONG capacity; /* Always a power of two */
+  ULONG top;
+  ULONG bottom;
+};
+
+/* A source directory watched for new archives in -watch mode */
+struct WatchDir
+{
+  struct WatchDir *next;
+  struct NotifyRequest request;
+  bool  notifying;     /* False if the file system cannot notify, so it is polled */
+  long  changed_time;  /* When the last change was seen, 0 if none is waiting */
+  long  scanned_time;
+  char  path[256];
+};
+
+/* Size and date of an archive when it was queued; the path follows the structure */
+struct SeenArchive
+{
+  struct SeenArchive *next;
+  LONG  size;
+  struct DateStamp date;
+  char *path;
+};
+
+struct Worker
+{
+  struct Message startup; /* Brings the worker to its process, and comes back when the process ends */
+  struct WhdContext *context;
+  int    id;
+  struct Task *task;
+  struct JobDeque deque;
+  ULONG  jobs_run;
+  ULONG  jobs_stolen;
+  ULONG  random_state;
+};
+
+/* Everything one extraction run needs; nothing is shared between contexts */
+struct WhdContext
+{
+  struct WhdOptions options;
+  bool skip_disk_space_check;
+  bool test_archives_only;
+  bool use_native_lha;
+  bool watch_mode;
+  bool lha_available, unlzx_available;
+  char input_directory_path[256];
+  char output_directory_path[256];
+  char *input_file_path;
+  LONG split_size_kb;
+  LONG max_errors; /* Abort after this many errors, 0 to never abort */
+  int  requested_workers;
+
+  /* Event log */
+  struct WhdEvent *first_event;
+  struct WhdEvent *last_event;
+  LONG event_counts[WHD_NUM_EVENT_CLASSES];
+  BPTR event_log_file;
+  int  error_count;
+  int  should_stop_app; /* used to stop the app if the lha extraction fails */
+
+  /* Counters */
+  int  num_archives_found;
+  int  num_directories_scanned;
+  int  num_lzx_archives_found;
+  int  num_lha_archives_found;
+  LONG num_members_unchanged;
+  int  resetProtectionBits;
+
+  /* Worker pool state, shared between the scanner and the workers */
+  struct Worker workers[WHD_MAX_WORKERS];
+  struct SignalSemaphore pool_lock;   /* Protects pending_jobs, workers_quit and the counters */
+  struct SignalSemaphore output_lock; /* Keeps console lines from interleaving */
+  struct SignalSemaphore log_lock;    /* Protects the error log */
+  struct Task *main_task;
+  struct MsgPort *result_port;        /* Jobs the workers have run, and workers that have ended */
+  int  num_workers;
+  int  running_workers;
+  int  workers_quit;
+  int  next_deque;
+  LONG pending_jobs;
+  ULONG queue_budget;   /* Bytes of jobs out with the workers, 0 for no limit */
+  ULONG queued_bytes;
+  LONG max_queue_depth;
+  ULONG stall_ticks;    /* Time the scanner spent waiting for the queue to drain */
+
+  /* Every archive found, with its headers read, before any is extracted */
+  struct Catalogue *catalogue;
+  ULONG kb_unpacked;
+  bool  catalogue_incomplete;         /* An archive or directory was left out for want of memory */
+  struct CatalogueIndex *index;       /* The catalogue saved by an earlier run, or NULL */
+  int   num_directories_unchanged;
+  int   num_archives_indexed;
+  ULONG kb_catalogue;                 /* Memory the catalogue took once complete */
+  ULONG kb_to_write, kb_needed;       /* -dryrun totals */
+
+  /* Image or stream written instead of the target folder; handle is NULL if none */
+  struct OutputSink sink;
+
+  /* Progress, in KB with the odd bytes carried; the counters are under pool_lock */
+  bool  progress_bar;    /* Drawn in place on a console, otherwise written as lines */
+  bool  bar_visible;     /* The bar ends the console line; under output_lock */
+  bool  counting_found;  /* -watch rescans add what they find to the total */
+  ULONG kb_total, bytes_total;
+  ULONG kb_done, bytes_done;
+  ULONG kb_decoded, bytes_decoded;
+  struct DateStamp start_time;
+  ULONG progress_shown;  /* Ticks after start_time when progress was last shown */
+
+  /* File system of the target, when extracted files are flushed to disk */
+  struct MsgPort *target_port;
+  LONG num_durable;
+
+  /* Buffer sizes; -lowmemory cuts them down to fit the memory free at the start */
+  ULONG input_buffer_size;
+  ULONG read_buffer_size;
+  ULONG write_buffer_max;
+  ULONG hash_buffer_size;
+  ULONG batch_size;
+
+  /* Decoded member cache, or NULL */
+  struct MemberCache *cache;
+  char target_root[256];  /* Absolute path of the target folder, for cache entries */
+  LONG num_members_copied;
+
+  /* -watch state, only used by the process that called whd_run() */
+  struct MsgPort *watch_port;
+  struct WatchDir *watch_dirs;
+  struct SeenArchive *seen_archives[SEEN_HASH_SIZE];
+};
+
+/* Writes a member to the caller's member_data callback */
+struct MemberStream
+{
+  struct WhdContext *context;
+  APTR member_handle;
+};
+
+/* Hashes the compressed data of a member while it is decoded */
+struct HashedRead
+{
+  struct AsyncFile *file;
+  ULONG hash;
+};
+
+/* Copies a cached file while its CRC is checked */
+struct CopyStream
+{
+  BPTR source;
+  BPTR destination;
+};
+
+/* Finishes the members of a job that were held in a WriteBatch */
+struct BatchedRange
+{
+  struct WhdContext *context;
+  struct ArchiveJob *job;
+  int errors;
+};
+
+/* An archive read from a stream, front to back, without seeking */
+struct StreamInput
+{
+  BPTR  file;
+  ULONG left;     /* Bytes of the archive still to come, or STREAM_UNLIMITED */
+  ULONG position; /* Bytes read from the archive so far */
+};
+
+/* Function prototypes */
+static char *get_file_path(const char *full_path);
+static char *remove_text(char *input_str, STRPTR text_to_remove);
+static int   check_disk_space(struct WhdContext *context, STRPTR path, int min_space_mb);
+static int   does_file_exist(char *filename);
+static int   does_folder_exists(const char *folder_name);
+static void  sanitizeAmigaPath(char *path);
+static void  get_directory_contents(struct WhdContext *context, const char *directory_path);
+static void  log_event(struct WhdContext *context, int event_class, const char *archive, const char *member, LONG exit_code, const char *message);
+static void  free_event_log(struct WhdContext *context);
+static void  report_progress(struct WhdContext *context, int stage, const char *path, const struct WhdEvent *event);
+static ULONG ticks_since(const struct DateStamp *start);
+static void  add_kb(ULONG *kb, ULONG *bytes, ULONG count);
+static ULONG scale(ULONG value, ULONG multiplier, ULONG divisor);
+static void  inventory_directory(struct WhdContext *context, const char *directory_path, bool top_level);
+static void  inventory_subdirectory(struct WhdContext *context, const char *path, bool top_level);
+static void  inventory_archive(struct WhdContext *context, int archive_type, const char *archive_path,
+                               struct FileInfoBlock *file_info_block, LONG indexed_directory);
+static void  add_indexed_archive(struct WhdContext *context, const char *path, LONG archive);
+static void  count_archive_found(struct WhdContext *context, int archive_type, bool from_index);
+static void  catalogue_failed(struct WhdContext *context, const char *path);
+static void  save_index(struct WhdContext *context);
+static void  plan_extraction(struct WhdContext *context);
+static void  plan_dry_run(struct WhdContext *context);
+static bool  get_free_kb(const char *path, ULONG *kb_free);
+static void  add_progress(struct WhdContext *context, struct ArchiveJob *job, ULONG packed, ULONG decoded);
+static void  show_progress(struct WhdContext *context, ULONG kb_done, ULONG kb_total, ULONG kb_decoded, ULONG ticks);
+static void  finish_progress(struct WhdContext *context);
+static void  report_extracted(struct WhdContext *context, struct ArchiveJob *job, const char *message);
+static bool  flush_target(struct WhdContext *context);
+static void  remove_trailing_slash(char *str);
+static char *findFirstDirectory(struct WhdContext *context, char *filePath, char *directoryName);
+static char *get_file_extension(const char *filename, char *outputBuffer);
+static void  log_printf(struct WhdContext *context, const char *format, ...);
+static struct ArchiveJob *create_job(struct WhdContext *context, int archive_type, const char *archive_path, const char *archive_name, LONG archive_size);
+static void  get_output_directory(struct WhdContext *context, const char *archive_path, char *output_path);
+static void  free_job(struct WhdContext *context, struct ArchiveJob *job);
+static void  queue_job(struct WhdContext *context, struct ArchiveJob *job);
+static void  address_job(struct WhdContext *context, struct ArchiveJob *job);
+static void  unqueue_job(struct WhdContext *context, struct ArchiveJob *job);
+static ULONG job_cost(struct WhdContext *context, struct ArchiveJob *job);
+static bool  queue_is_full(struct WhdContext *context, ULONG cost);
+static void  run_job(struct WhdContext *context, struct ArchiveJob *job, struct Worker *worker);
+static void  extract_archive(struct WhdContext *context, struct ArchiveJob *job, struct Worker *worker);
+static void  prepare_protected_files(struct WhdContext *context, struct ArchiveJob *job);
+static bool  split_archive(struct WhdContext *context, struct ArchiveJob *job, struct Worker *worker);
+static void  run_extraction(struct WhdContext *context, struct ArchiveJob *job, const char *program_name, const char *options);
+static bool  has_disk_space(struct WhdContext *context, const char *archive_path);
+static bool  extract_archive_native(struct WhdContext *context, struct ArchiveJob *job, struct Worker *worker);
+static void  extract_member_range(struct WhdContext *context, struct ArchiveJob *job);
+static void  get_timestamp_date(ULONG timestamp, struct DateStamp *date);
+static bool  member_is_current(struct LhaDecoder *decoder, const struct LhaMember *member, const char *path, struct FileInfoBlock *file_info_block);
+static void  restore_member_metadata(const struct LhaMember *member, const char *path);
+static bool  copy_cached_member(struct WhdContext *context, struct LhaDecoder *decoder, struct AsyncFile *archive,
+                                const struct LhaMember *member, const char *path, ULONG *hash, bool *hash_known);
+static void  remember_member(struct WhdContext *context, const struct LhaMember *member, ULONG hash, const char *path);
+static void  finish_batched_member(APTR user_data, APTR file, ULONG hash, const char *path, LONG error);
+static void  preallocate_file(BPTR file, ULONG size);
+static struct AsyncFile *create_member_file(const char *path, ULONG size, ULONG max_buffer);
+static LONG  decode_to_file(struct WhdContext *context, struct LhaDecoder *decoder, const struct LhaMember *member,
+                            const char *path, LhaReadFunc read, APTR read_handle, LONG *io_error);
+static LONG  decode_to_sink(struct WhdContext *context, struct LhaDecoder *decoder, const struct LhaMember *member,
+                            const char *path, LhaReadFunc read, APTR read_handle, LONG *io_error);
+static void  report_member_error(struct WhdContext *context, const char *archive_path, const char *member_path, LONG result,
+                                 LONG io_error);
+static void  create_directory_path(const char *path, char *last_created);
+static bool  member_output_path(struct ArchiveJob *job, const struct LhaMember *member, char *path, ULONG size);
+static void  make_member_directory(struct WhdContext *context, struct ArchiveJob *job, const struct LhaMember *member,
+                                   char *last_created);
+static void  release_member_set(struct WhdContext *context, struct ArchiveJob *job);
+static void  finish_part(struct WhdContext *context, struct ArchiveJob *job, bool extracted);
+static bool  deque_init(struct JobDeque *deque);
+static void  deque_free(struct WhdContext *context, struct JobDeque *deque);
+static bool  deque_push(struct JobDeque *deque, struct ArchiveJob *job);
+static struct ArchiveJob *deque_pop(struct JobDeque *deque);
+static struct ArchiveJob *deque_steal(struct JobDeque *deque);
+static struct ArchiveJob *steal_job(struct WhdContext *context, struct Worker *thief);
+static int   start_workers(struct WhdContext *context, int count);
+static void  finish_workers(struct WhdContext *context);
+static void  wait_for_jobs(struct WhdContext *context);
+static void  wake_workers(struct WhdContext *context);
+static void  collect_results(struct WhdContext *context);
+static struct WatchDir *watch_directory(struct WhdContext *context, const char *path);
+static bool  watch_directory_exists(struct WhdContext *context, const char *path);
+static void  remember_archive(struct WhdContext *context, const char *archive_path, struct FileInfoBlock *file_info_block);
+static bool  archive_is_new(struct WhdContext *context, const char *archive_path, struct FileInfoBlock *file_info_block);
+static bool  archive_is_complete(const char *archive_path);
+static void  watch_for_changes(struct WhdContext *context);
+static void  stop_watching(struct WhdContext *context);
+static LONG  open_sink(struct WhdContext *context);
+static void  extract_input(struct WhdContext *context);
+static bool  read_frame_header(struct WhdContext *context, ULONG *size, char *path);
+static void  extract_stream_archive(struct WhdContext *context, struct StreamInput *input, struct ArchiveJob *job);
+static LONG  read_input(APTR handle, UBYTE *buffer, LONG length);
+static bool  skip_input(struct StreamInput *input, ULONG count);
+static LONG  open_cache(struct WhdContext *context);
+static void  fit_buffers_to_memory(struct WhdContext *context);
+
+/*
+ * Function to sanitize an Amiga file path in-place by correcting specific path issues.
+ * It ensures no slashes immediately follow a colon, replaces "//" with "/", and removes consecutive colons.
+ * Assumes the input buffer is large enough for the sanitized path.
+ */
+static void sanitizeAmigaPath(char *path)
+{
+  ULONG len;
+  char *sanitizedPath;
+  int i, j;
+
+  if (path == NULL)
+  {
+    return;
+  }
+
+  len = strlen(path) + 1; /* Include null terminator*/
+  sanitizedPath = (char *)AllocVec(len, MEMF_ANY | MEMF_CLEAR);
+  if (sanitizedPath == NULL)
+  {
+    /* Memory allocation failed */
+    return;
+  }
+
+  i = 0;
+  j = 0;
+  while (path[i] != '\0')
+  {
+    if (path[i] == ':')
+    {
+      /* Copy the colon */
+      sanitizedPath[j++] = path[i++];
+      /* Skip all following slashes */
+      while (path[i] == '/')
+      {
+        i++;
+      }
+    }
+    else if (path[i] == '/' && path[i + 1] == '/')
+    {
+      /* Skip redundant slashes */
+      i++;
+    }
+    else
+    {
+      /* Copy other characters */
+      sanitizedPath[j++] = path[i++];
+    }
+  }
+
+  sanitizedPath[j] = '\0'; /* Ensure the result is null-terminated */
+
+  /* Copy back to the original path and free the allocated memory */
+  strcpy(path, sanitizedPath);
+  FreeVec(sanitizedPath);
+}
+
+static char *remove_text(char *input_str, STRPTR text_to_remove)
+{
+  int remove_len = strlen(text_to_remove);
+
+  /* Check if the second string exists at the start of the first string */
+  if (strncmp(input_str, text_to_remove, remove_len) == 0)
+  {
+    /* If the second string is found, return a pointer to the rest of the
+     * first string*/
+    return input_str + remove_len;
+  }
+
+  /*If the second string is not found, return the original first string*/
+  return input_str;
+}
+
+/*
+ * Extracts the file extension from a given filename and converts it to uppercase.
+ * Assumes the extension is exactly 4 characters long, including the dot.
+ *
+ * Parameters:
+ *     filename - the name of the file from which to extract the extension.
+ *     outputBuffer - a buffer to hold the uppercase extension, must be at least 5 characters long.
+ *
+ * Returns:
+ *     A pointer to the outputBuffer containing the uppercase extension, or NULL if the operation fails.
+ */
+static char *get_file_extension(const char *filename, char *outputBuffer)
+{
+  const char *extensionStart;
+  int i;
+  size_t len = strlen(filename);
+
+  if (len < 4 || outputBuffer == NULL)
+  {
+    return NULL; /* Return NULL if the string is too short or outputBuffer is NULL */
+  }
+
+  extensionStart = filename + len - 4;
+  for (i = 0; i < 4; i++)
+  {
+    outputBuffer[i] = toupper((unsigned char)extensionStart[i]);
+  }
+  outputBuffer[4] = '\0';
+
+  return outputBuffer;
+}
+
+static char *get_file_path(const char *full_path)
+{
+  char *file_path = NULL;
+
+  /* Find the last occurrence of the path separator character */
+  const char *last_slash = strrchr(full_path, '/');
+  const char *last_back_slash = strrchr(full_path, '\\');
+  const char *last_path_separator = last_slash > last_back_slash ? last_slash : last_back_slash;
+
+  if (last_path_separator != NULL)
+  {
+    /* Calculate the length of the file path */
+    size_t file_path_length = last_path_separator - full_path + 1;
+
+    /* Allocate memory for the file path string */
+    file_path = malloc(file_path_length + 1);
+
+    if (file_path != NULL)
+    {
+      /* Copy the file path string to the newly allocated memory */
+      strncpy(file_path, full_path, file_path_length);
+      file_path[file_path_length] = '\0';
+    }
+  }
+
+  return file_path;
+}
+
+static int does_file_exist(char *filename)
+{
+  FILE *file;
+  /* Try to open the file for reading*/
+  if ((file = fopen(filename, "r")))
+  {
+    /* If successful, close the file and return 1*/
+    fclose(file);
+    return 1;
+  }
+  else
+  {
+    /* If not successful, return 0*/
+    return 0;
+  }
+}
+
+static int does_folder_exists(const char *folder_name)
+{
+  BPTR lock = Lock((CONST_STRPTR)folder_name, ACCESS_READ);
+  if (lock != 0)
+  {
+    UnLock(lock);
+    return 1; /* Folder exists*/
+  }
+  else
+  {
+    return 0; /* Folder does not exist */
+  }
+}
+
+static void remove_trailing_slash(char *str)
+{
+  if (str != NULL && strlen(str) > 0 && str[strlen(str) - 1] == '/')
+  {
+    str[strlen(str) - 1] = '\0';
+  }
+}
+
+/*
+ * Formats a message and writes it to the console in one Write() call so
+ * lines printed by different workers do not interleave.  Used instead of
+ * printf() by everything that can run on a worker process.
+ */
+static void log_printf(struct WhdContext *context, const char *format, ...)
+{
+  char buffer[BUFFER_SIZE];
+  va_list arguments;
+
+  if (context->options.output == 0)
+  {
+    return;
+  }
+
+  va_start(arguments, format);
+  vsprintf(buffer, format, arguments);
+  va_end(arguments);
+
+  ObtainSemaphore(&context->output_lock);
+  if (context->bar_visible)
+  {
+    /* The bar is drawn again below the message by the next update */
+    Write(context->options.output, "\r\x1B[K", 4);
+    context->bar_visible = false;
+  }
+  Write(context->options.output, buffer, strlen(buffer));
+  ReleaseSemaphore(&context->output_lock);
+}
+
+static const char *event_class_names[WHD_NUM_EVENT_CLASSES] = {
+    "extracted", "corrupt", "io", "missing_tool", "space", "memory", "unknown"};
+
+/*
+ * Writes text as a JSON string.  Amiga file names are Latin-1, whose
+ * characters map directly onto the first 256 Unicode code points.
+ */
+static char *json_string(char *out, const char *text)
+{
+  UBYTE c;
+
+  *out++ = '"';
+  if (text != NULL)
+  {
+    for (; *text != '\0'; text++)
+    {
+      c = (UBYTE)*text;
+      if (c == '"' || c == '\\')
+      {
+        *out++ = '\\';
+        *out++ = (char)c;
+      }
+      else if (c < 0x20 || c >= 0x7F)
+      {
+        sprintf(out, "\\u%04x", c);
+        out += 6;
+      }
+      else
+      {
+        *out++ = (char)c;
+      }
+    }
+  }
+  *out++ = '"';
+  *out = '\0';
+  return out;
+}
+
+/*
+ * Appends one event to the -eventlog file as a line of JSON.  Called with
+ * log_lock held so lines from different workers never interleave.
+ */
+static void write_event_line(struct WhdContext *context, int event_class, const char *archive, const char *member, LONG exit_code, const char *message)
+{
+  struct DateStamp now;
+  char *line, *out;
+  ULONG size;
+
+  size = 6 * (strlen(archive) + (member != NULL ? strlen(member) : 0) + strlen(message)) + 128;
+  line = (char *)AllocVec(size, MEMF_ANY);
+  if (line == NULL)
+  {
+    return;
+  }
+
+  DateStamp(&now);
+  out = line;
+  out += sprintf(out, "{\"time\":%lu,\"class\":\"%s\",\"archive\":",
+                 (ULONG)now.ds_Days * 86400UL + (ULONG)now.ds_Minute * 60UL + (ULONG)now.ds_Tick / TICKS_PER_SECOND + 252460800UL,
+                 event_class_names[event_class]);
+  out = json_string(out, archive);
+  strcpy(out, ",\"member\":");
+  out += strlen(out);
+  if (member != NULL)
+  {
+    out = json_string(out, member);
+  }
+  else
+  {
+    strcpy(out, "null");
+    out += 4;
+  }
+  out += sprintf(out, ",\"exit_code\":%ld,\"message\":", exit_code);
+  out = json_string(out, message);
+  strcpy(out, "}\n");
+
+  Write(context->event_log_file, line, strlen(line));
+  FreeVec(line);
+}
+
+/*
+ * Records an event.  Errors are kept in memory for the summary printed
+ * at the end of the run; every event is also streamed to the -eventlog
+ * file as it happens.  Safe to call from any worker.
+ */
+static void log_event(struct WhdContext *context, int event_class, const char *archive, const char *member, LONG exit_code, const char *message)
+{
+  struct WhdEvent *event, reported;
+  ULONG size;
+
+  ObtainSemaphore(&context->log_lock);
+
+  if (context->event_log_file != 0)
+  {
+    write_event_line(context, event_class, archive, member, exit_code, message);
+  }
+  context->event_counts[event_class]++;
+
+  if (event_class != WHD_EVENT_EXTRACTED)
+  {
+    context->error_count++;
+
+    size = sizeof(struct WhdEvent) + strlen(archive) + strlen(message) + 2;
+    if (member != NULL)
+    {
+      size += strlen(member) + 1;
+    }
+    event = (struct WhdEvent *)AllocVec(size, MEMF_ANY | MEMF_CLEAR);
+    if (event != NULL)
+    {
+      event->event_class = event_class;
+      event->exit_code = exit_code;
+      event->archive = (char *)(event + 1);
+      strcpy(event->archive, archive);
+      event->message = event->archive + strlen(archive) + 1;
+      strcpy(event->message, message);
+      if (member != NULL)
+      {
+        event->member = event->message + strlen(message) + 1;
+        strcpy(event->member, member);
+      }
+
+      if (context->last_event != NULL)
+      {
+        context->last_event->next = event;
+      }
+      else
+      {
+        context->first_event = event;
+      }
+      context->last_event = event;
+    }
+
+    if (context->max_errors > 0 && context->error_count == context->max_errors)
+    {
+      log_printf(context,
+          "Maximum number of errors "
+          "reached. Aborting.\n");
+      context->should_stop_app = 1;
+    }
+  }
+
+  ReleaseSemaphore(&context->log_lock);
+
+  if (context->options.progress != NULL)
+  {
+    memset(&reported, 0, sizeof(reported));
+    reported.event_class = event_class;
+    reported.exit_code = exit_code;
+    reported.archive = (char *)archive;
+    reported.member = (char *)member;
+    reported.message = (char *)message;
+    report_progress(context, WHD_PROGRESS_EVENT, archive, &reported);
+  }
+}
+
+/* Asks the target's file system to write out everything it has buffered */
+static bool flush_target(struct WhdContext *context)
+{
+  return context->target_port != NULL && DoPkt(context->target_port, ACTION_FLUSH, 0, 0, 0, 0, 0) != DOSFALSE;
+}
+
+/*
+ * Records that a job's archive was extracted.  With WHD_DURABLE_ARCHIVE
+ * the target is flushed first, files and directory entries together, so
+ * the event is only logged once they are on disk, and an I/O error is
+ * logged instead if the flush fails.  Jobs finishing together on several
+ * workers each flush, but the file system has little left to write for
+ * all but the first.
+ */
+static void report_extracted(struct WhdContext *context, struct ArchiveJob *job, const char *message)
+{
+  if (context->options.durability == WHD_DURABLE_ARCHIVE && context->sink.handle == NULL)
+  {
+    if (!flush_target(context))
+    {
+      log_printf(context, "\n\x1B[1mError:\x1B[0m %s was extracted but could not be flushed to disk\n", job->archive_path);
+      log_event(context, WHD_ERROR_IO, job->archive_path, NULL, 0, "was extracted but could not be flushed to disk");
+      return;
+    }
+    ObtainSemaphore(&context->pool_lock);
+    context->num_durable++;
+    ReleaseSemaphore(&context->pool_lock);
+  }
+  log_event(context, WHD_EVENT_EXTRACTED, job->archive_path, NULL, 0, message);
+}
+
+/*
+ * Records how a job's part of an archive went.  An archive that is not
+ * shared between jobs is reported straight away; one that is waits for
+ * release_member_set() to find its last part done.
+ */
+static void finish_part(struct WhdContext *context, struct ArchiveJob *job, bool extracted)
+{
+  if (job->member_set == NULL)
+  {
+    if (extracted)
+    {
+      report_extracted(context, job, "");
+    }
+    return;
+  }
+  if (!extracted)
+  {
+    ObtainSemaphore(&context->pool_lock);
+    job->member_set->failed_parts++;
+    ReleaseSemaphore(&context->pool_lock);
+  }
+}
+
+/* Passes a progress report to the caller's callback, if there is one */
+static void report_progress(struct WhdContext *context, int stage, const char *path, const struct WhdEvent *event)
+{
+  struct WhdProgress progress;
+
+  if (context->options.progress == NULL)
+  {
+    return;
+  }
+
+  progress.stage = stage;
+  progress.path = path;
+  progress.event = event;
+  /* Read without pool_lock, so a report may be a little behind */
+  progress.directories_scanned = context->num_directories_scanned;
+  progress.archives_found = context->num_lha_archives_found + context->num_lzx_archives_found;
+  progress.kb_done = context->kb_done;
+  progress.kb_total = context->kb_total;
+  progress.kb_unpacked = context->kb_unpacked;
+
+  context->options.progress(context->options.user_data, &progress);
+}
+
+/* Ticks since a date stamp, at TICKS_PER_SECOND; good for about two years */
+static ULONG ticks_since(const struct DateStamp *start)
+{
+  struct DateStamp now;
+
+  DateStamp(&now);
+  return (ULONG)(((now.ds_Days - start->ds_Days) * 1440 + now.ds_Minute - start->ds_Minute) * 60 * TICKS_PER_SECOND +
+                 now.ds_Tick - start->ds_Tick);
+}
+
+/* Adds bytes to a KB counter, carrying the odd bytes so nothing is lost to rounding */
+static void add_kb(ULONG *kb, ULONG *bytes, ULONG count)
+{
+  *bytes += count;
+  *kb += *bytes >> 10;
+  *bytes &= 1023;
+}
+
+/*
+ * Counts compressed data of a job as done, and decoded data as written.
+ * Progress is shown from here, but only when enough time has passed
+ * since it was last shown, so the cost is one DateStamp() per call.
+ */
+static void add_progress(struct WhdContext *context, struct ArchiveJob *job, ULONG packed, ULONG decoded)
+{
+  ULONG ticks, kb_done = 0, kb_total = 0, kb_decoded = 0;
+  bool show = false;
+
+  if (packed > job->progress_bytes)
+  {
+    packed = job->progress_bytes;
+  }
+  job->progress_bytes -= packed;
+
+  ObtainSemaphore(&context->pool_lock);
+  add_kb(&context->kb_done, &context->bytes_done, packed);
+  add_kb(&context->kb_decoded, &context->bytes_decoded, decoded);
+  if (context->options.show_progress && context->options.output != 0)
+  {
+    ticks = ticks_since(&context->start_time);
+    if (ticks - context->progress_shown >= (context->progress_bar ? BAR_INTERVAL_TICKS : LINE_INTERVAL_TICKS))
+    {
+      context->progress_shown = ticks;
+      kb_done = context->kb_done;
+      kb_total = context->kb_total;
+      kb_decoded = context->kb_decoded;
+      show = true;
+    }
+  }
+  ReleaseSemaphore(&context->pool_lock);
+
+  if (show)
+  {
+    show_progress(context, kb_done, kb_total, kb_decoded, ticks);
+  }
+}
+
+/* value * multiplier / divisor without overflowing 32 bits, or 0 if divisor is 0 */
+static ULONG scale(ULONG value, ULONG multiplier, ULONG divisor)
+{
+  while (value > 0xFFFFFFFFUL / multiplier)
+  {
+    value >>= 1;
+    divisor >>= 1;
+  }
+  return divisor > 0 ? value * multiplier / divisor : 0;
+}
+
+/*
+ * Draws the progress bar, with throughput and the time left, over the
+ * last console line, or writes a line of key=value pairs for programs
+ * reading a file or pipe.
+ */
+static void show_progress(struct WhdContext *context, ULONG kb_done, ULONG kb_total, ULONG kb_decoded, ULONG ticks)
+{
+  char line[160];
+  char *out;
+  ULONG percent, rate, filled, i;
+  LONG eta = -1;
+
+  if (kb_total < kb_done)
+  {
+    kb_total = kb_done; /* Archives that grew since the pre-scan */
+  }
+  percent = kb_total > 0 ? scale(kb_done, 100, kb_total) : 100;
+  rate = scale(kb_done, TICKS_PER_SECOND, ticks);
+  if (rate > 0)
+  {
+    eta = (LONG)((kb_total - kb_done) / rate);
+  }
+
+  if (!context->progress_bar)
+  {
+    sprintf(line, "progress done_kb=%lu total_kb=%lu decoded_kb=%lu kb_per_s=%lu eta_s=%ld\n",
+            kb_done, kb_total, kb_decoded, rate, eta);
+  }
+  else
+  {
+    out = line;
+    out += sprintf(out, "\r\x1B[K[");
+    filled = percent * BAR_WIDTH / 100;
+    for (i = 0; i < BAR_WIDTH; i++)
+    {
+      *out++ = i < filled ? '#' : '-';
+    }
+    out += sprintf(out, "] \x1B[1m%3lu%%\x1B[0m %lu.%lu/%lu.%lu MB %lu KB/s", percent,
+                   kb_done / 1024, (kb_done % 1024) * 10 / 1024, kb_total / 1024, (kb_total % 1024) * 10 / 1024, rate);
+    if (eta >= 0)
+    {
+      sprintf(out, " ETA \x1B[1m%ld:%02ld:%02ld\x1B[0m", eta / 3600, (eta % 3600) / 60, eta % 60);
+    }
+  }
+
+  ObtainSemaphore(&context->output_lock);
+  Write(context->options.output, line, strlen(line));
+  context->bar_visible = context->progress_bar;
+  ReleaseSemaphore(&context->output_lock);
+}
+
+/* Shows the final figures and leaves the bar on a line of its own */
+static void finish_progress(struct WhdContext *context)
+{
+  if (!context->options.show_progress || context->options.output == 0)
+  {
+    return;
+  }
+  show_progress(context, context->kb_done, context->kb_total, context->kb_decoded, ticks_since(&context->start_time));
+  ObtainSemaphore(&context->output_lock);
+  if (context->bar_visible)
+  {
+    Write(context->options.output, "\n", 1);
+    context->bar_visible = false;
+  }
+  ReleaseSemaphore(&context->output_lock);
+}
+
+static void free_event_log(struct WhdContext *context)
+{
+  struct WhdEvent *event, *next;
+
+  for (event = context->first_event; event != NULL; event = next)
+  {
+    next = event->next;
+    FreeVec(event);
+  }
+  context->first_event = NULL;
+  context->last_event = NULL;
+}
+
+/*
+ * Returns the first directory named in an lha listing file.  Uses DOS
+ * file I/O and a caller supplied buffer so it is safe to call from a
+ * worker process.
+ */
+static char *findFirstDirectory(struct WhdContext *context, char *filePath, char *directoryName)
+{
+  BPTR file;
+  char line[256]; /* Buffer to read each line into */
+
+  /* Open the file for reading */
+  if ((file = Open((CONST_STRPTR)filePath, MODE_OLDFILE)) == 0)
+  {
+    log_printf(context, "File does not exist: %s\n", filePath);
+    return NULL; /* Return NULL if file can't be opened */
+  }
+
+  while (FGets(file, line, sizeof(line)) != NULL)
+  {                                          /* Read each line */
+    char *slashPosition = strchr(line, '/'); /* Find the first '/' */
+    if (slashPosition != NULL)
+    {
+      /* Calculate the directory name length */
+      int dirLength = slashPosition - line;
+      /* Copy the directory name to the caller's buffer */
+      strncpy(directoryName, line, dirLength);
+      directoryName[dirLength] = '\0'; /* Null-terminate the string */
+      Close(file);                     /* Close the file */
+      return directoryName;            /* Return the directory name */
+    }
+  }
+
+  Close(file); /* Close the file if no directory is found */
+  return NULL; /* Return NULL if no directory is found */
+}
+
+static void get_directory_contents(struct WhdContext *context, const char *directory_path)
+{
+  BPTR dir_lock;
+  char file_extension[5];
+  char current_file_path[256];
+  struct ArchiveJob *job;
+  struct WatchDir *watch = NULL;
+  int archive_type;
+
+  struct FileInfoBlock *file_info_block;
+  context->resetProtectionBits = 1;
+
+  log_printf(context, "Scanning directory: %s\n", directory_path);
+  report_progress(context, WHD_PROGRESS_DIRECTORY, directory_path, NULL);
+
+  if (context->watch_mode)
+  {
+    watch = watch_directory(context, directory_path);
+  }
+
+  dir_lock = Lock((CONST_STRPTR)directory_path, ACCESS_READ);
+  if (dir_lock)
+  {
+    file_info_block = (struct FileInfoBlock *)AllocMem(sizeof(struct FileInfoBlock), MEMF_CLEAR);
+    if (file_info_block)
+    {
+      if (Examine(dir_lock, file_info_block))
+      {
+        while (ExNext(dir_lock, file_info_block) && context->should_stop_app == 0)
+        {
+          if (strcmp(file_info_block->fib_FileName, ".") != 0 && strcmp(file_info_block->fib_FileName, "..") != 0)
+          {
+            strcpy(current_file_path, directory_path);
+            strcat(current_file_path, "/");
+            strcat(current_file_path, file_info_block->fib_FileName);
+            sanitizeAmigaPath(current_file_path);
+
+            if (file_info_block->fib_DirEntryType > 0)
+            {
+              /* A directory that is already watched is rescanned when it changes */
+              if (context->watch_mode && watch_directory_exists(context, current_file_path))
+              {
+                continue;
+              }
+              context->num_directories_scanned++;
+
+              get_directory_contents(context, current_file_path);
+            }
+            else
+            {
+              get_file_extension(file_info_block->fib_FileName, file_extension);
+
+              if (strcmp(file_extension, ".LHA") == 0 || strcmp(file_extension, ".LZX") == 0)
+              {
+                if (context->watch_mode && !archive_is_new(context, current_file_path, file_info_block))
+                {
+                  continue;
+                }
+                if (context->watch_mode && !archive_is_complete(current_file_path))
+                {
+                  /* Still being written; look again once it has settled */
+                  if (watch != NULL)
+                  {
+                    watch->changed_time = time(NULL);
+                  }
+                  continue;
+                }
+                if (context->watch_mode)
+                {
+                  remember_archive(context, current_file_path, file_info_block);
+                }
+
+                if (strcmp(file_extension, ".LHA") == 0)
+                {
+                  context->num_lha_archives_found++;
+                  archive_type = ARCHIVE_LHA;
+                }
+                else
+                {
+                  context->num_lzx_archives_found++;
+                  archive_type = ARCHIVE_LZX;
+                }
+
+                job = create_job(context, archive_type, current_file_path, file_info_block->fib_FileName, file_info_block->fib_Size);
+                if (job != NULL)
+                {
+                  if (context->counting_found)
+                  {
+                    ObtainSemaphore(&context->pool_lock);
+                    add_kb(&context->kb_total, &context->bytes_total, file_info_block->fib_Size);
+                    ReleaseSemaphore(&context->pool_lock);
+                  }
+                  queue_job(context, job);
+                }
+                else
+                {
+                  log_printf(context, "\n\x1B[1mError:\x1B[0m Out of memory queuing %s\n", current_file_path);
+                }
+              }
+            }
+          }
+        }
+      }
+      FreeMem(file_info_block, sizeof(struct FileInfoBlock));
+    }
+    UnLock(dir_lock);
+  }
+}
+
+/*
+ * First phase of a run: finds every archive below a directory and reads
+ * its member headers into the catalogue, decoding nothing.  With several
+ * workers each directory at the top of the source folder is taken by a
+ * worker of its own, since one slow drive or deep folder would otherwise
+ * hold up the rest.  A directory whose date is the one in the index has
+ * had nothing added, removed or replaced since, so its archives and
+ * subdirectories are taken from the index without reading it.
+ */
+static void inventory_directory(struct WhdContext *context, const char *directory_path, bool top_level)
+{
+  struct FileInfoBlock *file_info_block;
+  char file_extension[5];
+  char path[256];
+  BPTR dir_lock;
+  LONG indexed = -1, archive, i;
+  BOOL unchanged = FALSE;
+
+  log_printf(context, "Scanning directory: %s\n", directory_path);
+  report_progress(context, WHD_PROGRESS_DIRECTORY, directory_path, NULL);
+
+  dir_lock = Lock((CONST_STRPTR)directory_path, ACCESS_READ);
+  if (dir_lock == 0)
+  {
+    return;
+  }
+  file_info_block = (struct FileInfoBlock *)AllocMem(sizeof(struct FileInfoBlock), MEMF_CLEAR);
+  if (file_info_block != NULL && Examine(dir_lock, file_info_block))
+  {
+    if (!catalogue_add_directory(context->catalogue, directory_path, &file_info_block->fib_Date))
+    {
+      catalogue_failed(context, directory_path);
+    }
+    if (context->index != NULL)
+    {
+      indexed = catalogue_index_directory(context->index, directory_path, &file_info_block->fib_Date, &unchanged);
+    }
+
+    if (unchanged)
+    {
+      ObtainSemaphore(&context->pool_lock);
+      context->num_directories_unchanged++;
+      ReleaseSemaphore(&context->pool_lock);
+
+      for (i = 0; (archive = catalogue_index_archive(context->index, indexed, i)) >= 0; i++)
+      {
+        add_indexed_archive(context, directory_path, archive);
+      }
+      for (i = 0; catalogue_index_subdirectory(context->index, indexed, i, path, sizeof(path)) && context->should_stop_app == 0; i++)
+      {
+        inventory_subdirectory(context, path, top_level);
+      }
+    }
+    else
+    {
+      while (ExNext(dir_lock, file_info_block) && context->should_stop_app == 0)
+      {
+        sprintf(path, "%s/%s", directory_path, file_info_block->fib_FileName);
+        sanitizeAmigaPath(path);
+
+        if (file_info_block->fib_DirEntryType > 0)
+        {
+          inventory_subdirectory(context, path, top_level);
+        }
+        else
+        {
+          get_file_extension(file_info_block->fib_FileName, file_extension);
+          if (strcmp(file_extension, ".LHA") == 0)
+          {
+            inventory_archive(context, ARCHIVE_LHA, path, file_info_block, indexed);
+          }
+          else if (strcmp(file_extension, ".LZX") == 0)
+          {
+            inventory_archive(context, ARCHIVE_LZX, path, file_info_block, indexed);
+          }
+        }
+      }
+    }
+  }
+  if (file_info_block != NULL)
+  {
+    FreeMem(file_info_block, sizeof(struct FileInfoBlock));
+  }
+  UnLock(dir_lock);
+}
+
+/* Takes an inventory of a subdirectory, on a worker of its own when it is at the top */
+static void inventory_subdirectory(struct WhdContext *context, const char *path, bool top_level)
+{
+  struct ArchiveJob *job = NULL;
+
+  ObtainSemaphore(&context->pool_lock);
+  context->num_directories_scanned++;
+  ReleaseSemaphore(&context->pool_lock);
+
+  if (top_level && context->num_workers > 1)
+  {
+    job = (struct ArchiveJob *)AllocVec(sizeof(struct ArchiveJob), MEMF_ANY | MEMF_CLEAR);
+  }
+  if (job != NULL)
+  {
+    job->job_type = JOB_INVENTORY;
+    strncpy(job->archive_path, path, sizeof(job->archive_path) - 1);
+    queue_job(context, job);
+  }
+  else
+  {
+    inventory_directory(context, path, false);
+  }
+}
+
+/*
+ * Adds one archive and its member headers to the catalogue, from the
+ * index if it has the archive at the same size and date.  An archive
+ * whose headers cannot be read is still added, and fails when it is
+ * extracted.  LZX archives are catalogued by their size alone.
+ */
+static void inventory_archive(struct WhdContext *context, int archive_type, const char *archive_path,
+                              struct FileInfoBlock *file_info_block, LONG indexed_directory)
+{
+  struct LhaMember *members = NULL;
+  LONG num_members = -1, archive, i;
+  BOOL native = FALSE, added;
+
+  if (indexed_directory >= 0)
+  {
+    archive = catalogue_index_find_archive(context->index, indexed_directory, file_info_block->fib_FileName,
+                                           file_info_block->fib_Size, &file_info_block->fib_Date);
+    if (archive >= 0)
+    {
+      add_indexed_archive(context, archive_path, archive);
+      return;
+    }
+  }
+
+  if (archive_type == ARCHIVE_LHA && lha_read_members((CONST_STRPTR)archive_path, &members, &num_members) == LHA_OK)
+  {
+    native = TRUE;
+    for (i = 0; i < num_members; i++)
+    {
+      if (!members[i].is_directory && !lha_method_supported(members[i].method))
+      {
+        native = FALSE;
+      }
+    }
+  }
+  else
+  {
+    members = NULL;
+    num_members = -1;
+  }
+
+  added = catalogue_add(context->catalogue, archive_path, archive_type, file_info_block->fib_Size, &file_info_block->fib_Date,
+                        members, num_members, native);
+  if (members != NULL)
+  {
+    lha_free_members(members);
+  }
+  if (added)
+  {
+    count_archive_found(context, archive_type, false);
+  }
+  else
+  {
+    catalogue_failed(context, archive_path);
+  }
+}
+
+/* Adds an archive the index still has right; path is only for messages */
+static void add_indexed_archive(struct WhdContext *context, const char *path, LONG archive)
+{
+  int archive_type;
+
+  if (catalogue_add_indexed(context->catalogue, context->index, archive, &archive_type))
+  {
+    count_archive_found(context, archive_type, true);
+  }
+  else
+  {
+    catalogue_failed(context, path);
+  }
+}
+
+static void count_archive_found(struct WhdContext *context, int archive_type, bool from_index)
+{
+  ObtainSemaphore(&context->pool_lock);
+  if (archive_type == ARCHIVE_LHA)
+  {
+    context->num_lha_archives_found++;
+  }
+  else
+  {
+    context->num_lzx_archives_found++;
+  }
+  if (from_index)
+  {
+    context->num_archives_indexed++;
+  }
+  ReleaseSemaphore(&context->pool_lock);
+}
+
+/* Something is missing from the catalogue, so it must not be saved as the index */
+static void catalogue_failed(struct WhdContext *context, const char *path)
+{
+  log_printf(context, "\n\x1B[1mError:\x1B[0m Out of memory cataloguing %s\n", path);
+  log_event(context, WHD_ERROR_MEMORY, path, NULL, 0, "could not be catalogued. Out of memory");
+  ObtainSemaphore(&context->pool_lock);
+  context->catalogue_incomplete = true;
+  ReleaseSemaphore(&context->pool_lock);
+}
+
+/*
+ * Saves the catalogue as the index for the next run, unless the scan was
+ * cut short: a directory saved without all its archives would look
+ * complete next time.
+ */
+static void save_index(struct WhdContext *context)
+{
+  if (context->should_stop_app != 0 || context->catalogue_incomplete)
+  {
+    log_printf(context, "\n\x1B[1mWarning:\x1B[0m The inventory is incomplete, so %s was not updated\n", context->options.index_path);
+    return;
+  }
+  if (catalogue_save_index(context->catalogue, (CONST_STRPTR)context->options.index_path) != CATALOGUE_OK)
+  {
+    log_printf(context, "\n\x1B[1mWarning:\x1B[0m Could not write the index %s\n", context->options.index_path);
+  }
+}
+
+/*
+ * Second phase of a run: reports the totals of the inventory, checks the
+ * target has room for what will be extracted, and queues the archives.
+ * One process takes them directory by directory.  Workers take their
+ * newest job first, so for them the archives are queued smallest first
+ * and each starts on its largest; idle workers steal the small ones.
+ */
+static void plan_extraction(struct WhdContext *context)
+{
+  struct CatalogueArchive archive;
+  struct ArchiveJob *job;
+  char archive_path[256];
+  ULONG needed_mb;
+  LONG i, count = catalogue_count(context->catalogue);
+
+  ObtainSemaphore(&context->pool_lock);
+  context->kb_total = catalogue_kb_packed(context->catalogue);
+  context->bytes_total = 0;
+  context->kb_unpacked = catalogue_kb_original(context->catalogue);
+  ReleaseSemaphore(&context->pool_lock);
+
+  log_printf(context, "\nFound \x1B[1m%ld\x1B[0m archives (%d LHA, %d LZX) in \x1B[1m%d\x1B[0m directories: %lu KB packed, %lu KB in LHA members.\n",
+             count, context->num_lha_archives_found, context->num_lzx_archives_found, context->num_directories_scanned,
+             context->kb_total, context->kb_unpacked);
+  context->kb_catalogue = (catalogue_memory(context->catalogue) + 1023) / 1024;
+  report_progress(context, WHD_PROGRESS_PLANNED, context->input_directory_path, NULL);
+
+  if (context->options.dry_run)
+  {
+    plan_dry_run(context);
+    return;
+  }
+
+  /* Only a warning: members already on disk are skipped, and LZX archives are not counted */
+  if (!context->skip_disk_space_check && !context->test_archives_only)
+  {
+    needed_mb = context->kb_unpacked / 1024 + 20;
+    if (check_disk_space(context, (STRPTR)context->output_directory_path, (int)needed_mb) == -3)
+    {
+      log_printf(context, "\n\x1B[1mWarning:\x1B[0m About %lu MB will be extracted, more than is free on %s\n",
+                 needed_mb - 20, context->output_directory_path);
+    }
+  }
+
+  /* Without memory to sort, the archives are taken in the order they were found */
+  catalogue_sort(context->catalogue, context->num_workers > 1 ? CATALOGUE_BY_SIZE : CATALOGUE_BY_PATH);
+  for (i = 0; i < count && context->should_stop_app == 0; i++)
+  {
+    catalogue_get(context->catalogue, i, &archive);
+    catalogue_path(context->catalogue, archive.path, archive_path, sizeof(archive_path));
+    job = create_job(context, archive.archive_type, archive_path, (const char *)FilePart((CONST_STRPTR)archive_path), archive.size);
+    if (job != NULL)
+    {
+      queue_job(context, job);
+    }
+    else
+    {
+      log_printf(context, "\n\x1B[1mError:\x1B[0m Out of memory queuing %s\n", archive_path);
+    }
+  }
+}
+
+/*
+ * Reports what extracting the catalogue would do, archive by archive,
+ * from the member headers and the files already in the target folder:
+ * nothing is decoded or written.  A file is taken to be current on the
+ * same terms as member_is_current(), except that one of the right size
+ * but another date counts as overwritten, as telling would mean reading
+ * it back.  Images and tar files are written afresh, so all of every
+ * archive goes into them.
+ */
+static void plan_dry_run(struct WhdContext *context)
+{
+  struct CatalogueArchive archive;
+  struct CatalogueMember member;
+  struct FileInfoBlock *file_info_block;
+  struct DateStamp date;
+  char archive_path[256], output_path[256], member_path[256];
+  ULONG m, length, archive_bytes, kb_write = 0, bytes_write = 0, kb_needed = 0, bytes_needed = 0, kb_free;
+  LONG i, count = catalogue_count(context->catalogue), existing, files, written, overwritten;
+  LONG num_skipped = 0, num_extracted = 0, num_updated = 0, num_unlisted = 0;
+  bool compare = context->options.output_format == WHD_OUTPUT_FOLDER;
+  BPTR lock;
+
+  file_info_block = (struct FileInfoBlock *)AllocMem(sizeof(struct FileInfoBlock), MEMF_CLEAR);
+  if (file_info_block == NULL)
+  {
+    log_printf(context, "\n\x1B[1mError:\x1B[0m Out of memory planning the dry run\n");
+    return;
+  }
+
+  log_printf(context, "\n\x1B[1mDry run:\x1B[0m nothing will be extracted or written.\n\n");
+  catalogue_sort(context->catalogue, CATALOGUE_BY_PATH);
+  for (i = 0; i < count && context->should_stop_app == 0; i++)
+  {
+    if (SetSignal(0, SIGBREAKF_CTRL_C) & SIGBREAKF_CTRL_C)
+    {
+      context->should_stop_app = 1;
+      break;
+    }
+    catalogue_get(context->catalogue, i, &archive);
+    catalogue_path(context->catalogue, archive.path, archive_path, sizeof(archive_path));
+    if (archive.num_members < 0)
+    {
+      /* LZX, or headers the built-in reader could not make out */
+      log_printf(context, "Extract %s (contents not listed, %ld KB packed)\n", archive_path, (archive.size + 1023) / 1024);
+      num_extracted++;
+      num_unlisted++;
+      continue;
+    }
+
+    get_output_directory(context, archive_path, output_path);
+    length = strlen(output_path);
+    files = 0;
+    written = 0;
+    overwritten = 0;
+    archive_bytes = 0;
+    for (m = archive.first_member; m < archive.first_member + (ULONG)archive.num_members; m++)
+    {
+      catalogue_member(context->catalogue, m, &member);
+      if (strcmp(catalogue_method_name(member.method), "-lhd-") == 0)
+      {
+        continue;
+      }
+      files++;
+
+      existing = -1;
+      strcpy(member_path, output_path);
+      if (compare && catalogue_path(context->catalogue, member.path, member_path + length, sizeof(member_path) - length))
+      {
+        sanitizeAmigaPath(member_path);
+        lock = Lock((CONST_STRPTR)member_path, ACCESS_READ);
+        if (lock != 0)
+        {
+          if (Examine(lock, file_info_block) && file_info_block->fib_DirEntryType < 0)
+          {
+            existing = file_info_block->fib_Size;
+          }
+          UnLock(lock);
+        }
+      }
+      if (existing >= 0 && !context->options.force && (ULONG)existing == member.original_size)
+      {
+        get_timestamp_date(member.timestamp, &date);
+        if (CompareDates(&date, &file_info_block->fib_Date) == 0)
+        {
+          continue;
+        }
+      }
+
+      written++;
+      archive_bytes += member.original_size;
+      if (existing < 0)
+      {
+        add_kb(&kb_needed, &bytes_needed, member.original_size);
+      }
+      else
+      {
+        overwritten++;
+        if (member.original_size > (ULONG)existing)
+        {
+          add_kb(&kb_needed, &bytes_needed, member.original_size - existing);
+        }
+      }
+    }
+    add_kb(&kb_write, &bytes_write, archive_bytes);
+
+    if (written == 0)
+    {
+      log_printf(context, "Skip    %s (%ld files up to date)\n", archive_path, files);
+      num_skipped++;
+    }
+    else if (written == files)
+    {
+      log_printf(context, "Extract %s: %ld files, %lu KB, %ld overwritten\n", archive_path, files,
+                 (archive_bytes + 1023) / 1024, overwritten);
+      num_extracted++;
+    }
+    else
+    {
+      log_printf(context, "Update  %s: %ld of %ld files, %lu KB, %ld overwritten\n", archive_path, written, files,
+                 (archive_bytes + 1023) / 1024, overwritten);
+      num_updated++;
+    }
+  }
+  FreeMem(file_info_block, sizeof(struct FileInfoBlock));
+
+  kb_write += bytes_write > 0 ? 1 : 0;
+  kb_needed += bytes_needed > 0 ? 1 : 0;
+  context->kb_to_write = kb_write;
+  context->kb_needed = kb_needed;
+
+  log_printf(context, "\n\x1B[1m%ld\x1B[0m archives would be extracted, \x1B[1m%ld\x1B[0m updated and \x1B[1m%ld\x1B[0m skipped.\n",
+             num_extracted, num_updated, num_skipped);
+  log_printf(context, "\x1B[1m%lu KB\x1B[0m would be written, taking \x1B[1m%lu KB\x1B[0m more space", kb_write, kb_needed);
+  if (compare && get_free_kb(context->output_directory_path, &kb_free))
+  {
+    log_printf(context, " of the %lu KB free on %s.\n", kb_free, context->output_directory_path);
+    if (kb_needed > kb_free)
+    {
+      log_printf(context, "\x1B[1mWarning:\x1B[0m That is more than is free.\n");
+    }
+  }
+  else
+  {
+    log_printf(context, ".\n");
+  }
+  if (num_unlisted > 0)
+  {
+    log_printf(context, "The files of %ld archives could not be listed, so they are not counted.\n", num_unlisted);
+  }
+}
+
+/* Free space on the volume of a path, in KB; FALSE if it cannot be told */
+static bool get_free_kb(const char *path, ULONG *kb_free)
+{
+  struct InfoData *info;
+  BPTR lock;
+  bool known = false;
+
+  info = (struct InfoData *)AllocMem(sizeof(struct InfoData), MEMF_CLEAR);
+  if (info == NULL)
+  {
+    return false;
+  }
+  lock = Lock((CONST_STRPTR)path, ACCESS_READ);
+  if (lock != 0)
+  {
+    if (Info(lock, info) && info->id_NumBlocks >= info->id_NumBlocksUsed)
+    {
+      /* In 512 byte units first, so large volumes do not overflow */
+      *kb_free = (ULONG)(info->id_NumBlocks - info->id_NumBlocksUsed) * ((ULONG)info->id_BytesPerBlock >> 9) / 2;
+      known = true;
+    }
+    UnLock(lock);
+  }
+  FreeMem(info, sizeof(struct InfoData));
+  return known;
+}
+
+/*
+ * Starts watching a source directory with StartNotify() and returns its
+ * entry, or the existing entry if it is already watched.  Directories on
+ * file systems that cannot notify are rescanned every WATCH_POLL_SECONDS.
+ */
+static struct WatchDir *watch_directory(struct WhdContext *context, const char *path)
+{
+  struct WatchDir *watch;
+
+  for (watch = context->watch_dirs; watch != NULL; watch = watch->next)
+  {
+    if (strcmp(watch->path, path) == 0)
+    {
+      watch->scanned_time = time(NULL);
+      return watch;
+    }
+  }
+
+  watch = (struct WatchDir *)AllocVec(sizeof(struct WatchDir), MEMF_ANY | MEMF_CLEAR);
+  if (watch == NULL)
+  {
+    log_printf(context, "\n\x1B[1mError:\x1B[0m Out of memory watching %s\n", path);
+    return NULL;
+  }
+  strncpy(watch->path, path, sizeof(watch->path) - 1);
+  watch->scanned_time = time(NULL);
+
+  watch->request.nr_Name = (UBYTE *)watch->path;
+  watch->request.nr_UserData = (ULONG)watch;
+  watch->request.nr_Flags = NRF_SEND_MESSAGE | NRF_WAIT_REPLY;
+  watch->request.nr_stuff.nr_Msg.nr_Port = context->watch_port;
+  watch->notifying = StartNotify(&watch->request) ? true : false;
+  if (!watch->notifying)
+  {
+    log_printf(context, "Cannot be notified of changes to %s, it will be rescanned every %d seconds.\n", path, WATCH_POLL_SECONDS);
+  }
+
+  watch->next = context->watch_dirs;
+  context->watch_dirs = watch;
+  return watch;
+}
+
+static bool watch_directory_exists(struct WhdContext *context, const char *path)
+{
+  struct WatchDir *watch;
+
+  for (watch = context->watch_dirs; watch != NULL; watch = watch->next)
+  {
+    if (strcmp(watch->path, path) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static ULONG hash_path(const char *path)
+{
+  ULONG hash = 5381;
+
+  while (*path != '\0')
+  {
+    hash = hash * 33 + (UBYTE)*path++;
+  }
+  return hash & (SEEN_HASH_SIZE - 1);
+}
+
+static struct SeenArchive *find_seen_archive(struct WhdContext *context, const char *archive_path)
+{
+  struct SeenArchive *seen;
+
+  for (seen = context->seen_archives[hash_path(archive_path)]; seen != NULL; seen = seen->next)
+  {
+    if (strcmp(seen->path, archive_path) == 0)
+    {
+      return seen;
+    }
+  }
+  return NULL;
+}
+
+/* True if the archive has not been queued before, or has changed since */
+static bool archive_is_new(struct WhdContext *context, const char *archive_path, struct FileInfoBlock *file_info_block)
+{
+  struct SeenArchive *seen = find_seen_archive(context, archive_path);
+
+  if (seen == NULL)
+  {
+    return true;
+  }
+  return seen->size != file_info_block->fib_Size ||
+         seen->date.ds_Days != file_info_block->fib_Date.ds_Days ||
+         seen->date.ds_Minute != file_info_block->fib_Date.ds_Minute ||
+         seen->date.ds_Tick != file_info_block->fib_Date.ds_Tick;
+}
+
+/*
+ * A download in progress holds the file open for writing, so an
+ * exclusive lock is refused until the archive is complete.
+ */
+static bool archive_is_complete(const char *archive_path)
+{
+  BPTR lock = Lock((CONST_STRPTR)archive_path, EXCLUSIVE_LOCK);
+
+  if (lock == 0)
+  {
+    return false;
+  }
+  UnLock(lock);
+  return true;
+}
+
+static void remember_archive(struct WhdContext *context, const char *archive_path, struct FileInfoBlock *file_info_block)
+{
+  struct SeenArchive *seen = find_seen_archive(context, archive_path);
+  ULONG slot;
+
+  if (seen == NULL)
+  {
+    seen = (struct SeenArchive *)AllocVec(sizeof(struct SeenArchive) + strlen(archive_path) + 1, MEMF_ANY);
+    if (seen == NULL)
+    {
+      return; /* Only means an unchanged archive may be extracted again */
+    }
+    seen->path = (char *)(seen + 1);
+    strcpy(seen->path, archive_path);
+    slot = hash_path(archive_path);
+    seen->next = context->seen_archives[slot];
+    context->seen_archives[slot] = seen;
+  }
+  seen->size = file_info_block->fib_Size;
+  seen->date = file_info_block->fib_Date;
+}
+
+/*
+ * Stays resident after the first scan and extracts archives as they
+ * arrive.  A directory is rescanned once no change has been reported for
+ * WATCH_SETTLE_SECONDS, so a burst of writes causes a single rescan.
+ * Only new directories are scanned recursively; watched ones below a
+ * changed directory are left for their own notifications.
+ */
+static void watch_for_changes(struct WhdContext *context)
+{
+  struct NotifyMessage *message;
+  struct WatchDir *watch, **link;
+  long now;
+
+  log_printf(context, "Watching \x1B[1m%s\x1B[0m for new archives.  Press Ctrl-C to stop.\n", context->input_directory_path);
+
+  while (context->should_stop_app == 0)
+  {
+    Delay(TICKS_PER_SECOND);
+    if (SetSignal(0, SIGBREAKF_CTRL_C) & SIGBREAKF_CTRL_C)
+    {
+      break;
+    }
+
+    collect_results(context);
+
+    now = time(NULL);
+    while ((message = (struct NotifyMessage *)GetMsg(context->watch_port)) != NULL)
+    {
+      watch = (struct WatchDir *)message->nm_NReq->nr_UserData;
+      watch->changed_time = now;
+      ReplyMsg((struct Message *)message);
+    }
+
+    link = &context->watch_dirs;
+    while ((watch = *link) != NULL && context->should_stop_app == 0)
+    {
+      if (!watch->notifying && now - watch->scanned_time >= WATCH_POLL_SECONDS)
+      {
+        watch->changed_time = watch->scanned_time = now;
+      }
+      if (watch->changed_time == 0 || now - watch->changed_time < WATCH_SETTLE_SECONDS)
+      {
+        link = &watch->next;
+        continue;
+      }
+
+      watch->changed_time = 0;
+      if (!does_folder_exists(watch->path))
+      {
+        /* Deleted; its parent's rescan will find it if it comes back */
+        *link = watch->next;
+        if (watch->notifying)
+        {
+          EndNotify(&watch->request);
+        }
+        FreeVec(watch);
+        continue;
+      }
+
+      /* New directories are added at the head, so this entry stays put */
+      get_directory_contents(context, watch->path);
+      link = &watch->next;
+    }
+  }
+
+  log_printf(context, "Stopped watching %s\n", context->input_directory_path);
+}
+
+static void stop_watching(struct WhdContext *context)
+{
+  struct WatchDir *watch;
+  struct SeenArchive *seen;
+  struct Message *message;
+  int i;
+
+  for (watch = context->watch_dirs; watch != NULL; watch = watch->next)
+  {
+    if (watch->notifying)
+    {
+      EndNotify(&watch->request);
+    }
+  }
+  if (context->watch_port != NULL)
+  {
+    while ((message = GetMsg(context->watch_port)) != NULL)
+    {
+      ReplyMsg(message);
+    }
+    DeleteMsgPort(context->watch_port);
+    context->watch_port = NULL;
+  }
+
+  while ((watch = context->watch_dirs) != NULL)
+  {
+    context->watch_dirs = watch->next;
+    FreeVec(watch);
+  }
+  for (i = 0; i < SEEN_HASH_SIZE; i++)
+  {
+    while ((seen = context->seen_archives[i]) != NULL)
+    {
+      context->seen_archives[i] = seen->next;
+      FreeVec(seen);
+    }
+  }
+}
+
+/*
+ * Creates a whole-archive job.  The destination directory mirrors the
+ * archive's location below the source folder.
+ */
+static struct ArchiveJob *create_job(struct WhdContext *context, int archive_type, const char *archive_path, const char *archive_name, LONG archive_size)
+{
+  struct ArchiveJob *job;
+
+  job = (struct ArchiveJob *)AllocVec(sizeof(struct ArchiveJob), MEMF_ANY | MEMF_CLEAR);
+  if (job == NULL)
+  {
+    return NULL;
+  }
+
+  job->job_type = JOB_ARCHIVE;
+  job->archive_type = archive_type;
+  job->archive_size = archive_size;
+  job->progress_bytes = archive_size;
+  strncpy(job->archive_name, archive_name, sizeof(job->archive_name) - 1);
+  strncpy(job->archive_path, archive_path, sizeof(job->archive_path) - 1);
+  get_output_directory(context, archive_path, job->output_path);
+
+  return job;
+}
+
+/* The directory an archive is extracted to, ending in '/'; output_path holds 256 characters */
+static void get_output_directory(struct WhdContext *context, const char *archive_path, char *output_path)
+{
+  char *relative_path, *path;
+
+  output_path[0] = '\0';
+  relative_path = get_file_path(remove_text((char *)archive_path, context->input_file_path));
+  if (context->sink.handle != NULL)
+  {
+    /* Paths inside the sink are relative to its root */
+    path = relative_path != NULL ? relative_path : "";
+    while (*path == '/')
+    {
+      path++;
+    }
+    strncpy(output_path, path, 255);
+    output_path[255] = '\0';
+  }
+  else
+  {
+    sprintf(output_path, "%s/%s", context->output_directory_path, relative_path != NULL ? relative_path : "");
+  }
+  sanitizeAmigaPath(output_path);
+  free(relative_path);
+}
+
+static void free_job(struct WhdContext *context, struct ArchiveJob *job)
+{
+  if (job->member_args != NULL)
+  {
+    FreeVec(job->member_args);
+  }
+  if (job->member_set != NULL)
+  {
+    release_member_set(context, job);
+  }
+  FreeVec(job);
+}
+
+/*
+ * Memory a job holds from when it is queued until it comes back: its
+ * record and, if the archive is read by the built-in decoder, the
+ * read-ahead buffers.
+ */
+static ULONG job_cost(struct WhdContext *context, struct ArchiveJob *job)
+{
+  ULONG cost = sizeof(struct ArchiveJob);
+
+  if ((job->job_type == JOB_ARCHIVE && job->archive_type == ARCHIVE_LHA && context->use_native_lha) ||
+      (job->job_type == JOB_MEMBERS && job->member_args == NULL))
+  {
+    cost += context->read_buffer_size;
+  }
+  return cost;
+}
+
+/*
+ * Makes a job's reply, once a worker has run it, go back to the main
+ * process, and charges it to the queue budget.  The caller has already
+ * counted it in pending_jobs.
+ */
+static void address_job(struct WhdContext *context, struct ArchiveJob *job)
+{
+  memset(&job->message, 0, sizeof(struct Message));
+  job->message.mn_ReplyPort = context->result_port;
+  job->message.mn_Length = sizeof(struct ArchiveJob);
+  job->queue_cost = job_cost(context, job);
+
+  ObtainSemaphore(&context->pool_lock);
+  context->queued_bytes += job->queue_cost;
+  if (context->pending_jobs > context->max_queue_depth)
+  {
+    context->max_queue_depth = context->pending_jobs;
+  }
+  ReleaseSemaphore(&context->pool_lock);
+}
+
+/* True if a job costing cost would take the queue over its budget; one job may always go */
+static bool queue_is_full(struct WhdContext *context, ULONG cost)
+{
+  bool full;
+
+  ObtainSemaphore(&context->pool_lock);
+  full = context->queue_budget != 0 && context->pending_jobs > 0 &&
+         context->queued_bytes + cost > context->queue_budget;
+  ReleaseSemaphore(&context->pool_lock);
+  return full;
+}
+
+/* Counts a job queued by address_job() as done and gives back its share of the budget */
+static void unqueue_job(struct WhdContext *context, struct ArchiveJob *job)
+{
+  ObtainSemaphore(&context->pool_lock);
+  context->pending_jobs--;
+  context->queued_bytes -= job->queue_cost;
+  ReleaseSemaphore(&context->pool_lock);
+}
+
+/*
+ * Hands a job to the worker pool, or runs it straight away when there is
+ * only one worker.  Jobs are spread round-robin over the workers' own
+ * deques so no single queue head is shared by every worker.
+ */
+static void queue_job(struct WhdContext *context, struct ArchiveJob *job)
+{
+  struct DateStamp stall_start;
+  ULONG cost;
+  int target;
+
+  if (context->num_workers <= 1)
+  {
+    run_job(context, job, NULL);
+    free_job(context, job);
+    return;
+  }
+
+  /*
+   * Free the jobs already run while the scan goes on, and wait for some
+   * to come back while the queue is over its budget.  Workers queueing
+   * parts of an archive never wait, so they cannot hold each other up.
+   */
+  if (FindTask(NULL) == context->main_task)
+  {
+    collect_results(context);
+    cost = job_cost(context, job);
+    if (queue_is_full(context, cost))
+    {
+      DateStamp(&stall_start);
+      while (queue_is_full(context, cost) && context->should_stop_app == 0)
+      {
+        /* A finished job can take long to come back, so Ctrl-C is heard while waiting */
+        if (Wait((1UL << context->result_port->mp_SigBit) | SIGBREAKF_CTRL_C) & SIGBREAKF_CTRL_C)
+        {
+          context->should_stop_app = 1;
+        }
+        collect_results(context);
+      }
+      context->stall_ticks += ticks_since(&stall_start);
+    }
+  }
+
+  ObtainSemaphore(&context->pool_lock);
+  context->pending_jobs++;
+  target = context->next_deque;
+  context->next_deque = (context->next_deque + 1) % context->num_workers;
+  ReleaseSemaphore(&context->pool_lock);
+
+  address_job(context, job);
+  if (deque_push(&context->workers[target].deque, job))
+  {
+    wake_workers(context);
+  }
+  else
+  {
+    /* No memory to grow the deque, so do the work on the scanner */
+    run_job(context, job, NULL);
+    unqueue_job(context, job);
+    free_job(context, job);
+  }
+}
+
+static void run_job(struct WhdContext *context, struct ArchiveJob *job, struct Worker *worker)
+{
+  if (context->should_stop_app != 0)
+  {
+    return;
+  }
+
+  if (job->job_type == JOB_INVENTORY)
+  {
+    inventory_directory(context, job->archive_path, false);
+  }
+  else if (job->job_type == JOB_MEMBERS && job->member_args == NULL)
+  {
+    extract_member_range(context, job);
+  }
+  else if (job->job_type == JOB_MEMBERS)
+  {
+    run_extraction(context, job, "lha", "-T -M -N -m x");
+  }
+  else
+  {
+    extract_archive(context, job, worker);
+  }
+
+  /* Whatever was not counted member by member, including headers and archives that failed */
+  add_progress(context, job, job->progress_bytes, 0);
+}
+
+static void extract_archive(struct WhdContext *context, struct ArchiveJob *job, struct Worker *worker)
+{
+  char ExtractCommand[20];
+  char program_name[6];
+
+  log_printf(context, "Extracting \x1B[1m%s\x1B[0m to \x1B[1m%s\x1B[0m\n", job->archive_name, job->output_path);
+  report_progress(context, WHD_PROGRESS_ARCHIVE, job->archive_path, NULL);
+  if (context->sink.handle != NULL)
+  {
+    /* lha and unlzx can only write to a file system */
+    if (job->archive_type != ARCHIVE_LHA || !extract_archive_native(context, job, worker))
+    {
+      log_event(context, WHD_ERROR_UNKNOWN, job->archive_path, NULL, 0, "not extracted. Only archives the built-in decoder supports can be written to an image or tar file");
+    }
+    return;
+  }
+  if (job->archive_type == ARCHIVE_LHA)
+  {
+    if (context->use_native_lha && extract_archive_native(context, job, worker))
+    {
+      return;
+    }
+    if (!context->lha_available)
+    {
+      log_event(context, WHD_ERROR_MISSING_TOOL, job->archive_path, NULL, 0, "not extracted. c:lha is not installed");
+      return;
+    }
+
+    strcpy(program_name, "lha");
+    if (context->test_archives_only)
+    {
+      strcpy(ExtractCommand, "t");
+    }
+    else
+    {
+      if (context->resetProtectionBits == 1)
+      {
+        prepare_protected_files(context, job);
+      }
+      strcpy(ExtractCommand, "-T -M -N -m x");
+
+      if (split_archive(context, job, worker))
+      {
+        return; /* The members are now queued as separate jobs */
+      }
+    }
+  }
+  else
+  {
+    if (!context->unlzx_available)
+    {
+      log_event(context, WHD_ERROR_MISSING_TOOL, job->archive_path, NULL, 0, "not extracted. c:unlzx is not installed");
+      return;
+    }
+    strcpy(program_name, "unlzx");
+    if (context->test_archives_only)
+    {
+      strcpy(ExtractCommand, "-v");
+    }
+    else
+    {
+      strcpy(ExtractCommand, "-x");
+    }
+  }
+
+  run_extraction(context, job, program_name, ExtractCommand);
+}
+
+/*
+ * If the archive's top level directory already exists in the target,
+ * clears the protection bits of its files so lha can replace them.
+ */
+static void prepare_protected_files(struct WhdContext *context, struct ArchiveJob *job)
+{
+  char listing_path[40];
+  char directoryName[256];
+  char command[640];
+
+  /* Each process gets its own listing file */
+  sprintf(listing_path, "ram:listing_%lx.txt", (ULONG)FindTask(NULL));
+
+  sprintf(command, "lha vq \"%s\" >%s", job->archive_path, listing_path);
+  sanitizeAmigaPath(command);
+  SystemTagList(command, NULL);
+  if (findFirstDirectory(context, listing_path, directoryName) != NULL)
+  {
+    sprintf(command, "%s/%s", job->output_path, directoryName);
+    sanitizeAmigaPath(command);
+    if (does_folder_exists(command) == 1)
+    {
+      sprintf(command, "protect %s/%s/#? ALL rwed >NIL:", job->output_path, directoryName);
+      sanitizeAmigaPath(command);
+      log_printf(context, "Prepping any protected files for potential replacement...\n");
+      SystemTagList(command, NULL);
+    }
+  }
+  else
+  {
+    log_printf(context, "Unable to get the file path from the LHA output for file %s.\n", job->archive_path);
+  }
+  DeleteFile(listing_path);
+}
+
+/*
+ * Appends a member name to an lha command line, quoted, with AmigaDOS
+ * pattern characters escaped so the name only matches itself.
+ */
+static void append_member_arg(char *args, const char *member_path)
+{
+  char *out = args + strlen(args);
+
+  if (out != args)
+  {
+    *out++ = ' ';
+  }
+  *out++ = '"';
+  while (*member_path != '\0')
+  {
+    if (strchr("#?()|~[]%'*", *member_path) != NULL)
+    {
+      *out++ = '\'';
+    }
+    *out++ = *member_path++;
+  }
+  *out++ = '"';
+  *out = '\0';
+}
+
+/*
+ * Splits a large LHA archive into jobs that each extract a group of its
+ * members, and pushes them onto the worker's own deque where idle
+ * workers can steal them.  LHA members are compressed independently, so
+ * the groups can be extracted at the same time.  Returns false when the
+ * archive should be extracted as a whole.
+ */
+static bool split_archive(struct WhdContext *context, struct ArchiveJob *job, struct Worker *worker)
+{
+  struct LhaMember *members;
+  struct ArchiveJob *part_job;
+  struct ArchiveJob *parts[WHD_MAX_WORKERS * 2];
+  struct MemberSet *member_set = NULL;
+  LONG num_members, i;
+  ULONG total_packed = 0, part_target, part_packed = 0;
+  int num_parts = 0, p;
+  bool split = false;
+
+  if (worker == NULL || context->num_workers <= 1 || job->archive_size < context->split_size_kb * 1024)
+  {
+    return false;
+  }
+  if (lha_read_members((CONST_STRPTR)job->archive_path, &members, &num_members) != LHA_OK)
+  {
+    return false; /* Let lha report the problem */
+  }
+
+  for (i = 0; i < num_members; i++)
+  {
+    total_packed += members[i].packed_size;
+  }
+  part_target = total_packed / (context->num_workers * 2);
+  if (part_target < MIN_PART_SIZE)
+  {
+    part_target = MIN_PART_SIZE;
+  }
+
+  part_job = NULL;
+  for (i = 0; i < num_members; i++)
+  {
+    if (members[i].is_directory)
+    {
+      continue; /* lha creates directories as it extracts their files */
+    }
+    if (part_job != NULL && (part_packed >= part_target || strlen(part_job->member_args) + strlen(members[i].path) * 2 + 4 > MAX_MEMBER_ARGS))
+    {
+      part_job = NULL;
+    }
+    if (part_job == NULL)
+    {
+      if (num_parts == WHD_MAX_WORKERS * 2)
+      {
+        break;
+      }
+      part_job = (struct ArchiveJob *)AllocVec(sizeof(struct ArchiveJob), MEMF_ANY);
+      if (part_job != NULL)
+      {
+        memcpy(part_job, job, sizeof(struct ArchiveJob));
+        part_job->member_args = (STRPTR)AllocVec(MAX_MEMBER_ARGS + LHA_MAX_PATH * 2 + 4, MEMF_ANY | MEMF_CLEAR);
+        if (part_job->member_args == NULL)
+        {
+          FreeVec(part_job);
+          part_job = NULL;
+        }
+      }
+      if (part_job == NULL)
+      {
+        break;
+      }
+      part_job->job_type = JOB_MEMBERS;
+      part_job->progress_bytes = 0;
+      parts[num_parts++] = part_job;
+      part_packed = 0;
+    }
+    append_member_arg(part_job->member_args, members[i].path);
+    part_packed += members[i].packed_size;
+    part_job->progress_bytes += members[i].packed_size;
+  }
+
+  /* Only split when every member found a part and there is more than one */
+  if (i == num_members && num_parts > 1)
+  {
+    member_set = (struct MemberSet *)AllocVec(sizeof(struct MemberSet), MEMF_ANY | MEMF_CLEAR);
+  }
+  if (member_set != NULL)
+  {
+    member_set->refcount = num_parts;
+    ObtainSemaphore(&context->pool_lock);
+    context->pending_jobs += num_parts;
+    ReleaseSemaphore(&context->pool_lock);
+
+    for (p = 0; p < num_parts; p++)
+    {
+      /* The archive's own job keeps only the headers to count */
+      job->progress_bytes -= parts[p]->progress_bytes;
+    }
+    for (p = 0; p < num_parts; p++)
+    {
+      parts[p]->part = p + 1;
+      parts[p]->num_parts = num_parts;
+      parts[p]->member_set = member_set;
+      address_job(context, parts[p]);
+      if (!deque_push(&worker->deque, parts[p]))
+      {
+        run_job(context, parts[p], worker);
+        unqueue_job(context, parts[p]);
+        free_job(context, parts[p]);
+      }
+    }
+    log_printf(context, "Split \x1B[1m%s\x1B[0m into %d member jobs\n", job->archive_name, num_parts);
+    wake_workers(context);
+    split = true;
+  }
+  else
+  {
+    for (p = 0; p < num_parts; p++)
+    {
+      free_job(context, parts[p]);
+    }
+  }
+
+  lha_free_members(members);
+  return split;
+}
+
+/*
+ * Checks for disk space before extracting, when enabled.  Stops the run
+ * if the target drive is too full.
+ */
+static bool has_disk_space(struct WhdContext *context, const char *archive_path)
+{
+  if (context->skip_disk_space_check == false)
+  {
+    int disk_check_result = check_disk_space(context, context->output_directory_path, 20);
+    if (disk_check_result < 0)
+    {
+      /* To do: handle various error cases based
+         on the result code */
+      log_printf(context,
+          "\x1B[1mError:\x1B[0m Not enough "
+          "space on the target drive or cannot "
+          "check space.\n20MB minimum checked "
+          "for.  To disable this check, launch "
+          "the program\nwithout the "
+          "'-enablediskcheck' command.\n");
+      log_event(context, WHD_ERROR_SPACE, archive_path, NULL, 0, "not extracted. Not enough space on the target drive");
+      context->should_stop_app = 1;
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Runs lha or unlzx for a job and records any failure in the error log.
+ */
+static void run_extraction(struct WhdContext *context, struct ArchiveJob *job, const char *program_name, const char *options)
+{
+  char error_message[64];
+  char part_text[32];
+  char *extraction_command;
+  ULONG command_size;
+  LONG command_result;
+
+  if (!has_disk_space(context, job->archive_path))
+  {
+    finish_part(context, job, false);
+    return;
+  }
+
+  part_text[0] = '\0';
+  if (job->job_type == JOB_MEMBERS)
+  {
+    sprintf(part_text, " (part %d of %d)", job->part, job->num_parts);
+  }
+
+  ObtainSemaphore(&context->pool_lock);
+  if (job->part <= 1)
+  {
+    context->num_archives_found++;
+  }
+  ReleaseSemaphore(&context->pool_lock);
+
+  /* Combine the extraction command, source path, output path and any members */
+  command_size = strlen(program_name) + strlen(options) + strlen(job->archive_path) + strlen(job->output_path) + 16;
+  if (job->member_args != NULL)
+  {
+    command_size += strlen(job->member_args);
+  }
+  extraction_command = (char *)AllocVec(command_size, MEMF_ANY);
+  if (extraction_command == NULL)
+  {
+    sprintf(error_message, "failed to extract. Out of memory%s", part_text);
+    log_event(context, WHD_ERROR_MEMORY, job->archive_path, NULL, 0, error_message);
+    finish_part(context, job, false);
+    return;
+  }
+  sprintf(extraction_command, "%s %s \"%s\" \"%s\"%s%s", program_name, options, job->archive_path, job->output_path,
+          job->member_args != NULL ? " " : "", job->member_args != NULL ? (char *)job->member_args : "");
+
+  /* Execute the command*/
+  command_result = SystemTagList(extraction_command, NULL);
+  FreeVec(extraction_command);
+
+  /* Check for error */
+  finish_part(context, job, command_result == 0);
+  if (command_result == 10)
+  {
+    log_printf(context,
+        "\n\x1B[1mError:\x1B[0m "
+        "Corrupt archive %s%s\n",
+        job->archive_path, part_text);
+    sprintf(error_message, "is corrupt%s", part_text);
+    log_event(context, WHD_ERROR_CORRUPT, job->archive_path, NULL, command_result, error_message);
+  }
+  else if (command_result != 0)
+  {
+    log_printf(context,
+        "\n\x1B[1mError:\x1B[0m "
+        "Failed to execute command "
+        "%s for file %s%s.\nPlease "
+        "check the archive is not "
+        "damaged, and there is "
+        "enough space in the\ntarget "
+        "directory.\n",
+        program_name, job->archive_path, part_text);
+    if (command_result < 0)
+    {
+      /* SystemTagList() could not run the command at all */
+      sprintf(error_message, "failed to extract. Could not run %s%s", program_name, part_text);
+      log_event(context, WHD_ERROR_MISSING_TOOL, job->archive_path, NULL, command_result, error_message);
+    }
+    else
+    {
+      sprintf(error_message, "failed to extract. Unknown error%s", part_text);
+      log_event(context, WHD_ERROR_UNKNOWN, job->archive_path, NULL, command_result, error_message);
+    }
+  }
+}
+
+static LONG read_archive(APTR handle, UBYTE *buffer, LONG length)
+{
+  return Read((BPTR)handle, buffer, length);
+}
+
+/* Passes decoded data to the caller's member_data callback */
+static LONG stream_member(APTR handle, const UBYTE *data, LONG length)
+{
+  struct MemberStream *stream = (struct MemberStream *)handle;
+
+  if (stream->context->options.member_data == NULL)
+  {
+    return length;
+  }
+  return stream->context->options.member_data(stream->context->options.user_data, stream->member_handle, data, length);
+}
+
+static LONG read_hashed(APTR handle, UBYTE *buffer, LONG length)
+{
+  struct HashedRead *hashed = (struct HashedRead *)handle;
+  LONG count = async_read(hashed->file, buffer, length);
+
+  if (count > 0)
+  {
+    hashed->hash = cache_hash(hashed->hash, buffer, count);
+  }
+  return count;
+}
+
+static LONG read_and_copy(APTR handle, UBYTE *buffer, LONG length)
+{
+  struct CopyStream *copy = (struct CopyStream *)handle;
+  LONG count = Read(copy->source, buffer, length);
+
+  if (count > 0 && Write(copy->destination, buffer, count) != count)
+  {
+    return -1;
+  }
+  return count;
+}
+
+/* Used when testing archives: the data is decoded and its CRC checked */
+static LONG discard_member(APTR handle, const UBYTE *data, LONG length)
+{
+  return length;
+}
+
+/* Drops a job's hold on its member set; the last job to let go reports the archive */
+static void release_member_set(struct WhdContext *context, struct ArchiveJob *job)
+{
+  struct MemberSet *member_set = job->member_set;
+  LONG refcount;
+
+  ObtainSemaphore(&context->pool_lock);
+  refcount = --member_set->refcount;
+  ReleaseSemaphore(&context->pool_lock);
+
+  if (refcount == 0)
+  {
+    if (member_set->failed_parts == 0 && context->should_stop_app == 0)
+    {
+      report_extracted(context, job, "");
+    }
+    lha_free_members(member_set->members);
+    FreeVec(member_set);
+  }
+}
+
+/*
+ * Creates every missing directory along a path.  last_created holds the
+ * last directory made for this archive so runs of members in the same
+ * directory do not Lock() it again.
+ */
+static void create_directory_path(const char *path, char *last_created)
+{
+  char partial[256];
+  ULONG length = strlen(path);
+  ULONG i;
+  BPTR lock;
+
+  if (length == 0 || length >= sizeof(partial))
+  {
+    return;
+  }
+  if (strncmp(last_created, path, length) == 0 && (last_created[length] == '\0' || last_created[length] == '/'))
+  {
+    return;
+  }
+
+  strcpy(partial, path);
+  for (i = 1; i <= length; i++)
+  {
+    if (partial[i] == '/' || partial[i] == '\0')
+    {
+      if (partial[i - 1] == ':' || partial[i - 1] == '/')
+      {
+        continue;
+      }
+      partial[i] = '\0';
+      lock = Lock((CONST_STRPTR)partial, ACCESS_READ);
+      if (lock == 0)
+      {
+        lock = CreateDir((CONST_STRPTR)partial);
+      }
+      if (lock != 0)
+      {
+        UnLock(lock);
+      }
+      partial[i] = path[i];
+    }
+  }
+  strcpy(last_created, path);
+}
+
+/*
+ * Forms the path a member is extracted to, below its job's destination.
+ * Returns false, leaving path unset, if it does not fit in size bytes.
+ */
+static bool member_output_path(struct ArchiveJob *job, const struct LhaMember *member, char *path, ULONG size)
+{
+  if (strlen(job->output_path) + strlen(member->path) >= size)
+  {
+    return false;
+  }
+  sprintf(path, "%s%s", job->output_path, member->path);
+  return true;
+}
+
+/*
+ * Creates the directory a member is extracted into, or the member itself
+ * if it is a directory, in the target folder or the sink.  last_created
+ * is as for create_directory_path().  A member whose path is too long is
+ * left to be reported when it is extracted.
+ */
+static void make_member_directory(struct WhdContext *context, struct ArchiveJob *job, const struct LhaMember *member,
+                                  char *last_created)
+{
+  char directory[256];
+  char *slash;
+
+  if (!member_output_path(job, member, directory, sizeof(directory)))
+  {
+    return;
+  }
+  if (context->sink.handle == NULL)
+  {
+    sanitizeAmigaPath(directory);
+  }
+  if (!member->is_directory)
+  {
+    slash = strrchr(directory, '/');
+    if (slash == NULL)
+    {
+      return;
+    }
+    *slash = '\0';
+  }
+
+  if (context->sink.handle == NULL)
+  {
+    create_directory_path(directory, last_created);
+  }
+  else if (context->sink.make_directory(context->sink.handle, directory) != SINK_OK)
+  {
+    log_event(context, WHD_ERROR_IO, job->archive_path, member->path, 0, "failed to create directory");
+  }
+}
+
+/*
+ * Extracts an LHA archive with the built-in decoder.  The directories
+ * are created first, in archive order, and then the members are decoded.
+ * With several workers a large archive is split into ranges of members
+ * that idle workers steal and decode at the same time.  Returns false,
+ * before doing any work, if lha has to handle the archive instead.
+ */
+static bool extract_archive_native(struct WhdContext *context, struct ArchiveJob *job, struct Worker *worker)
+{
+  struct MemberSet *member_set;
+  struct ArchiveJob *part_job;
+  struct LhaMember *members;
+  char last_created[256];
+  LONG num_members, i, first;
+  ULONG total_packed = 0, part_target, part_packed;
+  int num_parts = 0;
+
+  if (lha_read_members((CONST_STRPTR)job->archive_path, &members, &num_members) != LHA_OK)
+  {
+    return false; /* Let lha report the problem */
+  }
+  for (i = 0; i < num_members; i++)
+  {
+    if (!lha_method_supported(members[i].method))
+    {
+      lha_free_members(members);
+      return false;
+    }
+    total_packed += members[i].packed_size;
+  }
+
+  member_set = (struct MemberSet *)AllocVec(sizeof(struct MemberSet), MEMF_ANY | MEMF_CLEAR);
+  if (member_set == NULL)
+  {
+    lha_free_members(members);
+    return false;
+  }
+  member_set->refcount = 1;
+  member_set->members = members;
+  member_set->num_members = num_members;
+  job->member_set = member_set;
+
+  if (!has_disk_space(context, job->archive_path))
+  {
+    member_set->failed_parts++;
+    return true;
+  }
+
+  ObtainSemaphore(&context->pool_lock);
+  context->num_archives_found++;
+  ReleaseSemaphore(&context->pool_lock);
+
+  /* Create the directories up front so they appear in archive order */
+  if (!context->test_archives_only)
+  {
+    last_created[0] = '\0';
+    if (context->sink.handle == NULL)
+    {
+      create_directory_path(job->output_path, last_created);
+    }
+    for (i = 0; i < num_members; i++)
+    {
+      /* Members naming a device are skipped as they are extracted */
+      if (strchr(members[i].path, ':') == NULL)
+      {
+        make_member_directory(context, job, &members[i], last_created);
+      }
+    }
+  }
+
+  job->first_member = 0;
+  job->last_member = num_members;
+
+  if (worker == NULL || context->num_workers <= 1 || job->archive_size < context->split_size_kb * 1024)
+  {
+    extract_member_range(context, job);
+    return true;
+  }
+
+  /* Hand out ranges of members for idle workers to steal */
+  part_target = total_packed / (context->num_workers * 2);
+  if (part_target < MIN_PART_SIZE)
+  {
+    part_target = MIN_PART_SIZE;
+  }
+
+  first = 0;
+  part_packed = 0;
+  for (i = 0; i < num_members; i++)
+  {
+    part_packed += members[i].packed_size;
+    if (part_packed < part_target && i + 1 < num_members)
+    {
+      continue;
+    }
+
+    part_job = (struct ArchiveJob *)AllocVec(sizeof(struct ArchiveJob), MEMF_ANY);
+    if (part_job == NULL)
+    {
+      break; /* This worker decodes what is left itself */
+    }
+    memcpy(part_job, job, sizeof(struct ArchiveJob));
+    part_job->job_type = JOB_MEMBERS;
+    part_job->member_args = NULL;
+    part_job->first_member = first;
+    part_job->last_member = i + 1;
+    part_job->part = ++num_parts;
+    part_job->progress_bytes = part_packed;
+
+    ObtainSemaphore(&context->pool_lock);
+    member_set->refcount++;
+    context->pending_jobs++;
+    ReleaseSemaphore(&context->pool_lock);
+
+    address_job(context, part_job);
+    if (!deque_push(&worker->deque, part_job))
+    {
+      unqueue_job(context, part_job);
+      num_parts--;
+      free_job(context, part_job);
+      break;
+    }
+    job->progress_bytes -= part_packed;
+
+    first = i + 1;
+    part_packed = 0;
+  }
+
+  if (num_parts > 1)
+  {
+    log_printf(context, "Split \x1B[1m%s\x1B[0m into %d member jobs\n", job->archive_name, num_parts);
+  }
+  wake_workers(context);
+
+  /* Anything not queued is decoded here */
+  if (first < num_members)
+  {
+    job->first_member = first;
+    job->last_member = num_members;
+    extract_member_range(context, job);
+  }
+  return true;
+}
+
+static void get_timestamp_date(ULONG timestamp, struct DateStamp *date)
+{
+  date->ds_Days = timestamp / 86400;
+  date->ds_Minute = (timestamp % 86400) / 60;
+  date->ds_Tick = (timestamp % 60) * TICKS_PER_SECOND;
+}
+
+/*
+ * Compares a member with the file it would be extracted to, before any
+ * decoding.  A file of the same size and date is taken to be current.
+ * If only the date differs the file is read back and its CRC compared,
+ * as an updated archive usually carries most of its members unchanged.
+ * Returns true if the file already holds the member's data, after
+ * bringing its date, protection bits and comment up to date.
+ */
+static bool member_is_current(struct LhaDecoder *decoder, const struct LhaMember *member, const char *path, struct FileInfoBlock *file_info_block)
+{
+  struct DateStamp date;
+  BPTR lock, file;
+  ULONG protection;
+  UWORD crc;
+  bool current, same_date;
+
+  if (file_info_block == NULL)
+  {
+    return false;
+  }
+  lock = Lock((CONST_STRPTR)path, ACCESS_READ);
+  if (lock == 0)
+  {
+    return false;
+  }
+  if (!Examine(lock, file_info_block) || file_info_block->fib_DirEntryType >= 0 ||
+      (ULONG)file_info_block->fib_Size != member->original_size)
+  {
+    UnLock(lock);
+    return false;
+  }
+
+  get_timestamp_date(member->timestamp, &date);
+  same_date = CompareDates(&date, &file_info_block->fib_Date) == 0;
+  current = same_date;
+  if (!same_date)
+  {
+    file = OpenFromLock(lock);
+    if (file != 0)
+    {
+      lock = 0; /* Now owned by the file handle */
+      current = lha_compute_crc(decoder, read_archive, (APTR)file, member->original_size, &crc) == LHA_OK &&
+                crc == member->crc;
+      Close(file);
+    }
+  }
+  if (lock != 0)
+  {
+    UnLock(lock);
+  }
+  if (!current)
+  {
+    return false;
+  }
+
+  /* Same metadata a fresh extraction would leave behind */
+  if (!same_date)
+  {
+    SetFileDate((CONST_STRPTR)path, &date);
+  }
+  protection = member->os_id == 'A' ? member->attributes : 0;
+  if ((ULONG)file_info_block->fib_Protection != protection)
+  {
+    SetProtection((CONST_STRPTR)path, protection);
+  }
+  if (strcmp(file_info_block->fib_Comment, member->comment) != 0)
+  {
+    SetComment((CONST_STRPTR)path, (CONST_STRPTR)member->comment);
+  }
+  return true;
+}
+
+static void restore_member_metadata(const struct LhaMember *member, const char *path)
+{
+  struct DateStamp date;
+
+  get_timestamp_date(member->timestamp, &date);
+  SetFileDate((CONST_STRPTR)path, &date);
+  if (member->os_id == 'A')
+  {
+    SetProtection((CONST_STRPTR)path, member->attributes);
+  }
+  if (member->comment[0] != '\0')
+  {
+    SetComment((CONST_STRPTR)path, (CONST_STRPTR)member->comment);
+  }
+}
+
+/*
+ * Looks for the member in the cache and, if a file holding its data is
+ * known, copies that file instead of decoding.  The compressed data is
+ * only hashed when an entry with the same method, sizes and CRC exists;
+ * the hash is passed back so it is not computed twice.  The copy is
+ * checked against the member's CRC, so a cached file that has since
+ * been changed is never used.  The archive is left at the member's data.
+ */
+static bool copy_cached_member(struct WhdContext *context, struct LhaDecoder *decoder, struct AsyncFile *archive,
+                               const struct LhaMember *member, const char *path, ULONG *hash, bool *hash_known)
+{
+  struct CopyStream copy;
+  char source_path[512];
+  UBYTE *buffer;
+  BPTR source_lock, destination_lock;
+  ULONG left, count;
+  LONG count_read, result;
+  UWORD crc;
+  bool same_file;
+
+  if (!cache_may_contain(context->cache, member))
+  {
+    return false;
+  }
+
+  buffer = (UBYTE *)AllocVec(context->hash_buffer_size, MEMF_ANY);
+  if (buffer == NULL)
+  {
+    return false;
+  }
+  *hash = CACHE_HASH_INIT;
+  for (left = member->packed_size; left > 0; left -= count_read)
+  {
+    count = left < context->hash_buffer_size ? left : context->hash_buffer_size;
+    count_read = async_read(archive, buffer, count);
+    if (count_read <= 0)
+    {
+      break;
+    }
+    *hash = cache_hash(*hash, buffer, count_read);
+  }
+  FreeVec(buffer);
+  async_seek(archive, member->data_offset);
+  if (left > 0)
+  {
+    return false;
+  }
+  *hash_known = true;
+
+  if (!cache_lookup(context->cache, member, *hash, source_path, sizeof(source_path)))
+  {
+    return false;
+  }
+  source_lock = Lock((CONST_STRPTR)source_path, ACCESS_READ);
+  if (source_lock == 0)
+  {
+    cache_remove(context->cache, member, *hash);
+    return false;
+  }
+
+  /* The destination may be the cached file itself, which was changed */
+  destination_lock = Lock((CONST_STRPTR)path, ACCESS_READ);
+  if (destination_lock != 0)
+  {
+    same_file = SameLock(source_lock, destination_lock) == LOCK_SAME;
+    UnLock(destination_lock);
+    if (same_file)
+    {
+      UnLock(source_lock);
+      return false;
+    }
+  }
+
+  copy.source = OpenFromLock(source_lock);
+  if (copy.source == 0)
+  {
+    UnLock(source_lock);
+    return false;
+  }
+  SetProtection((CONST_STRPTR)path, 0);
+  copy.destination = Open((CONST_STRPTR)path, MODE_NEWFILE);
+  if (copy.destination == 0)
+  {
+    Close(copy.source);
+    return false;
+  }
+  preallocate_file(copy.destination, member->original_size);
+  result = lha_compute_crc(decoder, read_and_copy, (APTR)&copy, member->original_size, &crc);
+  Close(copy.source);
+  if (!Close(copy.destination))
+  {
+    result = LHA_ERR_WRITE;
+  }
+
+  if (result != LHA_OK || crc != member->crc)
+  {
+    DeleteFile((CONST_STRPTR)path);
+    if (result == LHA_ERR_READ || crc != member->crc)
+    {
+      cache_remove(context->cache, member, *hash);
+    }
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Sets a new file to its final size before it is written, so the file
+ * system can give it one run of blocks rather than growing it a write
+ * at a time.  File systems that cannot do this let it grow as before.
+ */
+static void preallocate_file(BPTR file, ULONG size)
+{
+  if (size > PREALLOCATE_MIN_SIZE)
+  {
+    SetFileSize(file, size, OFFSET_BEGINNING);
+  }
+}
+
+/*
+ * Creates the file for a member that is decoded straight to disk.  A
+ * large member's file is preallocated and written through AsyncIO
+ * buffers sized to the member, up to max_buffer bytes in all, so the
+ * decoder's window-sized writes reach the file system in fewer and
+ * larger pieces while it goes on decoding.  A small member's file, or
+ * one without memory for buffers, is written as it is decoded.
+ */
+static struct AsyncFile *create_member_file(const char *path, ULONG size, ULONG max_buffer)
+{
+  struct AsyncFile *async;
+  BPTR file;
+  ULONG buffer_size = 0;
+
+  /* Clear any protection bits so an older copy can be replaced */
+  SetProtection((CONST_STRPTR)path, 0);
+  file = Open((CONST_STRPTR)path, MODE_NEWFILE);
+  if (file == 0)
+  {
+    return NULL;
+  }
+
+  if (size > PREALLOCATE_MIN_SIZE)
+  {
+    preallocate_file(file, size);
+    if (max_buffer >= MIN_WRITE_BUFFER)
+    {
+      buffer_size = size < max_buffer ? (size + 4095) & ~4095UL : max_buffer;
+    }
+  }
+  async = async_attach(file, ASYNC_WRITE, buffer_size, ASYNC_BUFFERS);
+  if (async == NULL)
+  {
+    Close(file);
+    DeleteFile((CONST_STRPTR)path);
+    SetIoErr(ERROR_NO_FREE_STORE);
+  }
+  return async;
+}
+
+/* Records the absolute path of a member just written to the target folder */
+static void remember_member(struct WhdContext *context, const struct LhaMember *member, ULONG hash, const char *path)
+{
+  char absolute_path[512];
+  const char *relative = path + strlen(context->output_directory_path);
+
+  if (strncmp(path, context->output_directory_path, strlen(context->output_directory_path)) != 0)
+  {
+    return;
+  }
+  while (*relative == '/')
+  {
+    relative++;
+  }
+  strcpy(absolute_path, context->target_root);
+  if (AddPart((STRPTR)absolute_path, (CONST_STRPTR)relative, sizeof(absolute_path)))
+  {
+    cache_add(context->cache, member, hash, absolute_path);
+  }
+}
+
+/*
+ * Called as a WriteBatch writes each member it held.  The member's
+ * directory is the current directory, so its name alone is enough to
+ * restore the date, protection bits and comment.
+ */
+static void finish_batched_member(APTR user_data, APTR file, ULONG hash, const char *path, LONG error)
+{
+  struct BatchedRange *range = (struct BatchedRange *)user_data;
+  struct WhdContext *context = range->context;
+  const struct LhaMember *member = (const struct LhaMember *)file;
+
+  if (error == 0)
+  {
+    restore_member_metadata(member, (const char *)FilePart((CONST_STRPTR)path));
+    if (context->cache != NULL)
+    {
+      remember_member(context, member, hash, path);
+    }
+    return;
+  }
+
+  range->errors++;
+  log_printf(context, "\n\x1B[1mError:\x1B[0m Failed to extract %s from %s\n", member->path, range->job->archive_path);
+  if (error == ERROR_DISK_FULL)
+  {
+    log_event(context, WHD_ERROR_SPACE, range->job->archive_path, member->path, 0, "failed to extract. Disk full");
+  }
+  else
+  {
+    log_event(context, WHD_ERROR_IO, range->job->archive_path, member->path, 0, "failed to extract. Write error");
+  }
+}
+
+/* Decodes a member into a new file and gives it the member's metadata; a file left incomplete is deleted */
+static LONG decode_to_file(struct WhdContext *context, struct LhaDecoder *decoder, const struct LhaMember *member,
+                           const char *path, LhaReadFunc read, APTR read_handle, LONG *io_error)
+{
+  struct AsyncFile *output;
+  LONG result;
+
+  output = create_member_file(path, member->original_size, context->write_buffer_max);
+  if (output == NULL)
+  {
+    *io_error = IoErr();
+    return LHA_ERR_WRITE;
+  }
+  result = lha_decode_member(decoder, member, read, read_handle, async_write, (APTR)output);
+  *io_error = async_close(output);
+  if (result == LHA_OK && *io_error != 0)
+  {
+    result = LHA_ERR_WRITE;
+  }
+  if (result != LHA_OK)
+  {
+    DeleteFile((CONST_STRPTR)path);
+  }
+  else
+  {
+    restore_member_metadata(member, path);
+  }
+  return result;
+}
+
+/* Decodes a member into the image or tar file */
+static LONG decode_to_sink(struct WhdContext *context, struct LhaDecoder *decoder, const struct LhaMember *member,
+                           const char *path, LhaReadFunc read, APTR read_handle, LONG *io_error)
+{
+  LONG result = LHA_ERR_WRITE, sink_result;
+
+  if (context->sink.begin_file(context->sink.handle, path, member->original_size, member->timestamp,
+                               member->os_id == 'A' ? member->attributes : 0, member->comment) == SINK_OK)
+  {
+    result = lha_decode_member(decoder, member, read, read_handle, context->sink.write_file, context->sink.handle);
+  }
+  sink_result = context->sink.end_file(context->sink.handle, result == LHA_OK);
+  if (sink_result != SINK_OK)
+  {
+    result = LHA_ERR_WRITE;
+    *io_error = sink_result == SINK_ERR_FULL ? ERROR_DISK_FULL : 0;
+  }
+  return result;
+}
+
+static void report_member_error(struct WhdContext *context, const char *archive_path, const char *member_path, LONG result,
+                                LONG io_error)
+{
+  if (result == LHA_ERR_CRC || result == LHA_ERR_FORMAT)
+  {
+    log_printf(context, "\n\x1B[1mError:\x1B[0m Corrupt archive %s (%s)\n", archive_path, member_path);
+    log_event(context, WHD_ERROR_CORRUPT, archive_path, member_path, 0, "is corrupt");
+  }
+  else
+  {
+    log_printf(context, "\n\x1B[1mError:\x1B[0m Failed to extract %s from %s\n", member_path, archive_path);
+    if (result == LHA_ERR_WRITE && io_error == ERROR_DISK_FULL)
+    {
+      log_event(context, WHD_ERROR_SPACE, archive_path, member_path, 0, "failed to extract. Disk full");
+    }
+    else
+    {
+      log_event(context, WHD_ERROR_IO, archive_path, member_path, 0,
+                result == LHA_ERR_WRITE ? "failed to extract. Write error" : "failed to extract. Read error");
+    }
+  }
+}
+
+/*
+ * Decodes a range of an archive's members with the built-in decoder and
+ * restores their dates, protection bits and comments.  Members already
+ * present in the target folder are not decoded again, and with a cache
+ * members whose data was written before are copied rather than decoded.
+ * Small members are held in a WriteBatch and written a directory at a
+ * time when it fills up and when the range is done.
+ */
+static void extract_member_range(struct WhdContext *context, struct ArchiveJob *job)
+{
+  struct LhaMember *member;
+  struct LhaDecoder *decoder;
+  char member_path[256];
+  struct MemberStream stream;
+  struct HashedRead hashed;
+  struct FileInfoBlock *file_info_block;
+  struct WriteBatch *batch = NULL;
+  struct BatchedRange batched;
+  LhaReadFunc read;
+  APTR read_handle;
+  BPTR archive_file;
+  struct AsyncFile *archive = NULL;
+  LONG i, result, io_error = 0, unchanged = 0, copied = 0;
+  ULONG hash = 0;
+  bool hash_known, in_batch;
+  int errors = 0;
+
+  /* Without it every member is simply extracted */
+  file_info_block = context->options.force ? NULL : (struct FileInfoBlock *)AllocMem(sizeof(struct FileInfoBlock), MEMF_CLEAR);
+
+  /* The archive is read ahead while its members are decoded */
+  decoder = lha_create_decoder_sized(context->input_buffer_size);
+  archive_file = Open((CONST_STRPTR)job->archive_path, MODE_OLDFILE);
+  if (decoder != NULL && archive_file != 0)
+  {
+    archive = async_attach(archive_file, ASYNC_READ, context->read_buffer_size, ASYNC_BUFFERS);
+  }
+  if (archive == NULL)
+  {
+    if (archive_file == 0)
+    {
+      log_event(context, WHD_ERROR_IO, job->archive_path, NULL, 0, "failed to extract. Cannot open archive");
+    }
+    else
+    {
+      log_event(context, WHD_ERROR_MEMORY, job->archive_path, NULL, 0, "failed to extract. Out of memory");
+      Close(archive_file);
+    }
+    lha_free_decoder(decoder);
+    if (file_info_block != NULL)
+    {
+      FreeMem(file_info_block, sizeof(struct FileInfoBlock));
+    }
+    return;
+  }
+
+  /* Without a batch, or memory for one, every file is written as it is decoded */
+  if (context->sink.handle == NULL && !context->test_archives_only && context->batch_size > 0)
+  {
+    batch = batch_create(context->batch_size);
+  }
+  batched.context = context;
+  batched.job = job;
+  batched.errors = 0;
+
+  for (i = job->first_member; i < job->last_member && context->should_stop_app == 0; i++)
+  {
+    member = &job->member_set->members[i];
+    if (strchr(member->path, ':') != NULL)
+    {
+      /* A device name would put the file or directory outside the target folder */
+      log_event(context, WHD_ERROR_UNKNOWN, job->archive_path, member->path, 0, "skipped. Absolute path");
+      errors++;
+      continue;
+    }
+    if (!member_output_path(job, member, member_path, sizeof(member_path)))
+    {
+      log_event(context, WHD_ERROR_UNKNOWN, job->archive_path, member->path, 0, "skipped. Path too long");
+      errors++;
+      continue;
+    }
+    if (member->is_directory)
+    {
+      continue;
+    }
+    sanitizeAmigaPath(member_path);
+
+    if (!async_seek(archive, member->data_offset))
+    {
+      result = LHA_ERR_READ;
+    }
+    else if (context->options.member_begin != NULL &&
+             context->options.member_begin(context->options.user_data, job->archive_path, member, &stream.member_handle))
+    {
+      stream.context = context;
+      result = lha_decode_member(decoder, member, async_read, (APTR)archive, stream_member, (APTR)&stream);
+      if (context->options.member_end != NULL)
+      {
+        context->options.member_end(context->options.user_data, stream.member_handle, result);
+      }
+    }
+    else if (context->test_archives_only)
+    {
+      result = lha_decode_member(decoder, member, async_read, (APTR)archive, discard_member, NULL);
+    }
+    else if (context->sink.handle != NULL)
+    {
+      result = decode_to_sink(context, decoder, member, member_path, async_read, (APTR)archive, &io_error);
+    }
+    else if (member_is_current(decoder, member, member_path, file_info_block))
+    {
+      unchanged++;
+      add_progress(context, job, member->packed_size, 0);
+      continue;
+    }
+    else
+    {
+      hash_known = false;
+      if (context->cache != NULL && copy_cached_member(context, decoder, archive, member, member_path, &hash, &hash_known))
+      {
+        restore_member_metadata(member, member_path);
+        remember_member(context, member, hash, member_path);
+        copied++;
+        add_progress(context, job, member->packed_size, member->original_size);
+        continue;
+      }
+
+      in_batch = batch != NULL && batch_accepts(batch, member_path, member->original_size);
+      if (in_batch && !batch_begin_file(batch, member_path, member->original_size, (APTR)member))
+      {
+        /* Full; write what it holds, after which a file it accepts always fits */
+        batch_flush(batch, finish_batched_member, &batched);
+        batch_begin_file(batch, member_path, member->original_size, (APTR)member);
+      }
+
+      read = async_read;
+      read_handle = (APTR)archive;
+      if (context->cache != NULL && !hash_known)
+      {
+        hashed.file = archive;
+        hashed.hash = CACHE_HASH_INIT;
+        read = read_hashed;
+        read_handle = (APTR)&hashed;
+      }
+      if (in_batch)
+      {
+        result = lha_decode_member(decoder, member, read, read_handle, batch_write, (APTR)batch);
+      }
+      else
+      {
+        result = decode_to_file(context, decoder, member, member_path, read, read_handle, &io_error);
+      }
+      if (read == read_hashed)
+      {
+        hash = hashed.hash;
+      }
+
+      if (in_batch)
+      {
+        /* Its metadata and cache entry follow once it is written */
+        batch_end_file(batch, result == LHA_OK, hash);
+      }
+      else if (result == LHA_OK && context->cache != NULL)
+      {
+        remember_member(context, member, hash, member_path);
+      }
+    }
+
+    if (result != LHA_OK)
+    {
+      errors++;
+      report_member_error(context, job->archive_path, member->path, result, io_error);
+    }
+    add_progress(context, job, member->packed_size, result == LHA_OK ? member->original_size : 0);
+  }
+
+  if (batch != NULL)
+  {
+    batch_flush(batch, finish_batched_member, &batched);
+    batch_free(batch);
+    errors += batched.errors;
+  }
+
+  finish_part(context, job, errors == 0 && context->should_stop_app == 0);
+  if (unchanged > 0 || copied > 0)
+  {
+    ObtainSemaphore(&context->pool_lock);
+    context->num_members_unchanged += unchanged;
+    context->num_members_copied += copied;
+    ReleaseSemaphore(&context->pool_lock);
+  }
+
+  async_close(archive);
+  lha_free_decoder(decoder);
+  if (file_info_block != NULL)
+  {
+    FreeMem(file_info_block, sizeof(struct FileInfoBlock));
+  }
+}
+
+/*
+ * Extracts archives as they arrive on options.input, such as a pipe from
+ * a download, so the compressed copy never has to be stored.  The input
+ * is either one LHA archive, extracted into the target folder, or with
+ * options.framed_input any number of them, each after a line giving its
+ * size and its path relative to the target folder.  Members are decoded
+ * in the order they are stored, which is also the order LHA writes
+ * them, so the stream is never rewound.
+ */
+static void extract_input(struct WhdContext *context)
+{
+  struct StreamInput input;
+  struct ArchiveJob *job;
+  char path[256], source_path[512];
+  ULONG size;
+
+  input.file = context->options.input;
+  while (context->should_stop_app == 0)
+  {
+    if (!context->options.framed_input)
+    {
+      size = STREAM_UNLIMITED;
+      strcpy(path, "-");
+    }
+    else if (!read_frame_header(context, &size, path))
+    {
+      break;
+    }
+
+    /* Output paths are found as if the archive had been in the source folder */
+    job = create_job(context, ARCHIVE_LHA, path, (const char *)FilePart((CONST_STRPTR)path), 0);
+    if (job == NULL)
+    {
+      log_printf(context, "\n\x1B[1mError:\x1B[0m Out of memory extracting %s\n", path);
+      log_event(context, WHD_ERROR_MEMORY, path, NULL, 0, "failed to extract. Out of memory");
+      break;
+    }
+    if (context->options.framed_input)
+    {
+      sprintf(source_path, "%s/%s", context->input_file_path, path);
+      get_output_directory(context, source_path, job->output_path);
+    }
+    else
+    {
+      get_output_directory(context, context->input_file_path, job->output_path);
+    }
+    count_archive_found(context, ARCHIVE_LHA, false);
+
+    input.left = size;
+    input.position = 0;
+    extract_stream_archive(context, &input, job);
+    free_job(context, job);
+
+    /* Whatever follows the end of an archive in its frame is not needed */
+    if (!context->options.framed_input || (input.left > 0 && !skip_input(&input, input.left)))
+    {
+      break;
+    }
+  }
+}
+
+/*
+ * Reads the line before an archive in a framed stream: its size in
+ * bytes, a space and its path.  Returns false at the end of the stream,
+ * which is the end of the input or an empty line, and if the line is
+ * not understood, as the stream cannot be followed after that.
+ */
+static bool read_frame_header(struct WhdContext *context, ULONG *size, char *path)
+{
+  char line[300], *name, *end;
+  ULONG length;
+
+  if (FGets(context->options.input, (STRPTR)line, sizeof(line)) == NULL)
+  {
+    return false;
+  }
+  length = strlen(line);
+  while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+  {
+    line[--length] = '\0';
+  }
+  if (length == 0)
+  {
+    return false;
+  }
+
+  *size = strtoul(line, &end, 10);
+  name = end + 1;
+  if (end == line || *end != ' ' || *name == '\0' || *name == '/' || strchr(name, ':') != NULL || strlen(name) >= 256)
+  {
+    /* A device name or a leading '/' would put the files outside the target folder */
+    log_printf(context, "\n\x1B[1mError:\x1B[0m Cannot read the stream past \"%s\"\n", line);
+    log_event(context, WHD_ERROR_CORRUPT, line, NULL, 0, "is not a size and path. The stream cannot be followed");
+    return false;
+  }
+  strcpy(path, name);
+  return true;
+}
+
+/*
+ * Decodes the members of one archive from a stream.  A member that is
+ * not decoded, being current already, failing or of a method the
+ * built-in decoder lacks, is read past; c:lha cannot be given a stream.
+ * Only a header that cannot be read or data that ends early stops the
+ * archive, as the stream cannot be followed past them.
+ */
+static void extract_stream_archive(struct WhdContext *context, struct StreamInput *input, struct ArchiveJob *job)
+{
+  struct LhaMember *member;
+  struct LhaDecoder *decoder;
+  struct FileInfoBlock *file_info_block;
+  struct MemberStream stream;
+  char member_path[256], last_created[256];
+  ULONG header_length, data_end;
+  LONG status, result, io_error = 0, unchanged = 0;
+  bool decoded, path_fits;
+  int errors = 0;
+
+  member = (struct LhaMember *)AllocVec(sizeof(struct LhaMember), MEMF_ANY);
+  decoder = lha_create_decoder_sized(context->input_buffer_size);
+  file_info_block = context->options.force ? NULL : (struct FileInfoBlock *)AllocMem(sizeof(struct FileInfoBlock), MEMF_CLEAR);
+  if (member == NULL || decoder == NULL)
+  {
+    log_event(context, WHD_ERROR_MEMORY, job->archive_path, NULL, 0, "failed to extract. Out of memory");
+    errors++;
+  }
+  last_created[0] = '\0';
+  if (!context->test_archives_only && context->sink.handle == NULL)
+  {
+    create_directory_path(job->output_path, last_created);
+  }
+
+  while (member != NULL && decoder != NULL && context->should_stop_app == 0)
+  {
+    status = lha_read_next_member(read_input, (APTR)input, member, &header_length);
+    if (status <= 0)
+    {
+      if (status < 0)
+      {
+        log_printf(context, "\n\x1B[1mError:\x1B[0m Corrupt archive %s\n", job->archive_path);
+        log_event(context, WHD_ERROR_CORRUPT, job->archive_path, NULL, 0, "is corrupt");
+        errors++;
+      }
+      break;
+    }
+    data_end = input->position + member->packed_size;
+
+    ObtainSemaphore(&context->pool_lock);
+    add_kb(&context->kb_total, &context->bytes_total, member->packed_size);
+    ReleaseSemaphore(&context->pool_lock);
+    job->progress_bytes += member->packed_size;
+
+    path_fits = member_output_path(job, member, member_path, sizeof(member_path));
+    if (path_fits)
+    {
+      sanitizeAmigaPath(member_path);
+    }
+
+    /* Each directory as its first member arrives, rather than all up front */
+    if (!context->test_archives_only && strchr(member->path, ':') == NULL)
+    {
+      make_member_directory(context, job, member, last_created);
+    }
+
+    result = LHA_OK;
+    decoded = false;
+    if (strchr(member->path, ':') != NULL)
+    {
+      log_event(context, WHD_ERROR_UNKNOWN, job->archive_path, member->path, 0, "skipped. Absolute path");
+      errors++;
+    }
+    else if (!path_fits)
+    {
+      log_event(context, WHD_ERROR_UNKNOWN, job->archive_path, member->path, 0, "skipped. Path too long");
+      errors++;
+    }
+    else if (member->is_directory)
+    {
+      /* Made above */
+    }
+    else if (!lha_method_supported(member->method))
+    {
+      log_printf(context, "\n\x1B[1mError:\x1B[0m %s in %s uses %s, which cannot be extracted from a stream\n", member->path,
+                 job->archive_path, member->method);
+      log_event(context, WHD_ERROR_MISSING_TOOL, job->archive_path, member->path, 0,
+                "skipped. The method can only be extracted with c:lha, which cannot read a stream");
+      errors++;
+    }
+    else if (context->options.member_begin != NULL &&
+             context->options.member_begin(context->options.user_data, job->archive_path, member, &stream.member_handle))
+    {
+      stream.context = context;
+      result = lha_decode_member(decoder, member, read_input, (APTR)input, stream_member, (APTR)&stream);
+      if (context->options.member_end != NULL)
+      {
+        context->options.member_end(context->options.user_data, stream.member_handle, result);
+      }
+      decoded = true;
+    }
+    else if (context->test_archives_only)
+    {
+      result = lha_decode_member(decoder, member, read_input, (APTR)input, discard_member, NULL);
+      decoded = true;
+    }
+    else if (context->sink.handle != NULL)
+    {
+      result = decode_to_sink(context, decoder, member, member_path, read_input, (APTR)input, &io_error);
+      decoded = true;
+    }
+    else if (member_is_current(decoder, member, member_path, file_info_block))
+    {
+      unchanged++;
+    }
+    else
+    {
+      result = decode_to_file(context, decoder, member, member_path, read_input, (APTR)input, &io_error);
+      decoded = true;
+    }
+
+    if (result != LHA_OK)
+    {
+      errors++;
+      report_member_error(context, job->archive_path, member->path, result, io_error);
+    }
+    add_progress(context, job, member->packed_size, decoded && result == LHA_OK ? member->original_size : 0);
+
+    /* The decoder may stop short of the end of the compressed data */
+    if (input->position > data_end || !skip_input(input, data_end - input->position))
+    {
+      if (result == LHA_OK)
+      {
+        log_printf(context, "\n\x1B[1mError:\x1B[0m %s ends early\n", job->archive_path);
+        log_event(context, WHD_ERROR_IO, job->archive_path, member->path, 0, "failed to extract. Read error");
+        errors++;
+      }
+      break;
+    }
+  }
+
+  if (errors == 0 && context->should_stop_app == 0)
+  {
+    report_extracted(context, job, "");
+  }
+  if (unchanged > 0)
+  {
+    ObtainSemaphore(&context->pool_lock);
+    context->num_members_unchanged += unchanged;
+    ReleaseSemaphore(&context->pool_lock);
+  }
+
+  if (member != NULL)
+  {
+    FreeVec(member);
+  }
+  lha_free_decoder(decoder);
+  if (file_info_block != NULL)
+  {
+    FreeMem(file_info_block, sizeof(struct FileInfoBlock));
+  }
+}
+
+/* An LhaReadFunc for a StreamInput; it only comes up short at the end of the archive */
+static LONG read_input(APTR handle, UBYTE *buffer, LONG length)
+{
+  struct StreamInput *input = (struct StreamInput *)handle;
+  LONG count;
+
+  if ((ULONG)length > input->left)
+  {
+    length = (LONG)input->left;
+  }
+  if (length == 0)
+  {
+    return 0;
+  }
+  /* Buffered, so pipes giving a few bytes at a time are read until length is met */
+  count = FRead(input->file, buffer, 1, length);
+  if (count < 0)
+  {
+    return -1;
+  }
+  if (input->left != STREAM_UNLIMITED)
+  {
+    input->left -= count;
+  }
+  input->position += count;
+  return count;
+}
+
+/* Reads and drops count bytes; returns false if the stream ends first */
+static bool skip_input(struct StreamInput *input, ULONG count)
+{
+  UBYTE buffer[SKIP_BUFFER_SIZE];
+  LONG count_read;
+
+  while (count > 0)
+  {
+    count_read = read_input((APTR)input, buffer, count < SKIP_BUFFER_SIZE ? count : SKIP_BUFFER_SIZE);
+    if (count_read <= 0)
+    {
+      return false;
+    }
+    count -= count_read;
+  }
+  return true;
+}
+
+static bool deque_init(struct JobDeque *deque)
+{
+  InitSemaphore(&deque->lock);
+  deque->capacity = INITIAL_DEQUE_SIZE;
+  deque->top = 0;
+  deque->bottom = 0;
+  deque->slots = (struct ArchiveJob **)AllocVec(deque->capacity * sizeof(struct ArchiveJob *), MEMF_ANY);
+  return deque->slots != NULL;
+}
+
+static void deque_free(struct WhdContext *context, struct JobDeque *deque)
+{
+  struct ArchiveJob *job;
+
+  if (deque->slots != NULL)
+  {
+    while ((job = deque_pop(deque)) != NULL)
+    {
+      free_job(context, job);
+    }
+    FreeVec(deque->slots);
+    deque->slots = NULL;
+  }
+}
+
+static bool deque_push(struct JobDeque *deque, struct ArchiveJob *job)
+{
+  struct ArchiveJob **grown;
+  ULONG i, size;
+
+  ObtainSemaphore(&deque->lock);
+  size = deque->bottom - deque->top;
+  if (size == deque->capacity)
+  {
+    /* Double the ring, keeping the jobs in order */
+    grown = (struct ArchiveJob **)AllocVec(deque->capacity * 2 * sizeof(struct ArchiveJob *), MEMF_ANY);
+    if (grown == NULL)
+    {
+      ReleaseSemaphore(&deque->lock);
+      return false;
+    }
+    for (i = 0; i < size; i++)
+    {
+      grown[i] = deque->slots[(deque->top + i) & (deque->capacity - 1)];
+    }
+    FreeVec(deque->slots);
+    deque->slots = grown;
+    deque->capacity *= 2;
+    deque->top = 0;
+    deque->bottom = size;
+  }
+  deque->slots[deque->bottom & (deque->capacity - 1)] = job;
+  deque->bottom++;
+  ReleaseSemaphore(&deque->lock);
+  return true;
+}
+
+/* Owner side: takes the most recently pushed job */
+static struct ArchiveJob *deque_pop(struct JobDeque *deque)
+{
+  struct ArchiveJob *job = NULL;
+
+  ObtainSemaphore(&deque->lock);
+  if (deque->bottom != deque->top)
+  {
+    deque->bottom--;
+    job = deque->slots[deque->bottom & (deque->capacity - 1)];
+  }
+  ReleaseSemaphore(&deque->lock);
+  return job;
+}
+
+/* Thief side: takes the oldest job */
+static struct ArchiveJob *deque_steal(struct JobDeque *deque)
+{
+  struct ArchiveJob *job = NULL;
+
+  ObtainSemaphore(&deque->lock);
+  if (deque->bottom != deque->top)
+  {
+    job = deque->slots[deque->top & (deque->capacity - 1)];
+    deque->top++;
+  }
+  ReleaseSemaphore(&deque->lock);
+  return job;
+}
+
+/*
+ * Tries every other worker's deque, starting from a random victim so
+ * idle workers do not all pile onto the same one.
+ */
+static struct ArchiveJob *steal_job(struct WhdContext *context, struct Worker *thief)
+{
+  struct ArchiveJob *job;
+  int start, i, victim;
+
+  thief->random_state = thief->random_state * 1103515245UL + 12345UL;
+  start = (int)((thief->random_state >> 16) % (ULONG)context->num_workers);
+
+  for (i = 0; i < context->num_workers; i++)
+  {
+    victim = (start + i) % context->num_workers;
+    if (&context->workers[victim] == thief)
+    {
+      continue;
+    }
+    job = deque_steal(&context->workers[victim].deque);
+    if (job != NULL)
+    {
+      thief->jobs_stolen++;
+      return job;
+    }
+  }
+  return NULL;
+}
+
+/* Signals every running worker that there may be work, or that it should quit */
+static void wake_workers(struct WhdContext *context)
+{
+  int i;
+
+  Forbid();
+  for (i = 0; i < context->num_workers; i++)
+  {
+    if (context->workers[i].task != NULL)
+    {
+      Signal(context->workers[i].task, SIGBREAKF_CTRL_F);
+    }
+  }
+  Permit();
+}
+
+/*
+ * A worker process.  Its Worker arrives as the startup message at its
+ * process port.  Each job it runs goes back to the main process as a
+ * reply, and the main process frees it and counts it done; the startup
+ * message goes back as the process ends.
+ */
+static void WORKER_SAVEDS worker_entry(void)
+{
+  struct Process *process = (struct Process *)FindTask(NULL);
+  struct Worker *worker;
+  struct WhdContext *context;
+  struct ArchiveJob *job;
+  bool quit;
+
+  WaitPort(&process->pr_MsgPort);
+  worker = (struct Worker *)GetMsg(&process->pr_MsgPort);
+  context = worker->context;
+
+  for (;;)
+  {
+    job = deque_pop(&worker->deque);
+    if (job == NULL)
+    {
+      job = steal_job(context, worker);
+    }
+
+    if (job != NULL)
+    {
+      run_job(context, job, worker);
+      worker->jobs_run++;
+      ReplyMsg(&job->message);
+      continue;
+    }
+
+    ObtainSemaphore(&context->pool_lock);
+    quit = context->workers_quit;
+    ReleaseSemaphore(&context->pool_lock);
+    if (quit)
+    {
+      break;
+    }
+    Wait(SIGBREAKF_CTRL_F);
+  }
+
+  /* Reply inside Forbid() so the main task cannot unload us while we finish */
+  Forbid();
+  worker->task = NULL;
+  ReplyMsg(&worker->startup);
+}
+
+/*
+ * Starts the worker processes.  Returns the number started; the caller
+ * falls back to extracting on the main process when this is below two.
+ */
+static int start_workers(struct WhdContext *context, int count)
+{
+  struct Process *process;
+  BPTR current_dir, worker_dir;
+  int i;
+
+  context->num_workers = 0;
+  context->result_port = CreateMsgPort();
+  if (context->result_port == NULL)
+  {
+    return 0;
+  }
+
+  current_dir = CurrentDir(0);
+  CurrentDir(current_dir);
+
+  for (i = 0; i < count; i++)
+  {
+    memset(&context->workers[i], 0, sizeof(struct Worker));
+    context->workers[i].startup.mn_ReplyPort = context->result_port;
+    context->workers[i].startup.mn_Length = sizeof(struct Worker);
+    context->workers[i].context = context;
+    context->workers[i].id = i + 1;
+    context->workers[i].random_state = (ULONG)(i + 1) * 2654435761UL;
+    if (!deque_init(&context->workers[i].deque))
+    {
+      break;
+    }
+
+    worker_dir = DupLock(current_dir);
+
+    /* Forbid() keeps wake_workers() from seeing the task before it is in the pool */
+    Forbid();
+    process = CreateNewProcTags(NP_Entry, (ULONG)worker_entry,
+                                NP_Name, (ULONG) "WHDArchiveExtractor worker",
+                                NP_StackSize, WORKER_STACK_SIZE,
+                                NP_Output, (ULONG)Output(),
+                                NP_CloseOutput, FALSE,
+                                NP_CurrentDir, (ULONG)worker_dir,
+                                NP_Cli, TRUE,
+                                TAG_DONE);
+    if (process != NULL)
+    {
+      context->workers[i].task = &process->pr_Task;
+      PutMsg(&process->pr_MsgPort, &context->workers[i].startup);
+      context->running_workers++;
+      context->num_workers++;
+    }
+    Permit();
+
+    if (process == NULL)
+    {
+      UnLock(worker_dir);
+      deque_free(context, &context->workers[i].deque);
+      break;
+    }
+  }
+
+  if (context->num_workers == 0)
+  {
+    DeleteMsgPort(context->result_port);
+    context->result_port = NULL;
+  }
+  return context->num_workers;
+}
+
+/*
+ * Takes in the jobs workers have run and the workers that have ended.
+ * Only the main process calls this, and it does not wait.
+ */
+static void collect_results(struct WhdContext *context)
+{
+  struct Message *message;
+  int i;
+
+  if (context->result_port == NULL)
+  {
+    return;
+  }
+  while ((message = GetMsg(context->result_port)) != NULL)
+  {
+    for (i = 0; i < context->num_workers && message != &context->workers[i].startup; i++)
+    {
+    }
+    if (i < context->num_workers)
+    {
+      context->running_workers--;
+      continue;
+    }
+
+    unqueue_job(context, (struct ArchiveJob *)message);
+    free_job(context, (struct ArchiveJob *)message);
+  }
+}
+
+/*
+ * Waits for the jobs still queued, then tells the workers to end and
+ * waits for each of them to come back.
+ */
+static void finish_workers(struct WhdContext *context)
+{
+  int i;
+
+  wait_for_jobs(context);
+
+  ObtainSemaphore(&context->pool_lock);
+  context->workers_quit = 1;
+  ReleaseSemaphore(&context->pool_lock);
+  wake_workers(context);
+
+  while (context->running_workers > 0)
+  {
+    WaitPort(context->result_port);
+    collect_results(context);
+  }
+
+  for (i = 0; i < context->num_workers; i++)
+  {
+    deque_free(context, &context->workers[i].deque);
+  }
+  if (context->result_port != NULL)
+  {
+    DeleteMsgPort(context->result_port);
+    context->result_port = NULL;
+  }
+}
+
+/* Waits until every job queued so far has been run, leaving the workers running */
+static void wait_for_jobs(struct WhdContext *context)
+{
+  LONG pending;
+
+  for (;;)
+  {
+    collect_results(context);
+    ObtainSemaphore(&context->pool_lock);
+    pending = context->pending_jobs;
+    ReleaseSemaphore(&context->pool_lock);
+    if (pending == 0 || context->result_port == NULL)
+    {
+      break;
+    }
+    WaitPort(context->result_port);
+  }
+}
+
+static int check_disk_space(struct WhdContext *context, STRPTR path, int min_space_mb)
+{
+  struct InfoData *info = AllocMem(sizeof(struct InfoData), MEMF_CLEAR);
+  BPTR lock = Lock(path, ACCESS_READ);
+  long free_space;
+  int result;
+
+  if (!info)
+    return -1; /* Allocation failed, can't check disk space */
+  if (!lock)
+  {
+    FreeMem(info, sizeof(struct InfoData));
+    return -2; /* Unable to lock the path, can't check disk space */
+  }
+
+  result = 0; /* Default to 0, meaning there's enough space */
+
+  if (Info(lock, info))
+  {
+    /* Convert available blocks to bytes and then to megabytes */
+    free_space = ((long)info->id_NumBlocks - (long)info->id_NumBlocksUsed) * (long)info->id_BytesPerBlock / 1024 / 1024;
+
+#ifdef DEBUG
+    log_printf(context, "Free space: %ld\n", free_space);
+#endif
+
+    if (free_space < 0)
+    {
+      result = 0; /* Assume very large disk, so return 0 */
+    }
+    else if (free_space < min_space_mb)
+    {
+      result = -3; /* Not enough space */
+    }
+  }
+  else
+  {
+    result = -4; /* Info call failed */
+  }
+
+  UnLock(lock);
+  FreeMem(info, sizeof(struct InfoData));
+  return result;
+}
+
+ULONG whd_available_tools(void)
+{
+  ULONG tools = 0;
+
+  if (does_file_exist("c:lha"))
+  {
+    tools |= WHD_TOOL_LHA;
+  }
+  if (does_file_exist("c:unlzx"))
+  {
+    tools |= WHD_TOOL_UNLZX;
+  }
+  return tools;
+}
+
+/*
+ * Creates the image or tar stream the members are written to.  A tar
+ * stream to "-" goes to the standard output.
+ */
+static LONG open_sink(struct WhdContext *context)
+{
+  struct OutputSink *sink = &context->sink;
+  BPTR file;
+  LONG error;
+
+  if (context->options.output_format == WHD_OUTPUT_HDF)
+  {
+    sink->handle = hdf_create_image((CONST_STRPTR)context->output_directory_path, context->options.image_size_mb, &error);
+    sink->make_directory = hdf_make_directory;
+    sink->begin_file = hdf_begin_file;
+    sink->write_file = hdf_write_file;
+    sink->end_file = hdf_end_file;
+    sink->close = hdf_close_image;
+  }
+  else
+  {
+    if (strcmp(context->output_directory_path, "-") == 0)
+    {
+      sink->handle = tar_create_stream(Output(), FALSE, &error);
+    }
+    else
+    {
+      file = Open((CONST_STRPTR)context->output_directory_path, MODE_NEWFILE);
+      error = SINK_ERR_OPEN;
+      if (file != 0)
+      {
+        sink->handle = tar_create_stream(file, TRUE, &error);
+        if (sink->handle == NULL)
+        {
+          Close(file);
+        }
+      }
+    }
+    sink->make_directory = tar_make_directory;
+    sink->begin_file = tar_begin_file;
+    sink->write_file = tar_write_file;
+    sink->end_file = tar_end_file;
+    sink->close = tar_close_stream;
+  }
+
+  if (sink->handle == NULL)
+  {
+    return error == SINK_ERR_MEMORY ? WHD_ERR_MEMORY : WHD_ERR_OUTPUT;
+  }
+  return WHD_OK;
+}
+
+/*
+ * Loads the cache index.  Entries hold absolute paths so the cache still
+ * applies when a new collection is extracted to a different folder.
+ */
+static LONG open_cache(struct WhdContext *context)
+{
+  BPTR lock;
+
+  lock = Lock((CONST_STRPTR)context->output_directory_path, ACCESS_READ);
+  if (lock == 0 || !NameFromLock(lock, (STRPTR)context->target_root, sizeof(context->target_root)))
+  {
+    if (lock != 0)
+    {
+      UnLock(lock);
+    }
+    return WHD_ERR_TARGET;
+  }
+  UnLock(lock);
+
+  context->cache = cache_open((CONST_STRPTR)context->options.cache_path);
+  return context->cache != NULL ? WHD_OK : WHD_ERR_MEMORY;
+}
+
+void whd_default_options(struct WhdOptions *options)
+{
+  memset(options, 0, sizeof(struct WhdOptions));
+  options->workers = 1;
+  options->split_size_kb = DEFAULT_SPLIT_SIZE_KB;
+  options->batch_kb = DEFAULT_BATCH_KB;
+  options->queue_kb = DEFAULT_QUEUE_KB;
+  options->output = Output();
+}
+
+struct WhdContext *whd_create_context(const struct WhdOptions *options)
+{
+  struct WhdContext *context;
+  ULONG tools;
+
+  context = (struct WhdContext *)AllocVec(sizeof(struct WhdContext), MEMF_ANY | MEMF_CLEAR);
+  if (context == NULL)
+  {
+    return NULL;
+  }
+
+  context->options = *options;
+  /* A stream cannot be looked at without being used up */
+  context->options.dry_run = options->dry_run && options->input == 0;
+  strncpy(context->input_directory_path, options->source_path, sizeof(context->input_directory_path) - 1);
+  strncpy(context->output_directory_path, options->target_path, sizeof(context->output_directory_path) - 1);
+  remove_trailing_slash(context->input_directory_path);
+  remove_trailing_slash(context->output_directory_path);
+  context->input_file_path = context->input_directory_path;
+
+  context->skip_disk_space_check = !options->space_check;
+  /* A dry run writes nothing either, so no cache, sink or flush is set up for it */
+  context->test_archives_only = options->test_only || context->options.dry_run;
+  context->use_native_lha = options->native || options->member_begin != NULL || options->input != 0;
+  context->watch_mode = options->watch && !options->dry_run && options->input == 0;
+  context->split_size_kb = options->split_size_kb;
+  context->max_errors = options->max_errors;
+  context->requested_workers = options->workers;
+  if (context->requested_workers < 1)
+  {
+    context->requested_workers = 1;
+  }
+  if (context->requested_workers > WHD_MAX_WORKERS)
+  {
+    context->requested_workers = WHD_MAX_WORKERS;
+  }
+  if (options->output_format != WHD_OUTPUT_FOLDER)
+  {
+    /* Sinks are written by one process, in one pass, by the built-in decoder */
+    context->requested_workers = 1;
+    context->use_native_lha = true;
+    context->skip_disk_space_check = true;
+  }
+  if (options->input != 0)
+  {
+    /* So is a stream read, as it arrives */
+    context->requested_workers = 1;
+  }
+  if (options->low_memory)
+  {
+    /* One decoder and its buffers in place of c:lha, which brings its own */
+    context->requested_workers = 1;
+    context->use_native_lha = true;
+  }
+  context->num_workers = 1;
+  context->resetProtectionBits = 1;
+  context->input_buffer_size = DEFAULT_INPUT_SIZE;
+  context->read_buffer_size = ARCHIVE_READ_SIZE;
+  context->write_buffer_max = MAX_WRITE_BUFFER;
+  context->hash_buffer_size = CACHE_READ_SIZE;
+  context->batch_size = options->batch_kb * 1024;
+  context->queue_budget = options->queue_kb * 1024;
+
+  tools = whd_available_tools();
+  context->lha_available = (tools & WHD_TOOL_LHA) != 0;
+  context->unlzx_available = (tools & WHD_TOOL_UNLZX) != 0;
+
+  InitSemaphore(&context->pool_lock);
+  InitSemaphore(&context->output_lock);
+  InitSemaphore(&context->log_lock);
+  return context;
+}
+
+void whd_free_context(struct WhdContext *context)
+{
+  if (context == NULL)
+  {
+    return;
+  }
+  free_event_log(context);
+  FreeVec(context);
+}
+
+/*
+ * Sizes the buffers from the fast memory free at the start, leaving most
+ * of it to Workbench and the file systems; a machine with none uses chip
+ * memory.  The decoder's window is set by each method, up to 64KB for
+ * -lh7-, so only the buffers around it give.  Each is cut rather than
+ * dropped while it is worth having.
+ */
+static void fit_buffers_to_memory(struct WhdContext *context)
+{
+  ULONG free_memory, budget;
+
+  free_memory = AvailMem(MEMF_FAST);
+  if (free_memory == 0)
+  {
+    free_memory = AvailMem(MEMF_ANY);
+  }
+  budget = free_memory / LOW_MEMORY_SHARE;
+
+  if (context->input_buffer_size > budget / 32)
+  {
+    context->input_buffer_size = budget / 32; /* The decoder keeps at least 256 bytes */
+  }
+  if (context->read_buffer_size > budget / 8)
+  {
+    context->read_buffer_size = budget / 8; /* Archives are read directly once it is too small to share */
+  }
+  while (context->write_buffer_max > budget / 4 && context->write_buffer_max >= MIN_WRITE_BUFFER)
+  {
+    context->write_buffer_max /= 2;
+  }
+  if (context->hash_buffer_size > budget / 16)
+  {
+    context->hash_buffer_size = budget / 16 > 1024 ? budget / 16 : 1024;
+  }
+  if (context->batch_size > budget / 2)
+  {
+    context->batch_size = budget / 2 >= MIN_BATCH_SIZE ? budget / 2 : 0;
+  }
+
+  log_printf(context,
+             "Low memory mode: %lu KB free, so archives are read ahead %lu KB and files are written through %lu KB buffers and "
+             "batched %lu KB at a time.\n",
+             free_memory / 1024, context->read_buffer_size / 1024,
+             context->write_buffer_max >= MIN_WRITE_BUFFER ? context->write_buffer_max / 1024 : 0, context->batch_size / 1024);
+}
+
+LONG whd_run(struct WhdContext *context)
+{
+  LONG result = WHD_OK;
+
+  if (!context->use_native_lha && !context->lha_available)
+  {
+    return WHD_ERR_NO_LHA;
+  }
+  if (context->options.input == 0 && does_folder_exists(context->input_directory_path) == 0)
+  {
+    return WHD_ERR_SOURCE;
+  }
+  if (context->options.output_format == WHD_OUTPUT_FOLDER && does_folder_exists(context->output_directory_path) == 0)
+  {
+    return WHD_ERR_TARGET;
+  }
+  if (!context->skip_disk_space_check && !context->options.dry_run &&
+      check_disk_space(context, (STRPTR)context->output_directory_path, 20) < 0)
+  {
+    return WHD_ERR_SPACE;
+  }
+
+  if (context->watch_mode)
+  {
+    context->watch_port = CreateMsgPort();
+    if (context->watch_port == NULL)
+    {
+      return WHD_ERR_MEMORY;
+    }
+  }
+
+  if (context->options.event_log_path != NULL)
+  {
+    context->event_log_file = Open((CONST_STRPTR)context->options.event_log_path, MODE_NEWFILE);
+    if (context->event_log_file == 0)
+    {
+      result = WHD_ERR_EVENT_LOG;
+    }
+  }
+
+  /* Members copied from the cache are written to the target folder only, from archives that can be read twice */
+  if (result == WHD_OK && context->options.cache_path != NULL && context->options.output_format == WHD_OUTPUT_FOLDER &&
+      !context->test_archives_only && context->options.input == 0)
+  {
+    result = open_cache(context);
+  }
+
+  /* Testing writes nothing, so no sink is opened */
+  if (result == WHD_OK && context->options.output_format != WHD_OUTPUT_FOLDER && !context->test_archives_only)
+  {
+    result = open_sink(context);
+  }
+
+  /* Nothing is written when testing, and standard output has no volume to flush */
+  if (result == WHD_OK && context->options.durability != WHD_DURABLE_NONE && !context->test_archives_only &&
+      strcmp(context->output_directory_path, "-") != 0)
+  {
+    context->target_port = DeviceProc((CONST_STRPTR)context->output_directory_path);
+    if (context->target_port == NULL)
+    {
+      log_printf(context, "\n\x1B[1mWarning:\x1B[0m Cannot find the file system of %s to flush it\n", context->output_directory_path);
+    }
+  }
+
+  if (result == WHD_OK)
+  {
+    if (context->options.low_memory)
+    {
+      fit_buffers_to_memory(context);
+    }
+    context->main_task = FindTask(NULL);
+    context->workers_quit = 0;
+    context->progress_bar = context->options.output != 0 && IsInteractive(context->options.output);
+    DateStamp(&context->start_time);
+
+    if (context->requested_workers > 1)
+    {
+      if (start_workers(context, context->requested_workers) < context->requested_workers)
+      {
+        log_printf(context, "Only %d of %d worker processes could be started.\n", context->num_workers, context->requested_workers);
+      }
+    }
+
+    if (context->watch_mode)
+    {
+      /* New archives keep arriving, so they are extracted as they are found */
+      context->counting_found = true;
+      get_directory_contents(context, context->input_directory_path);
+      watch_for_changes(context);
+    }
+    else if (context->options.input != 0)
+    {
+      /* Nothing is known ahead, so the total grows as member headers arrive */
+      extract_input(context);
+    }
+    else
+    {
+      context->catalogue = catalogue_create();
+      if (context->catalogue == NULL)
+      {
+        result = WHD_ERR_MEMORY;
+      }
+      else
+      {
+        if (context->options.index_path != NULL)
+        {
+          context->index = catalogue_load_index((CONST_STRPTR)context->options.index_path);
+        }
+        inventory_directory(context, context->input_directory_path, true);
+        wait_for_jobs(context);
+        if (context->index != NULL)
+        {
+          log_printf(context, "%d directories were unchanged since the index was saved, and %d archives were taken from it.\n",
+                     context->num_directories_unchanged, context->num_archives_indexed);
+          catalogue_free_index(context->index);
+          context->index = NULL;
+        }
+        if (context->options.index_path != NULL && !context->options.dry_run)
+        {
+          save_index(context);
+        }
+        plan_extraction(context);
+      }
+    }
+
+    if (context->requested_workers > 1)
+    {
+      finish_workers(context);
+    }
+    if (!context->options.dry_run)
+    {
+      finish_progress(context);
+    }
+    if (context->catalogue != NULL)
+    {
+      catalogue_free(context->catalogue);
+      context->catalogue = NULL;
+    }
+  }
+
+  if (context->watch_mode)
+  {
+    stop_watching(context);
+  }
+  if (context->sink.handle != NULL)
+  {
+    if (context->sink.close(context->sink.handle) != SINK_OK)
+    {
+      log_printf(context, "\n\x1B[1mError:\x1B[0m Failed to write %s\n", context->output_directory_path);
+      log_event(context, WHD_ERROR_IO, context->output_directory_path, NULL, 0, "failed to write the output. Write error");
+    }
+    context->sink.handle = NULL;
+  }
+
+  /* An image or tar file is only complete once it is closed, so it is flushed here too */
+  if (context->target_port != NULL &&
+      (context->options.durability == WHD_DURABLE_RUN || context->options.output_format != WHD_OUTPUT_FOLDER))
+  {
+    if (flush_target(context))
+    {
+      context->num_durable = context->event_counts[WHD_EVENT_EXTRACTED];
+    }
+    else
+    {
+      log_printf(context, "\n\x1B[1mWarning:\x1B[0m %s could not be flushed to disk\n", context->output_directory_path);
+    }
+  }
+  if (context->cache != NULL)
+  {
+    if (cache_close(context->cache) != CACHE_OK)
+    {
+      log_printf(context, "\n\x1B[1mWarning:\x1B[0m Could not update the cache index %s\n", context->options.cache_path);
+    }
+    context->cache = NULL;
+  }
+  if (context->event_log_file != 0)
+  {
+    Close(context->event_log_file);
+    context->event_log_file = 0;
+  }
+  return result;
+}
+
+void whd_stop(struct WhdContext *context)
+{
+  context->should_stop_app = 1;
+}
+
+void whd_get_stats(struct WhdContext *context, struct WhdStats *stats)
+{
+  int i;
+
+  memset(stats, 0, sizeof(struct WhdStats));
+  stats->directories_scanned = context->num_directories_scanned;
+  stats->lha_archives_found = context->num_lha_archives_found;
+  stats->lzx_archives_found = context->num_lzx_archives_found;
+  stats->error_count = context->error_count;
+  stats->members_unchanged = context->num_members_unchanged;
+  stats->members_copied = context->num_members_copied;
+  stats->archives_durable = context->num_durable;
+  stats->kb_found = context->kb_total;
+  stats->kb_unpacked = context->kb_unpacked;
+  stats->directories_unchanged = context->num_directories_unchanged;
+  stats->archives_indexed = context->num_archives_indexed;
+  stats->kb_catalogue = context->kb_catalogue;
+  stats->kb_to_write = context->kb_to_write;
+  stats->kb_needed = context->kb_needed;
+  for (i = 0; i < WHD_NUM_EVENT_CLASSES; i++)
+  {
+    stats->event_counts[i] = context->event_counts[i];
+  }
+  if (context->requested_workers > 1)
+  {
+    stats->num_workers = context->num_workers;
+    for (i = 0; i < context->num_workers; i++)
+    {
+      stats->jobs_run[i] = context->workers[i].jobs_run;
+      stats->jobs_stolen[i] = context->workers[i].jobs_stolen;
+    }
+    stats->max_queue_depth = context->max_queue_depth;
+    stats->queue_stall_ticks = context->stall_ticks;
+  }
+}
+
+const struct WhdEvent *whd_first_error(struct WhdContext *context)
+{
+  return context->first_event;
+}
@@ -0,0 +1,187 @@
+/*
+
+  WHDExtract
+
+  The scanning and extraction engine of WHDArchiveExtractor, usable from
+  other programs.  All state lives in a WhdContext, so several contexts
+  can extract at the same time in one program, each with its own worker
+  processes.  Callbacks report progress and can take the decoded data of
+  each member instead of it being written to the target folder.
+
+  This program is released under the MIT License.
+*/
+
+#ifndef WHDEXTRACT_H
+#define WHDEXTRACT_H
+
+#include <dos/dos.h>
+#include <exec/types.h>
+
+#include "LHAArchive.h"
+
+#define WHD_MAX_WORKERS 32
+
+/* Return codes of whd_run() */
+#define WHD_OK 0
+#define WHD_ERR_SOURCE -1    /* The source folder cannot be found */
+#define WHD_ERR_TARGET -2    /* The target folder cannot be found */
+#define WHD_ERR_SPACE -3     /* Less than 20MB free on the target drive */
+#define WHD_ERR_EVENT_LOG -4 /* The event log cannot be created */
+#define WHD_ERR_MEMORY -5
+#define WHD_ERR_NO_LHA -6    /* c:lha is needed but not installed */
+#define WHD_ERR_OUTPUT -7    /* The image or tar file cannot be created */
+
+/* Bits returned by whd_available_tools() */
+#define WHD_TOOL_LHA 1
+#define WHD_TOOL_UNLZX 2
+
+/* Output formats */
+#define WHD_OUTPUT_FOLDER 0 /* Files and directories below target_path */
+#define WHD_OUTPUT_HDF 1    /* An FFS hardfile image at target_path */
+#define WHD_OUTPUT_TAR 2    /* A tar file at target_path, or standard output if it is "-" */
+
+/* When extracted files are flushed to disk */
+#define WHD_DURABLE_NONE 0    /* Left to the file system */
+#define WHD_DURABLE_ARCHIVE 1 /* After each archive, before it is reported as extracted */
+#define WHD_DURABLE_RUN 2     /* Once, at the end of the run */
+
+/* Event classes */
+#define WHD_EVENT_EXTRACTED 0 /* Not an error */
+#define WHD_ERROR_CORRUPT 1
+#define WHD_ERROR_IO 2
+#define WHD_ERROR_MISSING_TOOL 3
+#define WHD_ERROR_SPACE 4
+#define WHD_ERROR_MEMORY 5
+#define WHD_ERROR_UNKNOWN 6
+#define WHD_NUM_EVENT_CLASSES 7
+
+/* Stages reported to the progress callback */
+#define WHD_PROGRESS_DIRECTORY 0 /* A source directory is being scanned */
+#define WHD_PROGRESS_ARCHIVE 1   /* An archive is about to be extracted */
+#define WHD_PROGRESS_EVENT 2     /* An archive was extracted or an error occurred */
+#define WHD_PROGRESS_PLANNED 3   /* Every archive has been found; the totals are final */
+
+/* One recorded event; the strings are stored after the structure */
+struct WhdEvent
+{
+  struct WhdEvent *next;
+  int   event_class;
+  LONG  exit_code; /* Return code of lha or unlzx, 0 if no tool was run */
+  char *archive;
+  char *member;    /* NULL when the event concerns the whole archive */
+  char *message;
+};
+
+struct WhdProgress
+{
+  int   stage;
+  const char *path;             /* The directory or archive */
+  const struct WhdEvent *event; /* WHD_PROGRESS_EVENT only */
+  LONG  directories_scanned;
+  LONG  archives_found;
+  ULONG kb_done;                /* Compressed data dealt with so far */
+  ULONG kb_total;               /* Compressed data of every archive found */
+  ULONG kb_unpacked;            /* Decoded size of every LHA member found */
+};
+
+/*
+ * Callbacks may be called from worker processes, several at a time, and
+ * run on the worker's stack.  A member callback returning TRUE from
+ * member_begin receives the member's data through member_data instead
+ * of it being written to the target folder; member_end follows with
+ * LHA_OK or a negative LHA_ERR_ code.  Member callbacks only apply to
+ * archives decoded natively, so setting them implies the native decoder;
+ * archives that need lha or unlzx are still extracted to the target.
+ * Directories are still created in the target folder, image or tar file.
+ */
+typedef void (*WhdProgressFunc)(APTR user_data, const struct WhdProgress *progress);
+typedef BOOL (*WhdMemberBeginFunc)(APTR user_data, const char *archive_path, const struct LhaMember *member, APTR *member_handle);
+typedef LONG (*WhdMemberDataFunc)(APTR user_data, APTR member_handle, const UBYTE *data, LONG length);
+typedef void (*WhdMemberEndFunc)(APTR user_data, APTR member_handle, LONG result);
+
+struct WhdOptions
+{
+  const char *source_path;
+  const char *target_path;
+  const char *event_log_path; /* JSON lines of every event, or NULL */
+  const char *cache_path;     /* Index of already decoded members, or NULL for no cache */
+  const char *index_path;     /* Catalogue of the source folder kept between runs, or NULL */
+  BPTR  input;                /* Extract the LHA archives arriving on this stream instead of source_path, or 0 */
+  BOOL  framed_input;         /* input holds several archives, each after a line "<size> <path>" */
+  int   workers;              /* 1 extracts on the calling process */
+  LONG  split_size_kb;
+  ULONG batch_kb;             /* Memory per job for small files written a directory at a time, 0 for none */
+  ULONG queue_kb;             /* Memory for jobs queued or running, with their read-ahead, 0 for no limit */
+  LONG  max_errors;           /* Stop after this many errors, 0 to never stop */
+  BOOL  native;
+  BOOL  test_only;
+  BOOL  space_check;
+  BOOL  force;                /* Decode every member, even if the file on disk already matches */
+  BOOL  watch;                /* Keep extracting new archives until whd_stop() */
+  BOOL  dry_run;              /* Only report what would be extracted, from headers and the target's metadata */
+  BOOL  low_memory;           /* Built-in decoder only, one process, buffers sized to the free memory */
+  BOOL  show_progress;        /* Progress bar on a console, or progress lines to a file or pipe */
+  int   output_format;        /* WHD_OUTPUT_FOLDER, WHD_OUTPUT_HDF or WHD_OUTPUT_TAR */
+  int   durability;           /* WHD_DURABLE_; images and tar files are only flushed at the end */
+  ULONG image_size_mb;        /* WHD_OUTPUT_HDF only */
+  BPTR  output;               /* Console messages are written here, 0 for none */
+  WhdProgressFunc progress;
+  WhdMemberBeginFunc member_begin;
+  WhdMemberDataFunc member_data;
+  WhdMemberEndFunc member_end;
+  APTR  user_data;
+};
+
+struct WhdStats
+{
+  LONG  directories_scanned;
+  LONG  lha_archives_found;
+  LONG  lzx_archives_found;
+  LONG  error_count;
+  LONG  members_unchanged;    /* Members already on disk, so not decoded */
+  LONG  members_copied;       /* Members copied from a cached earlier copy */
+  LONG  archives_durable;     /* Extracted archives, or parts of split ones, flushed to disk */
+  ULONG kb_found;             /* Compressed size of the archives found */
+  ULONG kb_unpacked;          /* Decoded size of the LHA members found, from their headers */
+  LONG  directories_unchanged; /* Directories taken from the index without being read */
+  LONG  archives_indexed;     /* Archives whose headers were taken from the index */
+  ULONG kb_catalogue;         /* Memory the catalogue of archives and members took */
+  ULONG kb_to_write;          /* -dryrun: decoded size of the files that would be written */
+  ULONG kb_needed;            /* -dryrun: space those files would take beyond the copies they replace */
+  LONG  event_counts[WHD_NUM_EVENT_CLASSES];
+  int   num_workers;
+  ULONG jobs_run[WHD_MAX_WORKERS];
+  ULONG jobs_stolen[WHD_MAX_WORKERS];
+  LONG  max_queue_depth;      /* Most jobs queued or running at once */
+  ULONG queue_stall_ticks;    /* Time scanning waited for the queue to drain, at TICKS_PER_SECOND */
+};
+
+struct WhdContext;
+
+ULONG whd_available_tools(void);
+void  whd_default_options(struct WhdOptions *options);
+
+/* Returns NULL if out of memory.  The options are copied. */
+struct WhdContext *whd_create_context(const struct WhdOptions *options);
+void  whd_free_context(struct WhdContext *context);
+
+/*
+ * Takes an inventory of the source folder, reading the headers of every
+ * archive, then extracts the archives in the order planned from it,
+ * returning once all of them are done, or with -watch once whd_stop() is
+ * called or Ctrl-C is sent to the calling process.  -watch extracts as it
+ * scans instead.  A dry run stops after the inventory and reports what
+ * extracting would write, overwrite or skip.  With an input stream its
+ * archives are extracted as they arrive, on the calling process, and
+ * source_path only names the stream in messages.  Returns WHD_OK or a negative
+ * WHD_ERR_ code if the run could not start.
+ */
+LONG  whd_run(struct WhdContext *context);
+
+/* May be called from any process, including from a callback */
+void  whd_stop(struct WhdContext *context);
+
+void  whd_get_stats(struct WhdContext *context, struct WhdStats *stats);
+const struct WhdEvent *whd_first_error(struct WhdContext *context);
+
+#endif
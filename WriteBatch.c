@@ -0,0 +1,279 @@
+/*
+
+  WriteBatch
+
+  Files are kept in one block of memory the size of the budget, each as
+  a header followed by its path and data, in a list sorted by directory
+  and then by name.  Files arrive in archive order, which is nearly
+  always sorted already, so most are simply added at the end.
+
+  This program is released under the MIT License.
+*/
+
+#include <dos/dos.h>
+#include <exec/memory.h>
+#include <exec/types.h>
+#include <proto/dos.h>
+#include <proto/exec.h>
+#include <string.h>
+
+#include "WriteBatch.h"
+
+#define FILES_PER_BATCH 4 /* A file may take up at most this part of the budget */
+
+struct BatchFile
+{
+  struct BatchFile *next;
+  APTR  file;
+  ULONG tag;
+  ULONG size;
+  ULONG written;
+  ULONG directory_length; /* Characters of the path before the file name */
+  char *path;             /* Stored after the structure, followed by the data */
+  UBYTE *data;
+};
+
+struct WriteBatch
+{
+  ULONG budget;
+  UBYTE *memory;
+  ULONG used;
+  BOOL  no_memory;
+  struct BatchFile *first;
+  struct BatchFile *last;
+  struct BatchFile *current; /* Being written, not yet in the list */
+};
+
+#define ENTRY_SIZE(path_length, size) ((sizeof(struct BatchFile) + (path_length) + 1 + (size) + 3) & ~3UL)
+
+struct WriteBatch *batch_create(ULONG budget)
+{
+  struct WriteBatch *batch;
+
+  batch = (struct WriteBatch *)AllocVec(sizeof(struct WriteBatch), MEMF_ANY | MEMF_CLEAR);
+  if (batch != NULL)
+  {
+    batch->budget = budget;
+  }
+  return batch;
+}
+
+void batch_free(struct WriteBatch *batch)
+{
+  if (batch->memory != NULL)
+  {
+    FreeVec(batch->memory);
+  }
+  FreeVec(batch);
+}
+
+BOOL batch_accepts(struct WriteBatch *batch, const char *path, ULONG size)
+{
+  if (size > batch->budget || ENTRY_SIZE(strlen(path), size) > batch->budget / FILES_PER_BATCH)
+  {
+    return FALSE;
+  }
+  if (batch->memory == NULL && !batch->no_memory)
+  {
+    batch->memory = (UBYTE *)AllocVec(batch->budget, MEMF_ANY);
+    batch->no_memory = batch->memory == NULL;
+  }
+  return batch->memory != NULL;
+}
+
+BOOL batch_begin_file(struct WriteBatch *batch, const char *path, ULONG size, APTR file)
+{
+  struct BatchFile *entry;
+  ULONG path_length = strlen(path);
+
+  if (batch->used + ENTRY_SIZE(path_length, size) > batch->budget)
+  {
+    return FALSE;
+  }
+  entry = (struct BatchFile *)(batch->memory + batch->used);
+  batch->used += ENTRY_SIZE(path_length, size);
+
+  entry->next = NULL;
+  entry->file = file;
+  entry->tag = 0;
+  entry->size = size;
+  entry->written = 0;
+  entry->path = (char *)(entry + 1);
+  memcpy(entry->path, path, path_length + 1);
+  entry->directory_length = (char *)FilePart((CONST_STRPTR)entry->path) - entry->path;
+  entry->data = (UBYTE *)entry->path + path_length + 1;
+  batch->current = entry;
+  return TRUE;
+}
+
+LONG batch_write(APTR handle, const UBYTE *data, LONG length)
+{
+  struct WriteBatch *batch = (struct WriteBatch *)handle;
+  struct BatchFile *entry = batch->current;
+
+  if (entry == NULL || (ULONG)length > entry->size - entry->written)
+  {
+    return -1;
+  }
+  memcpy(entry->data + entry->written, data, length);
+  entry->written += length;
+  return length;
+}
+
+/* Orders files by directory, a directory before those inside it, and then by name */
+static LONG compare_files(const struct BatchFile *a, const struct BatchFile *b)
+{
+  ULONG length = a->directory_length < b->directory_length ? a->directory_length : b->directory_length;
+  LONG order;
+
+  order = strncmp(a->path, b->path, length);
+  if (order == 0)
+  {
+    order = (LONG)a->directory_length - (LONG)b->directory_length;
+  }
+  if (order == 0)
+  {
+    order = strcmp(a->path + a->directory_length, b->path + b->directory_length);
+  }
+  return order;
+}
+
+void batch_end_file(struct WriteBatch *batch, BOOL keep, ULONG tag)
+{
+  struct BatchFile *entry = batch->current, **link;
+
+  if (entry == NULL)
+  {
+    return;
+  }
+  batch->current = NULL;
+  if (!keep || entry->written != entry->size)
+  {
+    /* It is the last entry in memory, so its space is simply given back */
+    batch->used = (UBYTE *)entry - batch->memory;
+    return;
+  }
+  entry->tag = tag;
+
+  if (batch->last == NULL || compare_files(batch->last, entry) <= 0)
+  {
+    if (batch->last != NULL)
+    {
+      batch->last->next = entry;
+    }
+    else
+    {
+      batch->first = entry;
+    }
+    batch->last = entry;
+    return;
+  }
+  for (link = &batch->first; compare_files(*link, entry) <= 0; link = &(*link)->next)
+  {
+  }
+  entry->next = *link;
+  *link = entry;
+}
+
+/* IoErr() after a call that failed, never 0 */
+static LONG failure_code(void)
+{
+  LONG error = IoErr();
+
+  return error != 0 ? error : ERROR_OBJECT_NOT_FOUND;
+}
+
+/* Locks the directory part of a path; an empty one is the current directory */
+static BPTR lock_directory(const struct BatchFile *entry)
+{
+  char directory[256];
+  ULONG length = entry->directory_length;
+
+  if (length >= sizeof(directory))
+  {
+    SetIoErr(ERROR_OBJECT_TOO_LARGE);
+    return 0;
+  }
+  /* "a/b/" locks as "a/b", but "DH0:" and "/" must stay whole */
+  if (length > 1 && entry->path[length - 1] == '/' && entry->path[length - 2] != ':' && entry->path[length - 2] != '/')
+  {
+    length--;
+  }
+  memcpy(directory, entry->path, length);
+  directory[length] = '\0';
+  return Lock((CONST_STRPTR)directory, ACCESS_READ);
+}
+
+void batch_flush(struct WriteBatch *batch, BatchDoneFunc done, APTR user_data)
+{
+  struct BatchFile *entry, *group = NULL;
+  BPTR lock = 0, old_directory = 0, file;
+  LONG error, group_error = 0;
+  const char *name;
+
+  for (entry = batch->first; entry != NULL; entry = entry->next)
+  {
+    if (group == NULL || entry->directory_length != group->directory_length ||
+        strncmp(entry->path, group->path, entry->directory_length) != 0)
+    {
+      if (lock != 0)
+      {
+        CurrentDir(old_directory);
+        UnLock(lock);
+      }
+      group = entry;
+      lock = lock_directory(entry);
+      if (lock != 0)
+      {
+        old_directory = CurrentDir(lock);
+      }
+      else
+      {
+        group_error = failure_code();
+      }
+    }
+
+    if (lock == 0)
+    {
+      error = group_error;
+    }
+    else
+    {
+      name = entry->path + entry->directory_length;
+
+      /* Clear any protection bits so an older copy can be replaced */
+      SetProtection((CONST_STRPTR)name, 0);
+      file = Open((CONST_STRPTR)name, MODE_NEWFILE);
+      if (file == 0)
+      {
+        error = failure_code();
+      }
+      else
+      {
+        error = 0;
+        if (Write(file, entry->data, entry->size) != (LONG)entry->size)
+        {
+          error = failure_code();
+        }
+        if (!Close(file) && error == 0)
+        {
+          error = failure_code();
+        }
+        if (error != 0)
+        {
+          DeleteFile((CONST_STRPTR)name);
+        }
+      }
+    }
+    done(user_data, entry->file, entry->tag, entry->path, error);
+  }
+
+  if (lock != 0)
+  {
+    CurrentDir(old_directory);
+    UnLock(lock);
+  }
+  batch->first = NULL;
+  batch->last = NULL;
+  batch->used = 0;
+}
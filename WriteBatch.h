@@ -0,0 +1,62 @@
+/*
+
+  WriteBatch
+
+  Collects small decoded files in memory and writes them out together,
+  grouped by directory.  Each directory is locked once and made the
+  current directory while its files are written, so a file costs one
+  Open(), Write() and Close() of a plain name instead of every part of
+  its path being looked up again, and the disk moves between one
+  directory's blocks and their data rather than all over the volume.
+  Most of a WHDLoad install is icons, slaves and ReadMes of a few KB.
+
+  This program is released under the MIT License.
+*/
+
+#ifndef WRITEBATCH_H
+#define WRITEBATCH_H
+
+#include <exec/types.h>
+
+struct WriteBatch;
+
+/*
+ * Called for every file once it has been written, with error 0 and the
+ * file's directory as the current directory, so FilePart(path) names
+ * it; or once it has failed, with the IoErr() code in error.
+ */
+typedef void (*BatchDoneFunc)(APTR user_data, APTR file, ULONG tag, const char *path, LONG error);
+
+/* Returns NULL if out of memory.  No memory is taken for data until a file is added. */
+struct WriteBatch *batch_create(ULONG budget);
+
+/* Frees the batch; files still held are discarded, so flush first */
+void batch_free(struct WriteBatch *batch);
+
+/*
+ * Whether a file of this size belongs in the batch: it must be small
+ * next to the budget, and the memory for the batch must be available.
+ */
+BOOL batch_accepts(struct WriteBatch *batch, const char *path, ULONG size);
+
+/*
+ * Starts a file that batch_accepts() took.  Returns FALSE if the batch
+ * has no room left, in which case it should be flushed first.  file is
+ * passed back to the BatchDoneFunc.
+ */
+BOOL batch_begin_file(struct WriteBatch *batch, const char *path, ULONG size, APTR file);
+
+/* An LhaWriteFunc adding data to the file begun last */
+LONG batch_write(APTR batch, const UBYTE *data, LONG length);
+
+/*
+ * Keeps the file for the next flush, or drops it if keep is FALSE.  tag
+ * is passed back to the BatchDoneFunc, and may be something only known
+ * once the data has been written, such as a hash of it.
+ */
+void batch_end_file(struct WriteBatch *batch, BOOL keep, ULONG tag);
+
+/* Writes every file held, directory by directory, and empties the batch */
+void batch_flush(struct WriteBatch *batch, BatchDoneFunc done, APTR user_data);
+
+#endif